@@ -4,6 +4,7 @@
  * SPDX-License-Identifier: LGPL-3.0-or-later
  */
 
+#include "linglong/generator/device_inventory.h"
 #include "nlohmann/json.hpp"
 
 #include <filesystem>
@@ -47,20 +48,20 @@ int main()
     bindIfExist("/dev/dri", "");
 
     nlohmann::json videoMounts = nlohmann::json::array();
-    for (const auto &entry : std::filesystem::directory_iterator{ "/dev" }) {
-        const auto &devPath = entry.path();
-        auto devName = devPath.filename().string();
-        if ((devName.rfind("video", 0) == 0) || (devName.rfind("nvidia", 0) == 0)) {
-            auto dev = u8R"(
-            {
-                "type": "bind",
-                "options": [ "rbind" ]
-            })"_json;
-            dev["destination"] = devPath.string();
-            dev["source"] = devPath.string();
+    linglong::generator::DeviceInventory inventory{
+        "/dev",
+        linglong::generator::DeviceInventory::defaultCacheFile()
+    };
+    for (const auto &devPath : inventory.devices()) {
+        auto dev = u8R"(
+        {
+            "type": "bind",
+            "options": [ "rbind" ]
+        })"_json;
+        dev["destination"] = devPath;
+        dev["source"] = devPath;
 
-            videoMounts.emplace_back(std::move(dev));
-        }
+        videoMounts.emplace_back(std::move(dev));
     }
 
     mounts.insert(mounts.end(), videoMounts.begin(), videoMounts.end());
@@ -17,15 +17,19 @@
 #include "util/semaphore.h"
 
 #include <sys/epoll.h>
+#include <sys/eventfd.h>
 #include <sys/mount.h>
 #include <sys/prctl.h>
 #include <sys/signalfd.h>
 #include <sys/syscall.h>
 #include <sys/sysmacros.h>
 
+#include <algorithm>
 #include <cerrno>
+#include <chrono>
 #include <filesystem>
 #include <map>
+#include <optional>
 #include <utility>
 
 #include <fcntl.h>
@@ -39,50 +43,150 @@
 namespace linglong {
 
 namespace {
-int ConfigUserNamespace(const linglong::Linux &linux, int initPid)
+std::string FormatIDMap(const std::vector<IDMap> &idMaps)
 {
-    std::string pid = "self";
-    if (initPid > 0) {
-        pid = util::format("%d", initPid);
+    std::string content;
+    for (auto const &idMap : idMaps) {
+        content += util::format("%lu %lu %lu\n", idMap.containerID, idMap.hostID, idMap.size);
     }
+    return content;
+}
 
-    logDbg() << "old uid:" << getuid() << "gid:" << getgid();
-    logDbg() << "start write uid_map and pid_map" << initPid;
+// An unprivileged process can only map its own id into a user namespace, anything
+// else (subordinate id ranges, more than one line) requires newuidmap/newgidmap.
+bool NeedIDMapHelper(const std::vector<IDMap> &idMaps, uint64_t self)
+{
+    if (idMaps.size() > 1) {
+        return true;
+    }
+
+    return std::any_of(idMaps.begin(), idMaps.end(), [self](const IDMap &idMap) {
+        return idMap.hostID != self || idMap.size != 1;
+    });
+}
 
-    // write uid map
-    auto uidMap = util::format("/proc/%s/uid_map", pid.c_str());
-    std::ofstream uidMapFile(uidMap);
-    if (!uidMapFile.is_open()) {
-        logErr() << "couldn't open file" << uidMap;
+// The kernel only accepts a single write(2) to uid_map/gid_map, so the whole map
+// must be written at once.
+int WriteIDMapFile(const std::string &path, const std::string &content)
+{
+    auto fd = open(path.c_str(), O_WRONLY | O_CLOEXEC);
+    if (fd == -1) {
+        logErr() << "couldn't open file" << path << util::errnoString();
         return -1;
     }
 
-    for (auto const &idMap : linux.uidMappings) {
-        uidMapFile << util::format("%lu %lu %lu\n", idMap.containerID, idMap.hostID, idMap.size);
+    auto ret = write(fd, content.data(), content.size());
+    auto err = errno;
+    close(fd);
+    if (ret != static_cast<ssize_t>(content.size())) {
+        errno = err;
+        logErr() << "write" << path << "failed" << util::errnoString();
+        return -1;
     }
-    uidMapFile.close();
 
-    // write gid map
-    auto setgroupsPath = util::format("/proc/%s/setgroups", pid.c_str());
-    std::ofstream setgroupsFile(setgroupsPath);
-    if (!setgroupsFile.is_open()) {
-        logErr() << "couldn't open file" << setgroupsPath;
+    return 0;
+}
+
+int ExecIDMapHelper(const std::string &helper, int pid, const std::vector<IDMap> &idMaps)
+{
+    util::str_vec args{ helper, std::to_string(pid) };
+    for (auto const &idMap : idMaps) {
+        args.push_back(std::to_string(idMap.containerID));
+        args.push_back(std::to_string(idMap.hostID));
+        args.push_back(std::to_string(idMap.size));
+    }
+
+    auto helperPid = fork();
+    if (helperPid < 0) {
+        logErr() << "fork failed" << util::errnoString();
         return -1;
     }
-    setgroupsFile << "deny";
-    setgroupsFile.close();
 
-    auto gidMap = util::format("/proc/%s/gid_map", pid.c_str());
-    std::ofstream gidMapFile(gidMap);
-    if (!gidMapFile.is_open()) {
-        logErr() << "couldn't open file" << gidMap;
+    if (helperPid == 0) {
+        // util::Exec would pass an empty environment without an explicit list
+        std::vector<std::string> env;
+        for (auto it = environ; it != nullptr && *it != nullptr; ++it) {
+            env.emplace_back(*it);
+        }
+        if (env.empty()) {
+            env.emplace_back("PATH=/usr/local/sbin:/usr/local/bin:/usr/sbin:/usr/bin:/sbin:/bin");
+        }
+        util::Exec(args, env);
+        logErr() << "exec" << helper << "failed" << util::errnoString();
+        _exit(127);
+    }
+
+    int wstatus = 0;
+    if (waitpid(helperPid, &wstatus, 0) == -1) {
+        logErr() << "waitpid" << helper << "failed" << util::errnoString();
+        return -1;
+    }
+
+    if (!WIFEXITED(wstatus) || WEXITSTATUS(wstatus) != 0) {
+        logErr() << helper << "failed with wstatus" << wstatus;
+        return -1;
+    }
+
+    return 0;
+}
+
+// The nested user namespace is created by the entry process, which runs as the container id
+// mapped to the host id in the outer namespace. Without CAP_SETUID in the outer namespace only
+// that id can be mapped, so keep it unchanged inside.
+std::optional<IDMap> NestedIDMap(const std::vector<IDMap> &outerMaps, uint64_t hostID)
+{
+    for (auto const &idMap : outerMaps) {
+        if (hostID >= idMap.hostID && hostID - idMap.hostID < idMap.size) {
+            IDMap nested;
+            nested.containerID = idMap.containerID + (hostID - idMap.hostID);
+            nested.hostID = nested.containerID;
+            nested.size = 1;
+            return nested;
+        }
+    }
+
+    return std::nullopt;
+}
+
+// NOTE: Mapping of "self" is done by the process in the new user namespace, mapping
+// of another process is done from the parent namespace and may go through the setuid
+// newuidmap/newgidmap helpers, which are required for multi-range maps.
+int ConfigUserNamespace(const linglong::Linux &linux, int initPid)
+{
+    std::string pid = "self";
+    if (initPid > 0) {
+        pid = util::format("%d", initPid);
+    }
+
+    logDbg() << "old uid:" << getuid() << "gid:" << getgid();
+    logDbg() << "start write uid_map and pid_map" << initPid;
+
+    if (initPid > 0 && NeedIDMapHelper(linux.uidMappings, geteuid())) {
+        if (ExecIDMapHelper("newuidmap", initPid, linux.uidMappings) != 0) {
+            return -1;
+        }
+    } else if (WriteIDMapFile(util::format("/proc/%s/uid_map", pid.c_str()),
+                              FormatIDMap(linux.uidMappings))
+               != 0) {
         return -1;
     }
 
-    for (auto const &idMap : linux.gidMappings) {
-        gidMapFile << util::format("%lu %lu %lu\n", idMap.containerID, idMap.hostID, idMap.size);
+    if (initPid > 0 && NeedIDMapHelper(linux.gidMappings, getegid())) {
+        // newgidmap decides about setgroups itself
+        if (ExecIDMapHelper("newgidmap", initPid, linux.gidMappings) != 0) {
+            return -1;
+        }
+    } else {
+        if (WriteIDMapFile(util::format("/proc/%s/setgroups", pid.c_str()), "deny") != 0) {
+            return -1;
+        }
+
+        if (WriteIDMapFile(util::format("/proc/%s/gid_map", pid.c_str()),
+                           FormatIDMap(linux.gidMappings))
+            != 0) {
+            return -1;
+        }
     }
-    gidMapFile.close();
 
     logDbg() << "new uid:" << getuid() << "gid:" << getgid();
     return 0;
@@ -231,8 +335,10 @@ struct ContainerPrivate
         } else {
             this->hostRoot = this->runtime.root.path;
         }
+        this->bundle = bundle;
     }
 
+    std::string bundle;
     std::string hostRoot;
 
     Runtime runtime;
@@ -243,6 +349,12 @@ struct ContainerPrivate
     uid_t hostUid = -1;
     gid_t hostGid = -1;
 
+    // eventfd signaled by the parent once it has written the id maps of the entry
+    // process, -1 if the entry process maps itself.
+    int idMapReadyFd = -1;
+
+    std::chrono::steady_clock::time_point cloneTime;
+
     std::unique_ptr<HostMount> nativeMounter;
     std::unique_ptr<HostMount> overlayfsMounter;
     std::unique_ptr<HostMount> fuseproxyMounter;
@@ -449,6 +561,11 @@ struct ContainerPrivate
             }
 
             logInf() << "start exec process";
+            logDbg() << "clone to exec:"
+                     << std::chrono::duration_cast<std::chrono::microseconds>(
+                          std::chrono::steady_clock::now() - cloneTime)
+                          .count()
+                     << "us";
             if (auto ret = util::Exec(process.args, process.env); ret != 0) {
                 logErr() << "exec failed" << util::RetErrString(ret);
                 exit(ret);
@@ -520,11 +637,46 @@ struct ContainerPrivate
         return 0;
     }
 
+    [[nodiscard]] std::string annotation(const std::string &key) const
+    {
+        if (!runtime.annotations) {
+            return {};
+        }
+        auto it = runtime.annotations->find(key);
+        return it == runtime.annotations->end() ? std::string{} : it->second;
+    }
+
     int PrepareRootfs()
     {
-        nativeMounter->Setup(new NativeFilesystemDriver(this->hostRoot));
+        // NOTE(iceyer): it's not standard oci action, the rootfs becomes a writable overlay of
+        // the given lower directories when org.deepin.linglong.overlayfs.lowerdirs is set.
+        auto lowerDirs = annotation("org.deepin.linglong.overlayfs.lowerdirs");
+        if (lowerDirs.empty()) {
+            nativeMounter->Setup(new NativeFilesystemDriver(this->hostRoot));
+            containerMounter = nativeMounter.get();
+            return 0;
+        }
 
-        containerMounter = nativeMounter.get();
+        auto upperDir = annotation("org.deepin.linglong.overlayfs.upperdir");
+        if (upperDir.empty()) {
+            upperDir = bundle + "/overlayfs/upper";
+        }
+        auto workDir = annotation("org.deepin.linglong.overlayfs.workdir");
+        if (workDir.empty()) {
+            workDir = bundle + "/overlayfs/work";
+        }
+
+        auto *driver = new OverlayfsFilesystemDriver(util::str_spilt(lowerDirs, ":"),
+                                                     upperDir,
+                                                     workDir,
+                                                     this->hostRoot);
+        if (overlayfsMounter->Setup(driver) != 0) {
+            logErr() << "setup overlayfs rootfs on" << this->hostRoot << "failed";
+            return -1;
+        }
+        logDbg() << "rootfs is" << (driver->isFuse() ? "fuse-overlayfs" : "kernel overlayfs");
+
+        containerMounter = overlayfsMounter.get();
         return 0;
     }
 
@@ -571,17 +723,17 @@ int NonePrivilegeProc(void *arg)
     // TODO(iceyer): use option
 
     Linux linux;
-    IDMap idMap;
-
-    idMap.containerID = containerPrivate.hostUid;
-    idMap.hostID = containerPrivate.hostUid;
-    idMap.size = 1;
-    linux.uidMappings.push_back(idMap);
+    const auto &outer = containerPrivate.runtime.linux;
 
-    idMap.containerID = containerPrivate.hostGid;
-    idMap.hostID = containerPrivate.hostGid;
-    idMap.size = 1;
-    linux.gidMappings.push_back(idMap);
+    auto uidMap = NestedIDMap(outer.uidMappings, containerPrivate.hostUid);
+    auto gidMap = NestedIDMap(outer.gidMappings, containerPrivate.hostGid);
+    if (!uidMap || !gidMap) {
+        logErr() << "host uid" << containerPrivate.hostUid << "or gid" << containerPrivate.hostGid
+                 << "is not mapped into the container";
+        return -1;
+    }
+    linux.uidMappings.push_back(*uidMap);
+    linux.gidMappings.push_back(*gidMap);
 
     if (auto ret = ConfigUserNamespace(linux, 0); ret != 0) {
         return ret;
@@ -621,7 +773,15 @@ int EntryProc(void *arg)
 {
     auto &containerPrivate = *reinterpret_cast<ContainerPrivate *>(arg);
 
-    if (auto ret = ConfigUserNamespace(containerPrivate.runtime.linux, 0); ret != 0) {
+    if (containerPrivate.idMapReadyFd >= 0) {
+        eventfd_t value = 0;
+        auto ret = eventfd_read(containerPrivate.idMapReadyFd, &value);
+        close(containerPrivate.idMapReadyFd);
+        if (ret != 0 || value != 1) {
+            logErr() << "wait for id maps failed";
+            return -1;
+        }
+    } else if (auto ret = ConfigUserNamespace(containerPrivate.runtime.linux, 0); ret != 0) {
         return ret;
     }
 
@@ -639,8 +799,10 @@ int EntryProc(void *arg)
         return -1;
     }
 
-    // NOTE(iceyer): it's not standard oci action
-    containerPrivate.PrepareRootfs();
+    if (containerPrivate.PrepareRootfs() != 0) {
+        logErr() << "prepare rootfs failed";
+        return -1;
+    }
 
     containerPrivate.MountContainerPath();
 
@@ -727,12 +889,33 @@ int Container::Start()
 
     flags |= CLONE_NEWUSER;
 
+    const auto &linux = contanerPrivate.runtime.linux;
+    if (NeedIDMapHelper(linux.uidMappings, contanerPrivate.hostUid)
+        || NeedIDMapHelper(linux.gidMappings, contanerPrivate.hostGid)) {
+        contanerPrivate.idMapReadyFd = eventfd(0, EFD_CLOEXEC);
+        if (contanerPrivate.idMapReadyFd == -1) {
+            logErr() << "eventfd failed" << util::errnoString();
+            return -1;
+        }
+    }
+
+    contanerPrivate.cloneTime = std::chrono::steady_clock::now();
     int entryPid = util::PlatformClone(EntryProc, flags, (void *)dd_ptr.get());
     if (entryPid < 0) {
         logErr() << "clone failed" << util::RetErrString(entryPid);
         return -1;
     }
 
+    if (contanerPrivate.idMapReadyFd >= 0) {
+        // entry process blocks until the maps are written, 1 means success
+        eventfd_t value = ConfigUserNamespace(linux, entryPid) == 0 ? 1 : 2;
+        if (eventfd_write(contanerPrivate.idMapReadyFd, value) != 0) {
+            logErr() << "eventfd_write failed" << util::errnoString();
+        }
+        close(contanerPrivate.idMapReadyFd);
+        contanerPrivate.idMapReadyFd = -1;
+    }
+
     // FIXME: maybe we need c.opt.child_need_wait?
 
     if (ContainerPrivate::DropPermissions() != 0) {
@@ -742,16 +925,21 @@ int Container::Start()
     // FIXME: parent may dead before this return.
     prctl(PR_SET_PDEATHSIG, SIGKILL);
 
-    writeContainerJson(this->bundle, this->id, entryPid);
+    std::string appID;
+    const auto &annotations = contanerPrivate.runtime.annotations;
+    if (annotations) {
+        auto it = annotations->find("org.deepin.linglong.appID");
+        if (it != annotations->end()) {
+            appID = it->second;
+        }
+    }
+
+    writeContainerJson(this->bundle, this->id, appID, entryPid);
 
     // FIXME(interactive bash): if need keep interactive shell
     auto ret = util::WaitAllUntil(entryPid);
 
-    auto dir =
-      std::filesystem::path("/run") / "user" / std::to_string(getuid()) / "linglong" / "box";
-    if (!std::filesystem::remove(dir / (this->id + ".json"))) {
-        logErr() << "remove" << dir / (this->id + ".json") << "failed";
-    }
+    removeContainerJson(this->id, appID);
 
     return ret;
 }
@@ -9,10 +9,20 @@
 #include "ocppi/types/Generators.hpp"
 #include "util/logger.h"
 
-#include <filesystem>
+#include <fstream>
+
+#include <unistd.h>
 
 namespace linglong {
-void writeContainerJson(const std::string &bundle, const std::string &id, pid_t pid)
+std::filesystem::path containerJsonDir()
+{
+    return std::filesystem::path("/run") / "user" / std::to_string(getuid()) / "linglong" / "box";
+}
+
+void writeContainerJson(const std::string &bundle,
+                        const std::string &id,
+                        const std::string &appID,
+                        pid_t pid)
 {
     ocppi::types::ContainerListItem item = {
         .bundle = bundle,
@@ -21,28 +31,83 @@ void writeContainerJson(const std::string &bundle, const std::string &id, pid_t
         .status = "running",
     };
 
-    auto dir =
-      std::filesystem::path("/run") / "user" / std::to_string(getuid()) / "linglong" / "box";
+    nlohmann::json content = item;
+    if (!appID.empty()) {
+        content["appID"] = appID;
+    }
+
+    auto dir = containerJsonDir();
     std::filesystem::create_directories(dir);
     if (!std::filesystem::exists(dir)) {
         logErr() << "create_directories" << dir << "failed";
         assert(false);
     }
 
-    std::ofstream file(dir / (id + ".json"));
-    if (file.is_open()) {
-        file << nlohmann::json(item).dump(4);
-    } else {
-        logErr() << "open" << dir / (id + ".json") << "failed";
+    // NOTE: readers may watch this directory, write to a temporary file and rename it, so they
+    // never see a partially written file.
+    auto tmpFile = dir / ("." + id + ".json.tmp");
+    {
+        std::ofstream file(tmpFile);
+        if (!file.is_open()) {
+            logErr() << "open" << tmpFile << "failed";
+            assert(false);
+            return;
+        }
+        file << content.dump(4);
+    }
+
+    std::error_code ec;
+    std::filesystem::rename(tmpFile, dir / (id + ".json"), ec);
+    if (ec) {
+        logErr() << "rename" << tmpFile << "failed:" << ec.message();
         assert(false);
+        return;
+    }
+
+    if (appID.empty()) {
+        return;
+    }
+
+    auto appDir = dir / "by-app" / appID;
+    std::filesystem::create_directories(appDir, ec);
+    if (ec) {
+        logWan() << "create_directories" << appDir << "failed:" << ec.message();
+        return;
+    }
+
+    std::filesystem::create_symlink(std::filesystem::path("..") / ".." / (id + ".json"),
+                                    appDir / (id + ".json"),
+                                    ec);
+    if (ec) {
+        logWan() << "create index of" << id << "failed:" << ec.message();
+    }
+}
+
+void removeContainerJson(const std::string &id, const std::string &appID) noexcept
+{
+    auto dir = containerJsonDir();
+    std::error_code ec;
+
+    if (!appID.empty()) {
+        auto appDir = dir / "by-app" / appID;
+        std::filesystem::remove(appDir / (id + ".json"), ec);
+        if (ec) {
+            logWan() << "remove index of" << id << "failed:" << ec.message();
+        }
+
+        // only succeeds when no other container of this application is running
+        std::filesystem::remove(appDir, ec);
+    }
+
+    if (!std::filesystem::remove(dir / (id + ".json"), ec)) {
+        logErr() << "remove" << dir / (id + ".json") << "failed";
     }
 }
 
 nlohmann::json readAllContainerJson() noexcept
 {
     nlohmann::json result = nlohmann::json::array();
-    auto dir =
-      std::filesystem::path("/run") / "user" / std::to_string(getuid()) / "linglong" / "box";
+    auto dir = containerJsonDir();
 
     std::error_code ec;
     std::filesystem::create_directories(dir, ec);
@@ -51,7 +116,11 @@ nlohmann::json readAllContainerJson() noexcept
         return {};
     }
 
-    for (auto entry : std::filesystem::directory_iterator{ dir }) {
+    for (const auto &entry : std::filesystem::directory_iterator{ dir }) {
+        if (!entry.is_regular_file() || entry.path().filename().string().rfind('.', 0) == 0) {
+            continue;
+        }
+
         std::ifstream containerInfo = entry.path();
         if (!containerInfo.is_open()) {
             continue;
@@ -7,10 +7,19 @@
 #ifndef LINGLONG_BOX_CONTAINER_HELPER_H_
 #define LINGLONG_BOX_CONTAINER_HELPER_H_
 #include <nlohmann/json.hpp>
+
+#include <filesystem>
 #include <string>
 
 namespace linglong {
-void writeContainerJson(const std::string &bundle, const std::string &id, pid_t pid);
+// Containers are registered under /run/user/<uid>/linglong/box as <id>.json, and indexed by
+// application as by-app/<appID>/<id>.json which links back to the container file.
+std::filesystem::path containerJsonDir();
+void writeContainerJson(const std::string &bundle,
+                        const std::string &id,
+                        const std::string &appID,
+                        pid_t pid);
+void removeContainerJson(const std::string &id, const std::string &appID) noexcept;
 nlohmann::json readAllContainerJson() noexcept;
 }; // namespace linglong
 #endif
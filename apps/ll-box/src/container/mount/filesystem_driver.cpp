@@ -9,8 +9,12 @@
 #include "util/logger.h"
 #include "util/platform.h"
 
+#include <cstdio>
+#include <fstream>
 #include <utility>
 
+#include <sys/mount.h>
+#include <sys/utsname.h>
 #include <sys/wait.h>
 
 namespace linglong {
@@ -81,6 +85,74 @@ util::fs::path OverlayfsFuseFilesystemDriver::HostSource(const util::fs::path &d
     return dest_full_path;
 }
 
+OverlayfsFilesystemDriver::KernelSupport OverlayfsFilesystemDriver::Probe()
+{
+    std::ifstream filesystems("/proc/filesystems");
+    std::string line;
+    bool hasOverlay = false;
+    while (std::getline(filesystems, line)) {
+        if (line.size() >= 8 && line.compare(line.size() - 8, 8, "\toverlay") == 0) {
+            hasOverlay = true;
+            break;
+        }
+    }
+    if (!hasOverlay) {
+        return KernelSupport::None;
+    }
+
+    // the initial user namespace maps the whole id range, any other namespace is unprivileged
+    std::ifstream uidMap("/proc/self/uid_map");
+    unsigned long inside = 0, outside = 0, count = 0;
+    uidMap >> inside >> outside >> count;
+    if (inside == 0 && outside == 0 && count == 4294967295UL) {
+        return KernelSupport::Privileged;
+    }
+
+    // unprivileged overlayfs and "userxattr" both came with linux 5.11
+    struct utsname name = {};
+    int major = 0, minor = 0;
+    if (uname(&name) != 0 || sscanf(name.release, "%d.%d", &major, &minor) != 2) {
+        return KernelSupport::None;
+    }
+    if (major > 5 || (major == 5 && minor >= 11)) {
+        return KernelSupport::UserXattr;
+    }
+
+    return KernelSupport::None;
+}
+
+int OverlayfsFilesystemDriver::Setup()
+{
+    auto support = Probe();
+    if (support == KernelSupport::None) {
+        logDbg() << "kernel overlayfs is not usable here, use fuse-overlayfs";
+        fuse_ = true;
+        return OverlayfsFuseFilesystemDriver::Setup();
+    }
+
+    util::fs::create_directories(util::fs::path(work_dir_), 0755);
+    util::fs::create_directories(util::fs::path(upper_dir_), 0755);
+    util::fs::create_directories(util::fs::path(mount_point_), 0755);
+
+    auto data = "lowerdir=" + util::str_vec_join(lower_dirs_, ':') + ",upperdir=" + upper_dir_
+      + ",workdir=" + work_dir_;
+    // NOTE: overlayfs mounted in a non-initial user namespace can not use trusted.* xattrs, the
+    // "userxattr" option makes it store its metadata in user.overlay.* instead.
+    if (support == KernelSupport::UserXattr) {
+        data += ",userxattr";
+    }
+
+    if (mount("overlay", mount_point_.c_str(), "overlay", 0, data.c_str()) == 0) {
+        logDbg() << "mount kernel overlayfs on" << mount_point_;
+        return 0;
+    }
+
+    logWan() << "mount kernel overlayfs on" << mount_point_
+             << "failed, fallback to fuse-overlayfs:" << util::errnoString();
+    fuse_ = true;
+    return OverlayfsFuseFilesystemDriver::Setup();
+}
+
 util::fs::path NativeFilesystemDriver::HostPath(const util::fs::path &dest_full_path) const
 {
     return util::fs::path(root_path_) / dest_full_path;
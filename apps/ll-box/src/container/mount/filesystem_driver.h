@@ -37,13 +37,39 @@ public:
 
     util::fs::path HostSource(const util::fs::path &dest_full_path) const override;
 
-private:
+protected:
     util::str_vec lower_dirs_;
     std::string upper_dir_;
     std::string work_dir_;
     std::string mount_point_;
 };
 
+// OverlayfsFilesystemDriver mounts the kernel overlayfs directly, which is allowed inside a user
+// namespace since linux 5.11. If the probe says the kernel can not do it, or the mount fails, it
+// falls back to fuse-overlayfs.
+class OverlayfsFilesystemDriver : public OverlayfsFuseFilesystemDriver
+{
+public:
+    enum class KernelSupport {
+        None,
+        // privileged mount, trusted.* xattrs are available
+        Privileged,
+        // unprivileged mount in a user namespace, needs the "userxattr" option
+        UserXattr,
+    };
+
+    using OverlayfsFuseFilesystemDriver::OverlayfsFuseFilesystemDriver;
+
+    static KernelSupport Probe();
+
+    int Setup() override;
+
+    [[nodiscard]] bool isFuse() const { return fuse_; }
+
+private:
+    bool fuse_ = false;
+};
+
 class FuseProxyFilesystemDriver : public FilesystemDriver
 {
 public:
@@ -69,12 +69,7 @@ void containerJsonCleanUp()
         }
 
         if (kill(boxPid, 0) != 0) {
-            auto jsonPath = std::filesystem::path("/run") / "user" / std::to_string(getuid())
-              / "linglong" / "box" / (it->value("id", "unknown") + ".json");
-
-            if (!std::filesystem::remove(jsonPath)) {
-                logErr() << "remove" << jsonPath << "failed";
-            }
+            linglong::removeContainerJson(it->value("id", "unknown"), it->value("appID", ""));
             it = containers.erase(it);
         } else {
             ++it;
@@ -478,6 +478,7 @@ struct Runtime
     Linux linux;
     std::optional<std::vector<Mount>> mounts;
     std::optional<Hooks> hooks;
+    std::optional<std::map<std::string, std::string>> annotations;
 };
 
 inline void from_json(const nlohmann::json &j, Runtime &o)
@@ -490,6 +491,7 @@ inline void from_json(const nlohmann::json &j, Runtime &o)
     // maybe optional
     LLJS_FROM(root);
     o.hooks = optional<decltype(o.hooks)::value_type>(j, "hooks");
+    o.annotations = optional<decltype(o.annotations)::value_type>(j, "annotations");
 }
 
 inline void to_json(nlohmann::json &j, const Runtime &o)
@@ -501,6 +503,7 @@ inline void to_json(nlohmann::json &j, const Runtime &o)
     j["linux"] = o.linux;
     j["root"] = o.root;
     j["hooks"] = o.hooks;
+    j["annotations"] = o.annotations;
 }
 
 inline static Runtime fromFile(const std::string &filepath)
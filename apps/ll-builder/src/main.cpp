@@ -501,6 +501,8 @@ int main(int argc, char **argv)
               auto buildSkipCommitOutput =
                 QCommandLineOption("skip-commit-output", "skip commit build output", "");
               auto buildArch = QCommandLineOption("arch", "set the build arch", "arch");
+              auto buildForce = QCommandLineOption(
+                "force", "rebuild even if the build inputs are unchanged", "");
 
               parser.addOptions({ yamlFile,
                                   execVerbose,
@@ -509,7 +511,8 @@ int main(int argc, char **argv)
                                   buildSkipPullDepend,
                                   buildSkipRunContainer,
                                   buildSkipCommitOutput,
-                                  buildArch });
+                                  buildArch,
+                                  buildForce });
 
               parser.addPositionalArgument("build", "build project", "build");
               parser.setApplicationDescription("linglong build command tools\n"
@@ -561,6 +564,11 @@ int main(int argc, char **argv)
                   cfg.skipCommitOutput = true;
                   builder.setConfig(cfg);
               }
+              if (parser.isSet(buildForce)) {
+                  auto cfg = builder.getConfig();
+                  cfg.force = true;
+                  builder.setConfig(cfg);
+              }
               if (parser.isSet(buildOffline)) {
                   auto cfg = builder.getConfig();
                   cfg.skipFetchSource = true;
@@ -599,7 +607,11 @@ int main(int argc, char **argv)
               auto execVerbose =
                 QCommandLineOption("exec", "run exec than build script", "command");
               auto buildOffline = QCommandLineOption("offline", "only use local files.", "");
-              parser.addOptions({ yamlFile, execVerbose, buildOffline });
+              auto traceAccess = QCommandLineOption(
+                "trace-access",
+                "record files of base and runtime opened by the application for export --minify",
+                "");
+              parser.addOptions({ yamlFile, execVerbose, buildOffline, traceAccess });
 
               parser.addPositionalArgument("run", "run project", "build");
 
@@ -627,7 +639,7 @@ int main(int argc, char **argv)
                   cfg.offline = true;
                   builder.setConfig(cfg);
               }
-              auto result = builder.run(exec);
+              auto result = builder.run(exec, parser.isSet(traceAccess));
               if (!result) {
                   qCritical() << result.error();
                   return -1;
@@ -647,7 +659,20 @@ int main(int argc, char **argv)
                                    "linglong.yaml");
               auto iconFile = QCommandLineOption({ "i", "icon" }, "uab icon (optional)", "path");
               auto layerMode = QCommandLineOption({ "l", "layer" }, "export layer file");
-              parser.addOptions({ yamlFile, iconFile, layerMode });
+              auto compressor = QCommandLineOption(
+                { "z", "compressor" },
+                "compressor of uab bundle: none, lz4, lz4hc, lzma, zstd, fast (lz4hc) or small "
+                "(lzma), default is lz4hc",
+                "name");
+              auto minify = QCommandLineOption(
+                "minify",
+                "only embed files of base and runtime recorded by run --trace-access");
+              auto minifyAllowlist = QCommandLineOption(
+                "minify-allowlist",
+                "file of wildcard patterns, matched files are always embedded when minifying",
+                "path");
+              parser.addOptions(
+                { yamlFile, iconFile, layerMode, compressor, minify, minifyAllowlist });
               parser.process(app);
 
               auto project = parseProjectConfig(QDir().absoluteFilePath(parser.value(yamlFile)));
@@ -674,7 +699,12 @@ int main(int argc, char **argv)
 
               auto result = builder.exportUAB(
                 QDir::currentPath(),
-                { .iconPath = parser.value(iconFile), .exportDevelop = true, .exportI18n = true });
+                { .iconPath = parser.value(iconFile),
+                  .exportDevelop = true,
+                  .exportI18n = true,
+                  .compressor = parser.value(compressor),
+                  .minify = parser.isSet(minify),
+                  .minifyAllowlist = parser.value(minifyAllowlist) });
               if (!result) {
                   qCritical() << result.error();
                   return -1;
@@ -693,6 +723,12 @@ int main(int argc, char **argv)
                                            "extract");
               parser.addPositionalArgument("layer", "layer file path", "[layer]");
               parser.addPositionalArgument("destination", "destination directory", "[destination]");
+              auto methodOpt = QCommandLineOption(
+                "method",
+                "how to extract the layer: fsck (fsck.erofs), fuse (erofsfuse and cp) or auto",
+                "method",
+                "auto");
+              parser.addOption(methodOpt);
 
               parser.process(app);
 
@@ -703,6 +739,16 @@ int main(int argc, char **argv)
                   parser.showHelp(-1);
               }
 
+              const QMap<QString, linglong::package::ExtractMethod> methods{
+                  { "auto", linglong::package::ExtractMethod::Auto },
+                  { "fsck", linglong::package::ExtractMethod::Fsck },
+                  { "fuse", linglong::package::ExtractMethod::Fuse },
+              };
+              if (!methods.contains(parser.value(methodOpt))) {
+                  qCritical() << "unknown extract method" << parser.value(methodOpt);
+                  parser.showHelp(-1);
+              }
+
               auto project =
                 linglong::utils::serialize::LoadYAMLFile<linglong::api::types::v1::BuilderProject>(
                   QDir().absoluteFilePath("linglong.yaml"));
@@ -716,7 +762,8 @@ int main(int argc, char **argv)
                                                  repo,
                                                  *containerBuidler,
                                                  *builderCfg);
-              auto result = builder.extractLayer(layerPath, destination);
+              auto result =
+                builder.extractLayer(layerPath, destination, methods.value(parser.value(methodOpt)));
               if (!result) {
                   qCritical() << result.error();
                   return -1;
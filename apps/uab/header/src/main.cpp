@@ -19,7 +19,9 @@
 #include <optional>
 
 #include <fcntl.h>
+#include <sys/file.h>
 #include <sys/stat.h>
+#include <sys/syscall.h>
 #include <sys/wait.h>
 #include <unistd.h>
 
@@ -84,31 +86,153 @@ std::string detectLinglong() noexcept
     return cliPath;
 }
 
-int importSelf(const std::string &cliBin, const char *uab) noexcept
+std::filesystem::path runtimeDir() noexcept
 {
+    const char *runtimeDirPtr{ nullptr };
+    runtimeDirPtr = ::getenv("XDG_RUNTIME_DIR");
+    if (runtimeDirPtr == nullptr) {
+        std::cerr << "failed to get XDG_RUNTIME_DIR, fallback to /tmp" << std::endl;
+        runtimeDirPtr = "/tmp";
+    }
+
+    return resolveRealPath(runtimeDirPtr);
+}
+
+// 同一个uab同时只运行一个导入进程。锁文件放在XDG_RUNTIME_DIR下，
+// 导入进程继承锁的描述符，持有锁直到ll-cli退出。返回-1表示已有导入进程在运行或者加锁失败
+int lockImport(const std::string &uuid) noexcept
+{
+    auto lockDir = runtimeDir() / "linglong/UAB";
+    std::error_code ec;
+    std::filesystem::create_directories(lockDir, ec);
+    if (ec) {
+        std::cerr << "create " << lockDir << ": " << ec.message() << std::endl;
+        return -1;
+    }
+
+    auto lockPath = lockDir / (uuid + ".import.lock");
+    auto fd = ::open(lockPath.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+    if (fd == -1) {
+        std::cerr << "open " << lockPath << ": " << strerror(errno) << std::endl;
+        return -1;
+    }
+
+    if (::flock(fd, LOCK_EX | LOCK_NB) == -1) {
+        if (errno != EWOULDBLOCK) {
+            std::cerr << "lock " << lockPath << ": " << strerror(errno) << std::endl;
+        }
+        ::close(fd);
+        return -1;
+    }
+
+    return fd;
+}
+
+// 在后台把uab导入玲珑，不阻塞应用的启动。导入进程脱离当前会话并降低CPU和IO优先级，
+// 应用退出后导入仍会继续，导入完成后再次启动时会直接使用玲珑中的应用
+void importSelfInBackground(const std::string &cliBin,
+                            const char *uab,
+                            const std::string &uuid) noexcept
+{
+    auto lockFd = lockImport(uuid);
+    if (lockFd == -1) {
+        return;
+    }
+
     auto pid = fork();
     if (pid < 0) {
         std::cerr << "fork() failed:" << strerror(errno) << std::endl;
-        return -1;
+        ::close(lockFd);
+        return;
     }
 
     if (pid == 0) {
-        return ::execl(cliBin.c_str(), cliBin.c_str(), "install", uab, nullptr);
+        // 再fork一次，导入进程由init回收，不需要等待
+        if (::setsid() == -1 || fork() != 0) {
+            ::_exit(0);
+        }
+
+        constexpr auto ioprioWhoProcess = 1;
+        constexpr auto ioprioClassIdle = 3;
+        constexpr auto ioprioClassShift = 13;
+        (void)::nice(19);
+        ::syscall(SYS_ioprio_set, ioprioWhoProcess, 0, ioprioClassIdle << ioprioClassShift);
+
+        auto *verbose = ::getenv("UAB_IMPORT_VERBOSE");
+        auto nullFd = ::open("/dev/null", O_RDWR);
+        if (nullFd != -1) {
+            ::dup2(nullFd, STDIN_FILENO);
+            if (verbose == nullptr) {
+                ::dup2(nullFd, STDOUT_FILENO);
+                ::dup2(nullFd, STDERR_FILENO);
+            }
+        }
+
+        ::fcntl(lockFd, F_SETFD, 0);
+        ::execl(cliBin.c_str(), cliBin.c_str(), "install", uab, nullptr);
+        ::_exit(errno);
     }
 
+    // 锁属于打开的文件，导入进程仍然持有同一个文件，关闭这里的描述符不会释放锁
+    ::close(lockFd);
     int status{ 0 };
-    auto ret = ::waitpid(pid, &status, 0);
-    if (ret == -1) {
+    if (::waitpid(pid, &status, 0) == -1) {
         std::cerr << "wait failed:" << strerror(errno) << std::endl;
-        return -1;
+    }
+}
+
+const nlohmann::json *findAppLayer(const nlohmann::json &metaInfo) noexcept
+{
+    if (!metaInfo.contains("layers") || !metaInfo["layers"].is_array()) {
+        std::cerr << "couldn't get layers info from metaInfo" << std::endl;
+        return nullptr;
     }
 
-    if (auto result = WEXITSTATUS(status); result != 0) {
-        std::cerr << "ll-cli install failed, return code:" << result << std::endl;
-        ::exit(-1);
+    for (const auto &layer : metaInfo["layers"]) {
+        if (!layer.is_object() || !layer.contains("info") || !layer["info"].is_object()) {
+            continue;
+        }
+
+        const auto &infoRef = layer["info"];
+        if (infoRef.contains("kind") && infoRef["kind"] == "app") {
+            return &layer;
+        }
     }
 
-    return 0;
+    std::cerr << "couldn't find application layer" << std::endl;
+    return nullptr;
+}
+
+// 检查uab是否已经导入到玲珑，只检查玲珑仓库中应用layer的检出目录，不需要启动ll-cli。
+// layer的检出目录在导入事务提交之前就已经存在，不能说明导入已经完成。
+// ll-package-manager在导入事务提交之后才在应用layer中写入.uab-<uuid>标记；
+// 应用已经从仓库、其他uab或者旧版本的玲珑安装时，后台导入也只会补上这个标记，见installFromUAB。
+// 这种情况下应用使用的依赖不一定是uab中的版本，所以不再检查依赖的检出目录
+bool importedToLinglong(const nlohmann::json &metaInfo) noexcept
+{
+    const auto *rootPtr = ::getenv("LINGLONG_ROOT");
+    std::filesystem::path layersDir{ rootPtr != nullptr ? rootPtr : "/var/lib/linglong" };
+    layersDir /= "layers";
+
+    const auto *appLayer = findAppLayer(metaInfo);
+    if (appLayer == nullptr) {
+        return false;
+    }
+
+    try {
+        const auto &uuid = metaInfo.at("uuid").get<std::string>();
+        const auto &info = appLayer->at("info");
+        auto layerDir = layersDir / info.at("channel").get<std::string>()
+          / info.at("id").get<std::string>() / info.at("version").get<std::string>()
+          / info.at("arch").at(0).get<std::string>()
+          / info.at("packageInfoV2Module").get<std::string>();
+
+        std::error_code ec;
+        return std::filesystem::exists(layerDir / (".uab-" + uuid), ec);
+    } catch (nlohmann::json::exception &e) {
+        std::cerr << "invalid layers info in metaInfo: " << e.what() << std::endl;
+        return false;
+    }
 }
 
 std::optional<GElf_Shdr> getSectionHeader(int elfFd, const char *sectionName) noexcept
@@ -402,15 +526,7 @@ void handleSig() noexcept
 
 int createMountPoint(const std::string &uuid) noexcept
 {
-    const char *runtimeDirPtr{ nullptr };
-    runtimeDirPtr = ::getenv("XDG_RUNTIME_DIR");
-    if (runtimeDirPtr == nullptr) {
-        std::cerr << "failed to get XDG_RUNTIME_DIR, fallback to /tmp" << std::endl;
-        runtimeDirPtr = "/tmp";
-    }
-
-    auto mountPointPath =
-      std::filesystem::path{ resolveRealPath(runtimeDirPtr) } / "linglong/UAB" / uuid;
+    auto mountPointPath = runtimeDir() / "linglong/UAB" / uuid;
 
     std::error_code ec;
     if (!std::filesystem::create_directories(mountPointPath, ec)) {
@@ -768,33 +884,11 @@ int main(int argc, char **argv)
         cleanAndExit(extractBundle(opts.extractPath));
     }
 
+    // 已经导入到玲珑时直接交给玲珑运行，否则先从uab中运行应用，同时在后台导入
     auto cliPath = detectLinglong();
-    if (!cliPath.empty() && importSelf(cliPath, selfBin) == 0) {
-        std::cout << "import uab to linglong successfully, delegate running operation to linglong"
-                  << std::endl;
-
-        if (!metaInfo.contains("layers") || !metaInfo["layers"].is_array()) {
-            std::cerr << "couldn't get layers info from metaInfo" << std::endl;
-            return -1;
-        }
-
-        const auto &layersRef = metaInfo["layers"].get<std::vector<nlohmann::json>>();
-        const auto &appLayer =
-          std::find_if(layersRef.cbegin(), layersRef.cend(), [](const nlohmann::json &layer) {
-              if (!layer.is_object() || !layer.contains("info") || !layer["info"].is_object()) {
-                  return false;
-              }
-
-              const auto &infoRef = layer["info"];
-              if (!infoRef.contains("kind")) {
-                  return false;
-              }
-
-              return infoRef["kind"] == "app";
-          });
-
-        if (appLayer == layersRef.cend()) {
-            std::cerr << "couldn't find application layer" << std::endl;
+    if (!cliPath.empty() && importedToLinglong(metaInfo)) {
+        const auto *appLayer = findAppLayer(metaInfo);
+        if (appLayer == nullptr) {
             return -1;
         }
 
@@ -806,5 +900,14 @@ int main(int argc, char **argv)
         cleanAndExit(-1);
     }
 
+    if (!cliPath.empty()) {
+        auto uabPath = resolveRealPath("/proc/self/exe");
+        if (!uabPath.empty()) {
+            importSelfInBackground(cliPath,
+                                   uabPath.c_str(),
+                                   metaInfo["uuid"].get<std::string>());
+        }
+    }
+
     runAppLoader(metaInfo, opts.loaderArgs);
 }
@@ -9,16 +9,26 @@
 
 #include <nlohmann/json.hpp>
 
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
 #include <exception>
 #include <filesystem>
 #include <fstream>
 #include <iostream>
+#include <optional>
 #include <random>
 #include <string>
-#include <thread>
 #include <utility>
+#include <vector>
 
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
 #include <sys/stat.h>
+#include <sys/syscall.h>
 #include <sys/wait.h>
 #include <unistd.h>
 
@@ -111,154 +121,364 @@ void applyJSONFilePatch(ocppi::runtime::config::types::Config &cfg,
     applyJSONPatch(cfg, patch);
 }
 
-void applyExecutablePatch(ocppi::runtime::config::types::Config &cfg,
-                          const std::filesystem::path &info) noexcept
+// 生成器的运行状态，多个生成器同时运行，由poll驱动读写管道和等待退出
+struct Generator
+{
+    std::filesystem::path path;
+    pid_t pid{ -1 };
+    int pidfd{ -1 };
+    int in{ -1 };
+    int out{ -1 };
+    int err{ -1 };
+    std::string input;
+    std::size_t written{ 0 };
+    std::string stdoutData;
+    std::string stderrData;
+    bool exited{ false };
+    bool failed{ false };
+    int wstatus{ -1 };
+    std::chrono::steady_clock::time_point start;
+    std::chrono::steady_clock::time_point end;
+};
+
+void closeFd(int &fd) noexcept
+{
+    if (fd != -1) {
+        ::close(fd);
+        fd = -1;
+    }
+}
+
+std::chrono::milliseconds generatorTimeout() noexcept
+{
+    // 单个生成器从启动到退出的最长时间，可以通过环境变量调整，单位为毫秒
+    constexpr std::chrono::milliseconds defaultTimeout{ 200 };
+    auto *env = ::getenv("LINGLONG_UAB_GENERATOR_TIMEOUT");
+    if (env == nullptr) {
+        return defaultTimeout;
+    }
+
+    char *endPtr{ nullptr };
+    auto value = std::strtol(env, &endPtr, 10);
+    if (endPtr == env || *endPtr != '\0' || value <= 0) {
+        std::cerr << "invalid LINGLONG_UAB_GENERATOR_TIMEOUT " << env << ", use "
+                  << defaultTimeout.count() << "ms" << std::endl;
+        return defaultTimeout;
+    }
+
+    return std::chrono::milliseconds{ value };
+}
+
+bool startGenerator(Generator &gen) noexcept
 {
     std::array<int, 2> inPipe{ -1, -1 };
     std::array<int, 2> outPipe{ -1, -1 };
     std::array<int, 2> errPipe{ -1, -1 };
-    if (::pipe(outPipe.data()) == -1) {
-        std::cerr << "pipe error:" << strerror(errno) << std::endl;
-        return;
-    }
+    auto closePipes = [&]() noexcept {
+        for (auto *pipe : { &inPipe, &outPipe, &errPipe }) {
+            closeFd((*pipe)[0]);
+            closeFd((*pipe)[1]);
+        }
+    };
 
-    if (::pipe(errPipe.data()) == -1) {
-        std::cerr << "pipe error:" << strerror(errno) << std::endl;
-        return;
+    // O_CLOEXEC避免同时运行的其他生成器继承管道，导致读不到EOF
+    for (auto *pipe : { &inPipe, &outPipe, &errPipe }) {
+        if (::pipe2(pipe->data(), O_CLOEXEC) == -1) {
+            std::cerr << "pipe error:" << strerror(errno) << std::endl;
+            closePipes();
+            return false;
+        }
     }
 
-    if (::pipe(inPipe.data()) == -1) {
-        std::cerr << "pipe error:" << strerror(errno) << std::endl;
-        return;
+    gen.start = std::chrono::steady_clock::now();
+    auto pid = fork();
+    if (pid < 0) {
+        std::cerr << "fork error:" << strerror(errno) << std::endl;
+        closePipes();
+        return false;
     }
 
-    auto pid = fork();
     if (pid == 0) {
+        ::signal(SIGPIPE, SIG_DFL);
         ::dup2(inPipe[0], STDIN_FILENO);
         ::dup2(outPipe[1], STDOUT_FILENO);
         ::dup2(errPipe[1], STDERR_FILENO);
 
-        ::close(inPipe[1]);
-        ::close(errPipe[0]);
-        ::close(outPipe[0]);
+        ::execl(gen.path.c_str(), gen.path.c_str(), nullptr);
+        std::cerr << "execl " << gen.path << " error:" << strerror(errno) << std::endl;
+        ::_exit(127);
+    }
 
-        if (::execl(info.c_str(), info.c_str(), nullptr) == -1) {
-            std::cerr << "execl " << info << " error:" << strerror(errno) << std::endl;
-            return;
-        }
-    } else if (pid < 0) {
-        std::cerr << "fork error:" << strerror(errno) << std::endl;
-        return;
+    gen.pid = pid;
+    gen.in = inPipe[1];
+    gen.out = outPipe[0];
+    gen.err = errPipe[0];
+    closeFd(inPipe[0]);
+    closeFd(outPipe[1]);
+    closeFd(errPipe[1]);
+    for (auto fd : { gen.in, gen.out, gen.err }) {
+        ::fcntl(fd, F_SETFL, ::fcntl(fd, F_GETFL) | O_NONBLOCK);
     }
 
-    ::close(inPipe[0]);
-    ::close(errPipe[1]);
-    ::close(outPipe[1]);
+    // 旧内核或者旧的内核头文件不支持pidfd时退回到定时调用waitpid
+#ifdef SYS_pidfd_open
+    gen.pidfd = static_cast<int>(::syscall(SYS_pidfd_open, pid, 0));
+#endif
+    return true;
+}
 
-    auto input = nlohmann::json(cfg).dump();
-    auto bytesWrite = input.size();
+// 读取管道中已有的数据，返回false表示管道已经关闭或者出错
+bool drainPipe(int fd, std::string &data) noexcept
+{
+    std::array<char, 4096> buf{};
     while (true) {
-        auto writeBytes = ::write(inPipe[1], input.c_str(), bytesWrite);
-        if (writeBytes == -1) {
-            if (errno == EAGAIN) {
-                continue;
-            }
+        auto reads = ::read(fd, buf.data(), buf.size());
+        if (reads > 0) {
+            data.append(buf.data(), reads);
+            continue;
+        }
+
+        if (reads == -1 && errno == EINTR) {
+            continue;
+        }
+
+        if (reads == -1 && errno == EAGAIN) {
+            return true;
+        }
 
+        if (reads == -1) {
+            std::cerr << "read error:" << strerror(errno) << std::endl;
+        }
+        return false;
+    }
+}
+
+void writeInput(Generator &gen) noexcept
+{
+    while (gen.written < gen.input.size()) {
+        auto writeBytes =
+          ::write(gen.in, gen.input.data() + gen.written, gen.input.size() - gen.written);
+        if (writeBytes == -1 && errno == EINTR) {
+            continue;
+        }
+
+        if (writeBytes == -1 && errno == EAGAIN) {
             return;
         }
 
-        bytesWrite -= writeBytes;
-        if (bytesWrite == 0) {
+        // 生成器没有读完输入就退出时会得到EPIPE，由退出码决定结果
+        if (writeBytes == -1) {
             break;
         }
+
+        gen.written += writeBytes;
     }
-    ::close(inPipe[1]);
 
-    using namespace std::chrono_literals;
-    auto timeout = 200;
+    closeFd(gen.in);
+}
+
+void reapGenerator(Generator &gen, int options) noexcept
+{
     int wstatus{ -1 };
-    std::string err;
-    std::string out;
+    pid_t ret{ -1 };
+    do {
+        ret = ::waitpid(gen.pid, &wstatus, options);
+    } while (ret == -1 && errno == EINTR);
 
-    while (true) {
-        std::this_thread::sleep_for(50ms);
-        int child{ -1 };
-        if (child = ::waitpid(pid, &wstatus, WNOHANG); child == -1) {
-            std::cerr << "wait for process error:" << strerror(errno) << std::endl;
-            return;
+    if (ret == -1) {
+        std::cerr << "wait for process error:" << strerror(errno) << std::endl;
+        gen.failed = true;
+    }
+
+    if (ret == 0) {
+        return;
+    }
+
+    gen.exited = true;
+    gen.wstatus = wstatus;
+    gen.end = std::chrono::steady_clock::now();
+    closeFd(gen.pidfd);
+
+    // 进程退出前写入的数据都在管道里，读完即可，不再等待可能继承了管道的子进程
+    if (gen.out != -1) {
+        drainPipe(gen.out, gen.stdoutData);
+    }
+    if (gen.err != -1) {
+        drainPipe(gen.err, gen.stderrData);
+    }
+    closeFd(gen.in);
+    closeFd(gen.out);
+    closeFd(gen.err);
+}
+
+void runGenerators(std::vector<Generator> &gens, std::chrono::milliseconds timeout) noexcept
+{
+    // 生成器提前退出时写stdin会触发SIGPIPE，运行期间忽略它
+    auto *oldHandler = ::signal(SIGPIPE, SIG_IGN);
+    defer restoreHandler{ [oldHandler]() noexcept {
+        ::signal(SIGPIPE, oldHandler);
+    } };
+
+    for (auto &gen : gens) {
+        if (!startGenerator(gen)) {
+            gen.failed = true;
         }
+    }
+
+    std::vector<struct pollfd> fds;
+    std::vector<std::pair<Generator *, int *>> owners;
+    while (true) {
+        fds.clear();
+        owners.clear();
+        bool polling{ false };
+        auto now = std::chrono::steady_clock::now();
+        auto nextDeadline = now + timeout;
+        for (auto &gen : gens) {
+            if (gen.failed || gen.exited) {
+                continue;
+            }
 
-        if (child == 0) {
-            timeout -= 50;
-            if (timeout == 0) {
-                std::cerr << "generator " << info << " timeout" << std::endl;
-                return;
+            if (now - gen.start >= timeout) {
+                std::cerr << "generator " << gen.path << " timeout after " << timeout.count()
+                          << "ms, see LINGLONG_UAB_GENERATOR_TIMEOUT" << std::endl;
+                ::kill(gen.pid, SIGKILL);
+                reapGenerator(gen, 0);
+                gen.failed = true;
+                continue;
             }
-            continue;
-        }
 
-        std::array<char, 4096> buf{};
-        int reads{ -1 };
-        while ((reads = ::read(errPipe[0], buf.data(), buf.size())) != 0) {
-            if (reads < 0) {
-                if (errno == EAGAIN) {
-                    continue;
+            polling = true;
+            nextDeadline = std::min(nextDeadline, gen.start + timeout);
+            if (gen.in != -1) {
+                fds.push_back({ gen.in, POLLOUT, 0 });
+                owners.emplace_back(&gen, &gen.in);
+            }
+            for (auto *fd : { &gen.out, &gen.err, &gen.pidfd }) {
+                if (*fd != -1) {
+                    fds.push_back({ *fd, POLLIN, 0 });
+                    owners.emplace_back(&gen, fd);
                 }
-                std::cerr << "read error:" << strerror(errno) << std::endl;
-                return;
             }
+        }
 
-            std::copy_n(buf.cbegin(), reads, std::back_inserter(err));
+        if (!polling) {
+            break;
         }
 
-        reads = -1;
-        while ((reads = ::read(outPipe[0], buf.data(), buf.size())) != 0) {
-            if (reads < 0) {
-                if (errno == EAGAIN) {
-                    continue;
+        auto wait =
+          std::chrono::duration_cast<std::chrono::milliseconds>(nextDeadline - now).count() + 1;
+        // 没有pidfd的生成器只能定时检查是否退出
+        auto fallback = std::any_of(gens.cbegin(), gens.cend(), [](const Generator &gen) {
+            return !gen.failed && !gen.exited && gen.pidfd == -1;
+        });
+        if (fallback) {
+            wait = std::min<decltype(wait)>(wait, 5);
+        }
+
+        auto ret = ::poll(fds.data(), fds.size(), static_cast<int>(wait));
+        if (ret == -1 && errno != EINTR) {
+            std::cerr << "poll error:" << strerror(errno) << std::endl;
+            for (auto &gen : gens) {
+                if (!gen.failed && !gen.exited) {
+                    ::kill(gen.pid, SIGKILL);
+                    reapGenerator(gen, 0);
+                    gen.failed = true;
                 }
-                std::cerr << "read error:" << strerror(errno) << std::endl;
-                return;
+            }
+            break;
+        }
+
+        for (std::size_t i = 0; ret > 0 && i < fds.size(); ++i) {
+            if (fds[i].revents == 0) {
+                continue;
+            }
+
+            auto &[gen, fd] = owners[i];
+            if (gen->exited || *fd == -1) {
+                continue;
             }
 
-            std::copy_n(buf.cbegin(), reads, std::back_inserter(out));
+            if (fd == &gen->in) {
+                writeInput(*gen);
+            } else if (fd == &gen->pidfd) {
+                reapGenerator(*gen, WNOHANG);
+            } else if (!drainPipe(*fd, fd == &gen->out ? gen->stdoutData : gen->stderrData)) {
+                closeFd(*fd);
+            }
+        }
+
+        for (auto &gen : gens) {
+            if (!gen.failed && !gen.exited && gen.pidfd == -1) {
+                reapGenerator(gen, WNOHANG);
+            }
         }
+    }
+}
 
-        break;
+// 检查生成器的结果，成功时返回修改后的配置
+std::optional<nlohmann::json> generatorOutput(const Generator &gen) noexcept
+{
+    if (gen.failed || !gen.exited) {
+        return std::nullopt;
     }
 
-    auto exitCode = WEXITSTATUS(wstatus);
-    if (exitCode != 0) {
-        std::cerr << "generator " << info << " return " << exitCode << std::endl;
-        std::cerr << "input:" << input << "stderr:" << err << std::endl;
-        return;
+    if (!WIFEXITED(gen.wstatus) || WEXITSTATUS(gen.wstatus) != 0) {
+        std::cerr << "generator " << gen.path << " return "
+                  << (WIFEXITED(gen.wstatus) ? WEXITSTATUS(gen.wstatus) : -WTERMSIG(gen.wstatus))
+                  << std::endl;
+        std::cerr << "input:" << gen.input << "stderr:" << gen.stderrData << std::endl;
+        return std::nullopt;
     }
 
-    if (!err.empty()) {
-        std::cerr << "generator " << info << " stderr:" << err << std::endl;
+    if (!gen.stderrData.empty()) {
+        std::cerr << "generator " << gen.path << " stderr:" << gen.stderrData << std::endl;
     }
 
-    nlohmann::json modified;
     try {
-        auto content = nlohmann::json::parse(out);
-        modified = content.get<ocppi::runtime::config::types::Config>();
+        auto content = nlohmann::json::parse(gen.stdoutData);
+        return nlohmann::json(content.get<ocppi::runtime::config::types::Config>());
     } catch (nlohmann::json::parse_error &e) {
         std::cerr << "parse output error: " << e.what() << std::endl;
-        return;
     } catch (...) {
         std::cerr << "unknown exception occurred during parsing output" << std::endl;
+    }
+
+    return std::nullopt;
+}
+
+void applyExecutablePatch(ocppi::runtime::config::types::Config &cfg,
+                          const std::filesystem::path &info) noexcept
+{
+    std::vector<Generator> gens(1);
+    gens[0].path = info;
+    gens[0].input = nlohmann::json(cfg).dump();
+    runGenerators(gens, generatorTimeout());
+
+    auto modified = generatorOutput(gens[0]);
+    if (!modified) {
         return;
     }
 
-    ::close(errPipe[0]);
-    ::close(outPipe[0]);
+    cfg = modified->get<ocppi::runtime::config::types::Config>();
+}
 
-    cfg = std::move(modified);
+// 文件名以.independent结尾的生成器声明自己不依赖其他补丁和生成器的修改
+bool isIndependentGenerator(const std::filesystem::path &path) noexcept
+{
+    std::string_view suffix{ ".independent" };
+    auto fileName = path.filename().string();
+    return fileName.size() > suffix.size()
+      && fileName.compare(fileName.size() - suffix.size(), suffix.size(), suffix) == 0;
 }
 
+// 补丁和生成器按文件名顺序依次应用，每个生成器的输入都是前面所有补丁和生成器处理后的配置。
+// 只有声明了independent的生成器会以初始配置为输入提前并发运行，到了它在文件名顺序中的位置时，
+// 如果配置仍然是初始配置就直接采用它的输出，否则在当前配置上重新运行一次。
+// 不能把它的修改以JSON diff合并到当前配置，diff中数组按下标修改，会打乱挂载顺序
 void applyPatches(ocppi::runtime::config::types::Config &cfg,
                   const std::vector<std::filesystem::path> &patches) noexcept
 {
+    std::vector<std::pair<std::filesystem::path, bool>> sorted;
     std::error_code ec;
     for (const auto &info : patches) {
         if (!std::filesystem::is_regular_file(info, ec)) {
@@ -282,12 +502,74 @@ void applyPatches(ocppi::runtime::config::types::Config &cfg,
         }
 
         auto mode = fileStat.st_mode;
-        if ((mode & S_IXUSR) || (mode & S_IXGRP) || (mode & S_IXOTH)) {
-            applyExecutablePatch(cfg, info);
+        sorted.emplace_back(info, (mode & S_IXUSR) || (mode & S_IXGRP) || (mode & S_IXOTH));
+    }
+    std::sort(sorted.begin(), sorted.end());
+
+    auto initial = nlohmann::json(cfg);
+    auto input = initial.dump();
+    std::vector<Generator> independents;
+    for (const auto &[path, executable] : sorted) {
+        if (executable && isIndependentGenerator(path)) {
+            independents.emplace_back().path = path;
+            independents.back().input = input;
+        }
+    }
+
+    const auto debug = ::getenv("LINGLONG_UAB_DEBUG") != nullptr;
+    auto ms = [](auto duration) {
+        return std::chrono::duration<double, std::milli>(duration).count();
+    };
+    auto begin = std::chrono::steady_clock::now();
+    runGenerators(independents, generatorTimeout());
+    if (debug) {
+        for (const auto &gen : independents) {
+            if (gen.exited) {
+                std::cout << "generator " << gen.path << ": " << ms(gen.end - gen.start) << "ms"
+                          << std::endl;
+            }
+        }
+    }
+
+    auto independent = independents.cbegin();
+    for (const auto &[path, executable] : sorted) {
+        if (!executable) {
+            applyJSONFilePatch(cfg, path);
             continue;
         }
 
-        applyJSONFilePatch(cfg, info);
+        if (!isIndependentGenerator(path)) {
+            auto start = std::chrono::steady_clock::now();
+            applyExecutablePatch(cfg, path);
+            if (debug) {
+                std::cout << "generator " << path << ": "
+                          << ms(std::chrono::steady_clock::now() - start) << "ms" << std::endl;
+            }
+            continue;
+        }
+
+        const auto &gen = *independent++;
+        if (nlohmann::json(cfg) != initial) {
+            if (debug) {
+                std::cout << "configuration changed before generator " << path << ", run it again"
+                          << std::endl;
+            }
+            applyExecutablePatch(cfg, path);
+            continue;
+        }
+
+        auto modified = generatorOutput(gen);
+        if (!modified) {
+            continue;
+        }
+
+        cfg = modified->get<ocppi::runtime::config::types::Config>();
+    }
+
+    if (debug) {
+        std::cout << "apply " << sorted.size()
+                  << " patches: " << ms(std::chrono::steady_clock::now() - begin) << "ms"
+                  << std::endl;
     }
 }
 
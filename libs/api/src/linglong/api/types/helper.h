@@ -14,7 +14,7 @@ namespace linglong::api::types::v1 {
 inline bool operator==(const RepoConfig &cfg1, const RepoConfig &cfg2) noexcept
 {
     return cfg1.version == cfg2.version && cfg1.repos == cfg2.repos
-      && cfg1.defaultRepo == cfg2.defaultRepo;
+      && cfg1.defaultRepo == cfg2.defaultRepo && cfg1.hardlinkLayers == cfg2.hardlinkLayers;
 }
 
 inline bool operator!=(const RepoConfig &cfg1, const RepoConfig &cfg2) noexcept
@@ -40,6 +40,10 @@ std::optional<std::string> arch;
 */
 std::optional<std::string> cache;
 /**
+* rebuild even if the build inputs are unchanged
+*/
+std::optional<bool> force;
+/**
 * use offline mode when build
 */
 std::optional<bool> offline;
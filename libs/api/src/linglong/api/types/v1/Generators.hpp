@@ -203,6 +203,7 @@ j["version"] = x.version;
 inline void from_json(const json & j, BuilderConfig& x) {
 x.arch = get_stack_optional<std::string>(j, "arch");
 x.cache = get_stack_optional<std::string>(j, "cache");
+x.force = get_stack_optional<bool>(j, "force");
 x.offline = get_stack_optional<bool>(j, "offline");
 x.repo = j.at("repo").get<std::string>();
 x.skipCommitOutput = get_stack_optional<bool>(j, "skip_commit_output");
@@ -220,6 +221,9 @@ j["arch"] = x.arch;
 if (x.cache) {
 j["cache"] = x.cache;
 }
+if (x.force) {
+j["force"] = x.force;
+}
 if (x.offline) {
 j["offline"] = x.offline;
 }
@@ -602,6 +606,7 @@ j["packages"] = x.packages;
 
 inline void from_json(const json & j, RepoConfig& x) {
 x.defaultRepo = j.at("defaultRepo").get<std::string>();
+x.hardlinkLayers = get_stack_optional<bool>(j, "hardlinkLayers");
 x.repos = j.at("repos").get<std::map<std::string, std::string>>();
 x.version = j.at("version").get<int64_t>();
 }
@@ -609,6 +614,9 @@ x.version = j.at("version").get<int64_t>();
 inline void to_json(json & j, const RepoConfig & x) {
 j = json::object();
 j["defaultRepo"] = x.defaultRepo;
+if (x.hardlinkLayers) {
+j["hardlinkLayers"] = x.hardlinkLayers;
+}
 j["repos"] = x.repos;
 j["version"] = x.version;
 }
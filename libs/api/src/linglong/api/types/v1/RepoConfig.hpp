@@ -36,6 +36,10 @@ struct RepoConfig {
 */
 std::string defaultRepo;
 /**
+* hardlink files of layers to objects of the repository instead of copying them
+*/
+std::optional<bool> hardlinkLayers;
+/**
 * repos of repo config
 */
 std::map<std::string, std::string> repos;
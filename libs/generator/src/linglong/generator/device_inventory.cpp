@@ -0,0 +1,126 @@
+/*
+ * SPDX-FileCopyrightText: 2024 UnionTech Software Technology Co., Ltd.
+ *
+ * SPDX-License-Identifier: LGPL-3.0-or-later
+ */
+
+#include "linglong/generator/device_inventory.h"
+
+#include <fstream>
+
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace linglong::generator {
+
+DeviceInventory::DeviceInventory(std::filesystem::path devDir, std::filesystem::path cacheFile)
+    : devDir(std::move(devDir))
+    , cacheFile(std::move(cacheFile))
+{
+}
+
+std::filesystem::path DeviceInventory::defaultCacheFile()
+{
+    std::filesystem::path runtimeDir;
+    if (const auto *dir = ::getenv("XDG_RUNTIME_DIR"); dir != nullptr && dir[0] != '\0') {
+        runtimeDir = dir;
+    } else {
+        runtimeDir = std::filesystem::path("/run/user") / std::to_string(::getuid());
+    }
+
+    return runtimeDir / "linglong" / "devices.json";
+}
+
+bool DeviceInventory::isVideoDevice(const std::string &devName)
+{
+    return (devName.rfind("video", 0) == 0) || (devName.rfind("nvidia", 0) == 0);
+}
+
+std::vector<std::string> DeviceInventory::devices()
+{
+    struct stat devStat{};
+    if (::stat(devDir.c_str(), &devStat) != 0) {
+        return {};
+    }
+
+    auto stamp = nlohmann::json{
+        { "dir", devDir.string() },
+        { "ino", devStat.st_ino },
+        { "mtime", devStat.st_mtim.tv_sec },
+        { "mtimeNsec", devStat.st_mtim.tv_nsec },
+    };
+
+    if (auto cached = load(stamp); cached) {
+        return std::move(*cached);
+    }
+
+    ++rescans;
+    auto result = scan();
+    save(stamp, result);
+    return result;
+}
+
+std::vector<std::string> DeviceInventory::scan() const
+{
+    std::vector<std::string> result;
+    std::error_code ec;
+    for (const auto &entry : std::filesystem::directory_iterator{ devDir, ec }) {
+        if (isVideoDevice(entry.path().filename().string())) {
+            result.push_back(entry.path().string());
+        }
+    }
+
+    return result;
+}
+
+std::optional<std::vector<std::string>>
+DeviceInventory::load(const nlohmann::json &stamp) const
+{
+    std::ifstream stream(cacheFile);
+    if (!stream.is_open()) {
+        return std::nullopt;
+    }
+
+    try {
+        auto cache = nlohmann::json::parse(stream);
+        if (cache.at("stamp") != stamp) {
+            return std::nullopt;
+        }
+
+        return cache.at("devices").get<std::vector<std::string>>();
+    } catch (...) {
+        return std::nullopt;
+    }
+}
+
+// best effort, the cache is simply rebuilt on next launch if this fails
+void DeviceInventory::save(const nlohmann::json &stamp,
+                           const std::vector<std::string> &devices) const
+{
+    std::error_code ec;
+    std::filesystem::create_directories(cacheFile.parent_path(), ec);
+    if (ec) {
+        return;
+    }
+
+    auto tmpFile = cacheFile;
+    tmpFile += "." + std::to_string(::getpid()) + ".tmp";
+    {
+        std::ofstream stream(tmpFile);
+        if (!stream.is_open()) {
+            return;
+        }
+        stream << nlohmann::json{ { "stamp", stamp }, { "devices", devices } }.dump();
+        if (!stream.good()) {
+            std::filesystem::remove(tmpFile, ec);
+            return;
+        }
+    }
+
+    std::filesystem::rename(tmpFile, cacheFile, ec);
+    if (ec) {
+        std::filesystem::remove(tmpFile, ec);
+    }
+}
+
+} // namespace linglong::generator
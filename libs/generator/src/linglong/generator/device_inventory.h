@@ -0,0 +1,47 @@
+/*
+ * SPDX-FileCopyrightText: 2024 UnionTech Software Technology Co., Ltd.
+ *
+ * SPDX-License-Identifier: LGPL-3.0-or-later
+ */
+
+#pragma once
+
+#include "nlohmann/json.hpp"
+
+#include <cstddef>
+#include <filesystem>
+#include <optional>
+#include <string>
+#include <vector>
+
+namespace linglong::generator {
+
+// DeviceInventory keeps the video and nvidia device nodes found in the device
+// directory in a cache file, so that launching an app doesn't have to scan the
+// whole directory. Nodes are created and removed directly in the device directory,
+// which updates its mtime, so the cache is only valid while the inode and mtime of
+// the directory are unchanged.
+class DeviceInventory
+{
+public:
+    DeviceInventory(std::filesystem::path devDir, std::filesystem::path cacheFile);
+
+    static std::filesystem::path defaultCacheFile();
+    static bool isVideoDevice(const std::string &devName);
+
+    std::vector<std::string> devices();
+    std::vector<std::string> scan() const;
+
+    // number of times devices() had to scan the device directory
+    [[nodiscard]] std::size_t rescanCount() const { return rescans; }
+
+private:
+    std::optional<std::vector<std::string>> load(const nlohmann::json &stamp) const;
+    void save(const nlohmann::json &stamp, const std::vector<std::string> &devices) const;
+
+    std::filesystem::path devDir;
+    std::filesystem::path cacheFile;
+    std::size_t rescans{ 0 };
+};
+
+} // namespace linglong::generator
@@ -0,0 +1,208 @@
+/*
+ * SPDX-FileCopyrightText: 2024 UnionTech Software Technology Co., Ltd.
+ *
+ * SPDX-License-Identifier: LGPL-3.0-or-later
+ */
+
+#include "access_tracer.h"
+
+#include <QDebug>
+#include <QDir>
+#include <QDirIterator>
+
+#include <array>
+#include <cerrno>
+#include <cstring>
+
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/eventfd.h>
+#include <sys/fanotify.h>
+#include <unistd.h>
+
+#ifndef AT_HANDLE_FID
+#define AT_HANDLE_FID AT_REMOVEDIR
+#endif
+
+namespace linglong::builder {
+
+namespace {
+
+QByteArray handleKey(const struct file_handle *handle)
+{
+    QByteArray key(reinterpret_cast<const char *>(&handle->handle_type),
+                   sizeof(handle->handle_type));
+    key.append(reinterpret_cast<const char *>(handle->f_handle),
+               static_cast<int>(handle->handle_bytes));
+    return key;
+}
+
+} // namespace
+
+auto AccessTracer::create(const QStringList &roots) noexcept
+  -> utils::error::Result<std::unique_ptr<AccessTracer>>
+{
+    LINGLONG_TRACE("create access tracer");
+
+    std::unique_ptr<AccessTracer> tracer(new AccessTracer);
+    tracer->fanotifyFd = ::fanotify_init(FAN_CLASS_NOTIF | FAN_CLOEXEC | FAN_NONBLOCK
+                                           | FAN_REPORT_DFID_NAME,
+                                         O_RDONLY | O_LARGEFILE);
+    if (tracer->fanotifyFd == -1) {
+        return LINGLONG_ERR(QString("fanotify_init: %1").arg(::strerror(errno)));
+    }
+
+    tracer->stopFd = ::eventfd(0, EFD_CLOEXEC);
+    if (tracer->stopFd == -1) {
+        return LINGLONG_ERR(QString("eventfd: %1").arg(::strerror(errno)));
+    }
+
+    for (const auto &root : roots) {
+        auto ret = tracer->mark(root);
+        if (!ret) {
+            return LINGLONG_ERR(ret);
+        }
+
+        QDirIterator it(root,
+                        QDir::Dirs | QDir::NoDotAndDotDot | QDir::Hidden | QDir::System,
+                        QDirIterator::Subdirectories);
+        while (it.hasNext()) {
+            it.next();
+            if (it.fileInfo().isSymLink()) {
+                continue;
+            }
+            ret = tracer->mark(it.filePath());
+            if (!ret) {
+                return LINGLONG_ERR(ret);
+            }
+        }
+    }
+
+    tracer->reader = std::thread([raw = tracer.get()] {
+        raw->loop();
+    });
+
+    return tracer;
+}
+
+AccessTracer::~AccessTracer()
+{
+    stop();
+
+    if (this->fanotifyFd != -1) {
+        ::close(this->fanotifyFd);
+    }
+    if (this->stopFd != -1) {
+        ::close(this->stopFd);
+    }
+}
+
+auto AccessTracer::mark(const QString &dir) noexcept -> utils::error::Result<void>
+{
+    LINGLONG_TRACE("mark " + dir);
+
+    auto path = dir.toLocal8Bit();
+    // FAN_EVENT_ON_CHILD只会报告直接子项的事件，每一级目录都需要标记
+    if (::fanotify_mark(this->fanotifyFd,
+                        FAN_MARK_ADD | FAN_MARK_ONLYDIR,
+                        FAN_OPEN | FAN_OPEN_EXEC | FAN_EVENT_ON_CHILD,
+                        AT_FDCWD,
+                        path.constData())
+        == -1) {
+        if (errno == ENOSPC) {
+            return LINGLONG_ERR("too many directories to trace, please increase "
+                                "/proc/sys/fs/fanotify/max_user_marks");
+        }
+        return LINGLONG_ERR(QString("fanotify_mark: %1").arg(::strerror(errno)));
+    }
+
+    constexpr auto maxHandleSize = 128;
+    alignas(struct file_handle) std::array<char, sizeof(struct file_handle) + maxHandleSize> buf{};
+    auto *handle = reinterpret_cast<struct file_handle *>(buf.data());
+    int mountID{ 0 };
+    // fanotify上报的file handle和AT_HANDLE_FID得到的一致，旧内核上回退到普通的file handle
+    handle->handle_bytes = maxHandleSize;
+    if (::name_to_handle_at(AT_FDCWD, path.constData(), handle, &mountID, AT_HANDLE_FID) == -1) {
+        handle->handle_bytes = maxHandleSize;
+        if (::name_to_handle_at(AT_FDCWD, path.constData(), handle, &mountID, 0) == -1) {
+            return LINGLONG_ERR(QString("name_to_handle_at: %1").arg(::strerror(errno)));
+        }
+    }
+
+    this->dirs.insert(handleKey(handle), QDir::cleanPath(dir));
+    return LINGLONG_OK;
+}
+
+void AccessTracer::readEvents() noexcept
+{
+    alignas(struct fanotify_event_metadata) std::array<char, 64 * 1024> buf{};
+    while (true) {
+        auto len = ::read(this->fanotifyFd, buf.data(), buf.size());
+        if (len <= 0) {
+            if (len == -1 && errno == EINTR) {
+                continue;
+            }
+            return;
+        }
+
+        QMutexLocker locker(&this->mutex);
+        auto *metadata = reinterpret_cast<struct fanotify_event_metadata *>(buf.data());
+        for (; FAN_EVENT_OK(metadata, len); metadata = FAN_EVENT_NEXT(metadata, len)) {
+            if (metadata->vers != FANOTIFY_METADATA_VERSION
+                || metadata->event_len < metadata->metadata_len + sizeof(fanotify_event_info_fid)) {
+                continue;
+            }
+
+            const auto *info = reinterpret_cast<const struct fanotify_event_info_fid *>(
+              reinterpret_cast<const char *>(metadata) + metadata->metadata_len);
+            if (info->hdr.info_type != FAN_EVENT_INFO_TYPE_DFID_NAME) {
+                continue;
+            }
+
+            const auto *handle = reinterpret_cast<const struct file_handle *>(info->handle);
+            const auto *name =
+              reinterpret_cast<const char *>(handle->f_handle + handle->handle_bytes);
+            auto dir = this->dirs.find(handleKey(handle));
+            // 目录自身的事件名称为"."
+            if (dir == this->dirs.end() || std::strcmp(name, ".") == 0) {
+                continue;
+            }
+
+            this->accessed.insert(dir.value() + "/" + QString::fromLocal8Bit(name));
+        }
+    }
+}
+
+void AccessTracer::loop() noexcept
+{
+    std::array<struct pollfd, 2> fds{ { { this->fanotifyFd, POLLIN, 0 },
+                                        { this->stopFd, POLLIN, 0 } } };
+    while (true) {
+        auto ret = ::poll(fds.data(), fds.size(), -1);
+        if (ret == -1 && errno == EINTR) {
+            continue;
+        }
+        if (ret == -1) {
+            qCritical() << "poll fanotify events:" << ::strerror(errno);
+            return;
+        }
+
+        readEvents();
+        if ((fds[1].revents & POLLIN) != 0) {
+            return;
+        }
+    }
+}
+
+auto AccessTracer::stop() noexcept -> QSet<QString>
+{
+    if (this->reader.joinable()) {
+        ::eventfd_write(this->stopFd, 1);
+        this->reader.join();
+    }
+
+    QMutexLocker locker(&this->mutex);
+    return this->accessed;
+}
+
+} // namespace linglong::builder
@@ -0,0 +1,63 @@
+/*
+ * SPDX-FileCopyrightText: 2024 UnionTech Software Technology Co., Ltd.
+ *
+ * SPDX-License-Identifier: LGPL-3.0-or-later
+ */
+
+#ifndef LINGLONG_SRC_BUILDER_ACCESS_TRACER_H_
+#define LINGLONG_SRC_BUILDER_ACCESS_TRACER_H_
+
+#include "linglong/utils/error/error.h"
+
+#include <QHash>
+#include <QMutex>
+#include <QSet>
+#include <QString>
+#include <QStringList>
+
+#include <memory>
+#include <thread>
+
+namespace linglong::builder {
+
+/*!
+ * 使用fanotify记录目录中被打开过的文件，用于根据应用的实际运行情况生成精简的layer。
+ * 只在目录的inode上添加标记，不需要特权，要求内核不低于5.13。
+ * 容器通过bind mount使用layer目录，所以容器内的访问也会被记录。
+ * 标记针对的是inode，主机上任何进程对这些目录的访问同样会被记录，结果只会多不会少
+ */
+class AccessTracer
+{
+public:
+    static auto create(const QStringList &roots) noexcept
+      -> utils::error::Result<std::unique_ptr<AccessTracer>>;
+
+    AccessTracer(const AccessTracer &) = delete;
+    AccessTracer(AccessTracer &&) = delete;
+    AccessTracer &operator=(const AccessTracer &) = delete;
+    AccessTracer &operator=(AccessTracer &&) = delete;
+    ~AccessTracer();
+
+    /*!
+     * 停止记录，返回被打开过的文件的绝对路径
+     */
+    auto stop() noexcept -> QSet<QString>;
+
+private:
+    AccessTracer() = default;
+    auto mark(const QString &dir) noexcept -> utils::error::Result<void>;
+    void readEvents() noexcept;
+    void loop() noexcept;
+
+    int fanotifyFd{ -1 };
+    int stopFd{ -1 };
+    // 目录的file handle到路径的映射，fanotify的事件中只有父目录的file handle和文件名
+    QHash<QByteArray, QString> dirs;
+    QMutex mutex;
+    QSet<QString> accessed;
+    std::thread reader;
+};
+
+} // namespace linglong::builder
+
+#endif // LINGLONG_SRC_BUILDER_ACCESS_TRACER_H_
@@ -14,6 +14,9 @@
 #include <QJsonObject>
 #include <QStandardPaths>
 
+#include <algorithm>
+#include <functional>
+
 #include <sys/stat.h>
 
 namespace linglong::util {
@@ -75,31 +78,67 @@ QString createProxySocket(const QString &pattern)
     return tmpFile.fileName();
 }
 
-quint64 sizeOfDir(const QString &srcPath)
+bool SizeCounter::add(const QString &path)
 {
-    QDir srcDir(srcPath);
-    quint64 size = 0;
-    QFileInfoList list = srcDir.entryInfoList();
+    struct stat fileStat{};
+    if (lstat(path.toLocal8Bit(), &fileStat) != 0) {
+        return false;
+    }
 
-    for (auto info : list) {
-        if (info.fileName() == "." || info.fileName() == "..") {
-            continue;
-        }
-        if (info.isSymLink()) {
-            // FIXME: https://bugreports.qt.io/browse/QTBUG-50301
-            struct stat symlinkStat;
-            lstat(info.absoluteFilePath().toLocal8Bit(), &symlinkStat);
-            size += symlinkStat.st_size;
-        } else if (info.isDir()) {
-            // 一个文件夹大小为4K
-            size += 4 * 1024;
-            size += sizeOfDir(QStringList{ srcPath, info.fileName() }.join("/"));
-        } else {
-            size += info.size();
-        }
+    add(fileStat);
+    return true;
+}
+
+void SizeCounter::add(const struct stat &fileStat)
+{
+    if (inodes.contains({ fileStat.st_dev, fileStat.st_ino })) {
+        return;
     }
+    inodes.insert({ fileStat.st_dev, fileStat.st_ino });
 
-    return size;
+    apparent += fileStat.st_size;
+    disk += static_cast<quint64>(fileStat.st_blocks) * 512;
+}
+
+QString metadataHashOfDir(const QString &srcPath, const QStringList &excludes)
+{
+    QDir srcDir(srcPath);
+    QCryptographicHash hash(QCryptographicHash::Sha256);
+
+    // 被排除的目录不会进入，linglong/中的源码和构建产物可能有大量文件
+    std::function<void(const QString &)> hashDir = [&](const QString &dirPath) {
+        // 目录遍历顺序与文件系统有关，按名称排序
+        const auto entries = QDir(dirPath).entryInfoList(QDir::AllEntries | QDir::NoDotAndDotDot
+                                                           | QDir::Hidden | QDir::System,
+                                                         QDir::Name);
+        for (const auto &info : entries) {
+            const auto path = info.absoluteFilePath();
+            const auto relativePath = srcDir.relativeFilePath(path);
+            if (excludes.contains(relativePath)) {
+                continue;
+            }
+
+            struct stat entryStat{};
+            if (lstat(path.toLocal8Bit(), &entryStat) != 0) {
+                continue;
+            }
+            hash.addData(relativePath.toUtf8());
+            hash.addData(QString(" %1 %2 %3.%4\n")
+                           .arg(entryStat.st_mode)
+                           .arg(entryStat.st_size)
+                           .arg(entryStat.st_mtim.tv_sec)
+                           .arg(entryStat.st_mtim.tv_nsec)
+                           .toUtf8());
+            if (S_ISLNK(entryStat.st_mode)) {
+                hash.addData(QFile::symLinkTarget(path).toUtf8());
+            } else if (S_ISDIR(entryStat.st_mode)) {
+                hashDir(path);
+            }
+        }
+    };
+    hashDir(srcDir.absolutePath());
+
+    return QString(hash.result().toHex());
 }
 
 QString fileHash(QIODevice &device, QCryptographicHash::Algorithm method)
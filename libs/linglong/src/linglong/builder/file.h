@@ -14,7 +14,9 @@
 #include <QDir>
 #include <QDirIterator>
 #include <QFileInfo>
+#include <QPair>
 #include <QProcess>
+#include <QSet>
 #include <QString>
 #include <QStringList>
 #include <QSysInfo>
@@ -22,6 +24,7 @@
 
 #include <cstdlib>
 
+#include <sys/stat.h>
 #include <unistd.h>
 
 namespace linglong::util {
@@ -54,13 +57,41 @@ QString fileHash(QIODevice &device, QCryptographicHash::Algorithm method);
 QString fileHash(const QString &path, QCryptographicHash::Algorithm method);
 
 /*!
- * 计算文件夹大小
+ * 在遍历目录的同时累计文件大小，硬链接只计算一次，结果与 du --apparent-size 一致
+ */
+class SizeCounter
+{
+public:
+    /*!
+     * 累计一个文件、目录或链接本身的大小，不会递归
+     * @param path 路径
+     * @return bool: lstat是否成功
+     */
+    bool add(const QString &path);
+    void add(const struct stat &fileStat);
+
+    // 文件的逻辑大小
+    [[nodiscard]] quint64 apparentSize() const noexcept { return apparent; }
+
+    // 实际占用的磁盘空间
+    [[nodiscard]] quint64 diskSize() const noexcept { return disk; }
+
+private:
+    QSet<QPair<quint64, quint64>> inodes;
+    quint64 apparent = 0;
+    quint64 disk = 0;
+};
+
+/*!
+ * 根据目录中所有文件的路径、类型、权限、大小和修改时间计算hash，不读取文件内容
  *
  * @param: srcPath: 文件夹路径
  *
- * @return quint64: byte 文件夹大小
+ * @param: excludes: 需要跳过的相对路径
+ *
+ * @return QString: hash字符串
  */
-quint64 sizeOfDir(const QString &srcPath);
+QString metadataHashOfDir(const QString &srcPath, const QStringList &excludes = {});
 
 /*!
  * 创建一个pattern格式的随机文件
@@ -7,6 +7,7 @@
 #include "linglong_builder.h"
 
 #include "linglong/api/types/v1/Generators.hpp"
+#include "linglong/builder/access_tracer.h"
 #include "linglong/builder/file.h"
 #include "linglong/builder/printer.h"
 #include "linglong/package/architecture.h"
@@ -28,17 +29,27 @@
 #include <QCoreApplication>
 #include <QDir>
 #include <QHash>
+#include <QMap>
+#include <QMutex>
 #include <QProcess>
+#include <QRegularExpression>
+#include <QSaveFile>
+#include <QSet>
 #include <QTemporaryFile>
 #include <QThread>
+#include <QThreadPool>
 #include <QUrl>
+#include <QtConcurrent/QtConcurrent>
 
+#include <algorithm>
 #include <filesystem>
+#include <functional>
 #include <optional>
 #include <string>
 #include <vector>
 
 #include <sys/socket.h>
+#include <sys/stat.h>
 #include <sys/wait.h>
 
 namespace linglong::builder {
@@ -75,39 +86,6 @@ currentReference(const api::types::v1::BuilderProject &project)
     return ref;
 }
 
-utils::error::Result<void>
-fetchSources(const std::vector<api::types::v1::BuilderProjectSource> &sources,
-             const QDir &cacheDir,
-             const QDir &destination,
-             const api::types::v1::BuilderConfig &cfg) noexcept
-{
-    LINGLONG_TRACE("fetch sources to " + destination.absolutePath());
-
-    for (int pos = 0; pos < sources.size(); ++pos) {
-        printReplacedText(QString("%1%2%3%4")
-                            .arg("Source " + QString::number(pos), -20)
-                            .arg(QString::fromStdString(sources.at(pos).kind), -15)
-                            .arg(QString::fromStdString(*(sources.at(pos).url)), -75)
-                            .arg("downloading ...")
-                            .toStdString(),
-                          2);
-        SourceFetcher sf(sources.at(pos), cfg, cacheDir);
-        auto result = sf.fetch(QDir(destination));
-        if (!result) {
-            return LINGLONG_ERR(result);
-        }
-        printReplacedText(QString("%1%2%3%4")
-                            .arg("Source " + QString::number(pos), -20)
-                            .arg(QString::fromStdString(sources.at(pos).kind), -15)
-                            .arg(QString::fromStdString(*(sources.at(pos).url)), -75)
-                            .arg("complete\n")
-                            .toStdString(),
-                          2);
-    }
-
-    return LINGLONG_OK;
-}
-
 utils::error::Result<package::Reference> pullDependency(const package::FuzzyReference &fuzzyRef,
                                                         repo::OSTreeRepo &repo,
                                                         bool develop,
@@ -168,6 +146,231 @@ utils::error::Result<package::Reference> pullDependency(const QString &fuzzyRefS
     return pullDependency(*fuzzyRef, repo, develop, onlyLocal);
 }
 
+// 记录应用访问过的文件，每个依赖一个文件，多次运行的结果会合并
+QString accessTraceFile(const QDir &workingDir, const QString &id) noexcept
+{
+    return workingDir.absoluteFilePath(QString("linglong/minify/%1.list").arg(id));
+}
+
+utils::error::Result<QSet<QString>> loadAccessTrace(const QString &path) noexcept
+{
+    LINGLONG_TRACE("load access trace " + path);
+
+    QFile file(path);
+    if (!file.open(QIODevice::ReadOnly | QIODevice::Text)) {
+        return LINGLONG_ERR(file);
+    }
+
+    QSet<QString> files;
+    for (const auto &line : QString::fromUtf8(file.readAll()).split('\n')) {
+        if (!line.isEmpty()) {
+            files.insert(line);
+        }
+    }
+    return files;
+}
+
+// binary和develop等模块互不依赖，在同一个线程池中并发处理，
+// 线程数默认为CPU核数，可以通过LINGLONG_EXPORT_JOBS修改。
+// 一个模块失败不会打断其他模块，所有模块结束后返回第一个错误
+utils::error::Result<void>
+forEachModule(const QString &stage,
+              const QStringList &modules,
+              const std::function<utils::error::Result<void>(const QString &)> &task) noexcept
+{
+    LINGLONG_TRACE(stage);
+
+    if (modules.isEmpty()) {
+        return LINGLONG_OK;
+    }
+
+    auto jobs = QThread::idealThreadCount();
+    if (auto env = qgetenv("LINGLONG_EXPORT_JOBS"); !env.isEmpty()) {
+        jobs = env.toInt();
+    }
+    QThreadPool pool;
+    pool.setMaxThreadCount(std::clamp(jobs, 1, static_cast<int>(modules.size())));
+
+    printMessage("[" + stage.toStdString() + "]");
+    QMutex progressMutex;
+    int finished = 0;
+    std::vector<utils::error::Result<void>> results(modules.size());
+    QList<QFuture<void>> futures;
+    for (int pos = 0; pos < modules.size(); ++pos) {
+        futures.append(QtConcurrent::run(&pool, [&, pos]() {
+            results[pos] = task(modules.at(pos));
+
+            QMutexLocker locker(&progressMutex);
+            ++finished;
+            printMessage(QString("%1%2(%3/%4)")
+                           .arg(modules.at(pos), -15)
+                           .arg(QString(results[pos] ? "complete" : "failed"), -15)
+                           .arg(finished)
+                           .arg(modules.size())
+                           .toStdString(),
+                         2);
+        }));
+    }
+
+    for (auto &future : futures) {
+        future.waitForFinished();
+    }
+
+    for (auto &result : results) {
+        if (!result) {
+            return LINGLONG_ERR(result);
+        }
+    }
+
+    return LINGLONG_OK;
+}
+
+} // namespace
+
+auto loadBuildStamp(const QString &path) noexcept -> utils::error::Result<BuildStamp>
+{
+    LINGLONG_TRACE("load build stamp " + path);
+
+    QFile file(path);
+    if (!file.open(QIODevice::ReadOnly)) {
+        return LINGLONG_ERR(file);
+    }
+
+    try {
+        auto content = nlohmann::json::parse(file.readAll().toStdString());
+        return BuildStamp{
+            .inputsDigest = QString::fromStdString(content.at("inputs").get<std::string>()),
+            .binaryCommit = QString::fromStdString(content.at("binary").get<std::string>()),
+            .developCommit = QString::fromStdString(content.at("develop").get<std::string>()),
+        };
+    } catch (const std::exception &e) {
+        return LINGLONG_ERR("parse", e);
+    }
+}
+
+auto saveBuildStamp(const QString &path, const BuildStamp &stamp) noexcept
+  -> utils::error::Result<void>
+{
+    LINGLONG_TRACE("save build stamp " + path);
+
+    nlohmann::json content{
+        { "inputs", stamp.inputsDigest.toStdString() },
+        { "binary", stamp.binaryCommit.toStdString() },
+        { "develop", stamp.developCommit.toStdString() },
+    };
+    QSaveFile file(path);
+    if (!file.open(QIODevice::WriteOnly)) {
+        return LINGLONG_ERR(file);
+    }
+    file.write(QByteArray::fromStdString(content.dump()));
+    if (!file.commit()) {
+        return LINGLONG_ERR(file);
+    }
+
+    return LINGLONG_OK;
+}
+
+// Digest of everything a build depends on. Files are compared by metadata only, like make does.
+auto buildInputsDigest(const api::types::v1::BuilderProject &project,
+                       const api::types::v1::BuilderConfig &cfg,
+                       const QDir &workingDir,
+                       const QStringList &args,
+                       const QStringList &dependLayerDirs) noexcept -> QString
+{
+    QCryptographicHash hash(QCryptographicHash::Sha256);
+    hash.addData(QByteArray(LINGLONG_VERSION));
+    hash.addData(QByteArray::fromStdString(nlohmann::json(project).dump()));
+    hash.addData(QByteArray::fromStdString(cfg.arch.value_or("")));
+    hash.addData(args.join(QChar('\0')).toUtf8());
+    // an offline build uses the sources as they are instead of fetching them again
+    hash.addData(QByteArray::number(cfg.offline.value_or(false)));
+    hash.addData(QByteArray::number(cfg.skipFetchSource.value_or(false)));
+
+    // a layer is checked out again when its commit changes
+    for (const auto &layerDir : dependLayerDirs) {
+        struct stat layerStat{};
+        if (stat(layerDir.toLocal8Bit(), &layerStat) == 0) {
+            hash.addData(QString("%1 %2 %3.%4\n")
+                           .arg(layerDir)
+                           .arg(layerStat.st_ino)
+                           .arg(layerStat.st_mtim.tv_sec)
+                           .arg(layerStat.st_mtim.tv_nsec)
+                           .toUtf8());
+        }
+        QFile infoFile(QDir(layerDir).filePath("info.json"));
+        if (infoFile.open(QIODevice::ReadOnly)) {
+            hash.addData(infoFile.readAll());
+        }
+    }
+
+    hash.addData(
+      util::metadataHashOfDir(workingDir.absolutePath(), { "linglong", ".git" }).toUtf8());
+    // linglong/sources holds the fetched sources, which may be edited by hand. The rest of
+    // linglong/ is written by ll-builder itself.
+    hash.addData(util::metadataHashOfDir(workingDir.absoluteFilePath("linglong"),
+                                         { "output",
+                                           "cache",
+                                           "ccache",
+                                           "minify",
+                                           "entry.sh",
+                                           "build.stamp" })
+                   .toUtf8());
+
+    return hash.result().toHex();
+}
+
+auto isBuildUpToDate(const BuildStamp &stamp,
+                     const QString &inputsDigest,
+                     const repo::OSTreeRepo &repo,
+                     const package::Reference &ref) noexcept -> bool
+{
+    if (stamp.inputsDigest != inputsDigest) {
+        return false;
+    }
+
+    // 同一个引用可能被其他构建或导入覆盖，只比较检出目录是否存在是不够的
+    auto binaryCommit = repo.getCommit(ref);
+    auto developCommit = repo.getCommit(ref, true);
+    return binaryCommit && *binaryCommit == stamp.binaryCommit && developCommit
+      && *developCommit == stamp.developCommit && repo.getLayerDir(ref)
+      && repo.getLayerDir(ref, true);
+}
+
+namespace {
+
+// 记录刚提交的结果，写入失败时删除旧的记录，避免下次误判为最新
+void updateBuildStamp(const QString &path,
+                      const QString &inputsDigest,
+                      const repo::OSTreeRepo &repo,
+                      const package::Reference &ref) noexcept
+{
+    auto save = [&]() -> utils::error::Result<void> {
+        LINGLONG_TRACE("update build stamp");
+
+        auto binaryCommit = repo.getCommit(ref);
+        if (!binaryCommit) {
+            return LINGLONG_ERR(binaryCommit);
+        }
+        auto developCommit = repo.getCommit(ref, true);
+        if (!developCommit) {
+            return LINGLONG_ERR(developCommit);
+        }
+
+        return saveBuildStamp(path,
+                              BuildStamp{
+                                .inputsDigest = inputsDigest,
+                                .binaryCommit = *binaryCommit,
+                                .developCommit = *developCommit,
+                              });
+    };
+
+    auto result = save();
+    if (!result) {
+        qWarning() << "write" << path << "failed:" << result.error().message();
+        QFile::remove(path);
+    }
+}
+
 } // namespace
 
 Builder::Builder(const api::types::v1::BuilderProject &project,
@@ -198,10 +401,12 @@ void Builder::setConfig(const api::types::v1::BuilderConfig &cfg) noexcept
     this->cfg = cfg;
 }
 
-// 拆分develop和binary的文件
+// 拆分develop和binary的文件，同时累计两个layer的大小
 utils::error::Result<void> Builder::splitDevelop(QDir developOutput,
                                                  QDir binaryOutput,
-                                                 QString prefix)
+                                                 QString prefix,
+                                                 util::SizeCounter &developSize,
+                                                 util::SizeCounter &binarySize)
 {
     LINGLONG_TRACE("split layers file");
     const QString installFilename =
@@ -213,7 +418,8 @@ utils::error::Result<void> Builder::splitDevelop(QDir developOutput,
 
     // if ${PROJECT_ROOT}/${appid}.install is not exist, copy all files
     const auto installRulePath = workingDir.filePath(installFilename);
-    if (QFileInfo(installRulePath).exists()) {
+    const bool installAll = !QFileInfo(installRulePath).exists();
+    if (!installAll) {
         QFile configFile(installRulePath);
         if (!configFile.open(QIODevice::ReadOnly)) {
             return LINGLONG_ERR("open file", configFile);
@@ -224,33 +430,60 @@ utils::error::Result<void> Builder::splitDevelop(QDir developOutput,
         installRules.removeDuplicates();
     } else {
         qDebug() << "generate install list from " << src;
-        QDirIterator it(src,
-                        QDir::AllEntries | QDir::NoDotAndDotDot | QDir::Hidden | QDir::System,
-                        QDirIterator::Subdirectories);
-        while (it.hasNext()) {
-            it.next();
-            auto filepath = it.filePath();
-            qDebug() << filepath;
-            // $PROJECT_ROOT/.../files to /opt/apps/${appid}
-            // $PROJECT_ROOT/ to /runtime/
-            filepath.replace(0, src.length(), prefix);
-            installRules.append(filepath);
+    }
+
+    // 普通路径直接查找，正则规则在遍历目录时逐条匹配
+    // 不合并成一个表达式，否则反向引用的编号会错乱，而且一条回溯严重的规则会拖慢所有匹配
+    QStringList plainRules;
+    QList<QRegularExpression> regexRules;
+    for (auto rule : installRules) {
+        // /opt/apps/${appid} to $PROJECT_ROOT/.../files
+        // /runtime/ to $PROJECT_ROOT/
+        rule.replace(0, prefix.length(), src);
+        // 如果不以^符号开头，当作普通路径使用
+        if (!rule.startsWith("^")) {
+            plainRules.append(QDir::cleanPath(rule));
+            continue;
+        }
+        QRegularExpression re(rule);
+        if (!re.isValid()) {
+            return LINGLONG_ERR(QString("invalid install rule %1: %2").arg(rule, re.errorString()));
         }
+        re.optimize();
+        regexRules.append(re);
     }
+
+    // binary中的目录可能由mkpath隐式创建，逐级记录以便统计大小
+    QSet<QString> binaryDirs;
+    auto makeBinaryDir = [&](const QString &path) -> bool {
+        if (binaryDirs.contains(path)) {
+            return true;
+        }
+        if (!QDir().mkpath(path)) {
+            return false;
+        }
+        for (auto dir = path; dir.startsWith(dest) && !binaryDirs.contains(dir);
+             dir = QFileInfo(dir).path()) {
+            binaryDirs.insert(dir);
+            binarySize.add(dir);
+        }
+        return true;
+    };
+
     // 复制目录、文件和超链接
-    auto copyFile = [&](const int &process,
-                        const QFileInfo &info,
+    // 文件优先使用硬链接，develop和binary在同一文件系统时不需要复制文件内容
+    auto copyFile = [&](const QFileInfo &info,
                         const QString &dstPath) -> utils::error::Result<void> {
         LINGLONG_TRACE("copy file");
         if (info.isDir()) {
-            qDebug() << QString("process: %1%").arg(process) << "matched dir"
-                     << info.absoluteFilePath();
-            QDir().mkpath(dstPath);
+            qDebug() << "matched dir" << info.absoluteFilePath();
+            if (!makeBinaryDir(dstPath)) {
+                return LINGLONG_ERR("make path " + dstPath + ": failed.");
+            }
             return LINGLONG_OK;
         }
         if (info.isSymLink()) {
-            qDebug() << QString("process: %1%").arg(process) << "matched symlinks"
-                     << info.absoluteFilePath();
+            qDebug() << "matched symlinks" << info.absoluteFilePath();
             char buf[PATH_MAX];
             // qt的readlin无法区分相对链接还是绝对链接，所以用c库的readlink
             auto size = readlink(info.filePath().toStdString().c_str(), buf, sizeof(buf) - 1);
@@ -261,65 +494,94 @@ utils::error::Result<void> Builder::splitDevelop(QDir developOutput,
             buf[size] = '\0';
             QString linkpath(buf);
             qDebug() << "link" << linkpath << "to" << dstPath;
+            if (!makeBinaryDir(QFileInfo(dstPath).path())) {
+                return LINGLONG_ERR("make path " + QFileInfo(dstPath).path() + ": failed.");
+            }
             QFile file(linkpath);
             if (!file.link(dstPath))
                 return LINGLONG_ERR("link file failed, relative path", file);
+            binarySize.add(dstPath);
             return LINGLONG_OK;
         }
         // 链接也是文件，isFile要放到isSymLink后面
         if (info.isFile()) {
-            qDebug() << QString("process: %1%").arg(process) << "matched file"
-                     << info.absoluteFilePath();
-            QDir().mkpath(info.path().replace(src, dest));
-            QFile file(info.absoluteFilePath());
-            if (!file.copy(dstPath))
-                return LINGLONG_ERR("copy file", file);
+            qDebug() << "matched file" << info.absoluteFilePath();
+            if (!makeBinaryDir(QFileInfo(dstPath).path())) {
+                return LINGLONG_ERR("make path " + QFileInfo(dstPath).path() + ": failed.");
+            }
+            if (::link(info.absoluteFilePath().toStdString().c_str(),
+                       dstPath.toStdString().c_str())
+                != 0) {
+                // 跨文件系统(EXDEV)或文件系统不支持硬链接时回退到复制
+                QFile file(info.absoluteFilePath());
+                if (!file.copy(dstPath))
+                    return LINGLONG_ERR("copy file", file);
+            }
+            binarySize.add(dstPath);
             return LINGLONG_OK;
         }
         return LINGLONG_ERR(QString("unknown file type %1").arg(info.path()));
     };
 
-    auto ruleIndex = 0;
-    for (auto rule : installRules) {
-        // 计算进度
-        ruleIndex++;
-        auto process = ruleIndex * 100 / installRules.length();
-        // /opt/apps/${appid} to $PROJECT_ROOT/.../files
-        // /runtime/ to $PROJECT_ROOT/
-        rule.replace(0, prefix.length(), src);
-        // 如果不以^符号开头，当作普通路径使用
-        if (!rule.startsWith("^")) {
-            QFileInfo info(rule);
-            // 链接指向的文件如果不存在，info.exists会返回false
-            // 所以要先判断文件是否是链接
-            if (info.isSymLink() || info.exists()) {
-                const QString dstPath = info.absoluteFilePath().replace(src, dest);
-                auto ret = copyFile(process, info, dstPath);
-                if (!ret.has_value()) {
-                    return LINGLONG_ERR(ret);
-                }
-            } else {
-                qWarning() << "missing file" << rule;
-            }
+    developSize.add(developOutput.absoluteFilePath(".."));
+    developSize.add(src);
+    binarySize.add(binaryOutput.absoluteFilePath(".."));
+    binaryDirs.insert(dest);
+    binarySize.add(dest);
+
+    // 普通路径可能经过指向目录的链接，遍历目录时不会进入这些链接，所以直接查找
+    QSet<QString> processed;
+    for (const auto &rule : plainRules) {
+        QFileInfo info(rule);
+        // 链接指向的文件如果不存在，info.exists会返回false
+        // 所以要先判断文件是否是链接
+        if (!info.isSymLink() && !info.exists()) {
+            qWarning() << "missing file" << rule;
             continue;
         }
-        // convert prefix in container to real path in host
-        QRegularExpression re(rule);
-        // reverse files in src
-        QDirIterator it(src,
-                        QDir::AllEntries | QDir::NoDotAndDotDot | QDir::Hidden | QDir::System,
-                        QDirIterator::Subdirectories);
-        while (it.hasNext()) {
-            it.next();
-            if (re.match(it.fileInfo().absoluteFilePath()).hasMatch()) {
-                const QString dstPath = it.fileInfo().absoluteFilePath().replace(src, dest);
-                auto ret = copyFile(process, it.fileInfo(), dstPath);
-                if (!ret.has_value()) {
-                    return LINGLONG_ERR(ret);
-                }
-            }
+        const QString dstPath = QString(rule).replace(0, src.length(), dest);
+        if (processed.contains(dstPath)) {
+            continue;
+        }
+        processed.insert(dstPath);
+        auto ret = copyFile(info, dstPath);
+        if (!ret.has_value()) {
+            return LINGLONG_ERR(ret);
+        }
+    }
+
+    // 遍历develop时同时完成大小统计和正则规则的匹配
+    QDirIterator it(src,
+                    QDir::AllEntries | QDir::NoDotAndDotDot | QDir::Hidden | QDir::System,
+                    QDirIterator::Subdirectories);
+    while (it.hasNext()) {
+        it.next();
+        const auto filepath = it.filePath();
+        developSize.add(filepath);
+
+        const QString dstPath = QString(filepath).replace(0, src.length(), dest);
+        bool matched = installAll;
+        if (installAll) {
+            // $PROJECT_ROOT/.../files to /opt/apps/${appid}
+            // $PROJECT_ROOT/ to /runtime/
+            installRules.append(QString(filepath).replace(0, src.length(), prefix));
+        } else if (!processed.contains(dstPath)) {
+            matched = std::any_of(regexRules.cbegin(),
+                                  regexRules.cend(),
+                                  [&filepath](const QRegularExpression &re) {
+                                      return re.match(filepath).hasMatch();
+                                  });
+        }
+        if (!matched) {
+            continue;
+        }
+
+        auto ret = copyFile(it.fileInfo(), dstPath);
+        if (!ret.has_value()) {
+            return LINGLONG_ERR(ret);
         }
     }
+
     for (auto dir : { developOutput, binaryOutput }) {
         // save all installed file path to ${appid}.install
         const auto installRulePath = dir.filePath("../" + installFilename);
@@ -332,6 +594,8 @@ utils::error::Result<void> Builder::splitDevelop(QDir developOutput,
         }
         configFile.close();
     }
+    developSize.add(developOutput.filePath("../" + installFilename));
+    binarySize.add(binaryOutput.filePath("../" + installFilename));
     return LINGLONG_OK;
 }
 
@@ -359,28 +623,6 @@ utils::error::Result<void> Builder::build(const QStringList &args) noexcept
 
     this->workingDir.mkdir("linglong");
 
-    if (this->project.sources && !cfg.skipFetchSource) {
-        printMessage("[Processing Sources]");
-        printMessage(QString("%1%2%3%4")
-                       .arg("Name", -20)
-                       .arg("Type", -15)
-                       .arg("Url", -75)
-                       .arg("Status")
-                       .toStdString(),
-                     2);
-        auto fetchCacheDir = this->workingDir.absoluteFilePath("linglong/cache");
-        if (!qgetenv("LINGLONG_FETCH_CACHE").isEmpty()) {
-            fetchCacheDir = qgetenv("LINGLONG_FETCH_CACHE");
-        }
-        auto result = fetchSources(*this->project.sources,
-                                   fetchCacheDir,
-                                   this->workingDir.absoluteFilePath("linglong/sources"),
-                                   this->cfg);
-        if (!result) {
-            return LINGLONG_ERR(result);
-        }
-    }
-
     printMessage("[Processing Dependency]");
     printMessage(QString("%1%2%3%4")
                    .arg("Package", -25)
@@ -447,10 +689,143 @@ utils::error::Result<void> Builder::build(const QStringList &args) noexcept
                       2);
     qDebug() << "pull base success" << base->toString();
 
+    auto ref = currentReference(this->project);
+    if (!ref) {
+        return LINGLONG_ERR(ref);
+    }
+
+    auto commitOutput = [this, &ref]() -> utils::error::Result<void> {
+        LINGLONG_TRACE("commit build output");
+
+        for (const auto develop : { false, true }) {
+            package::LayerDir outputLayerDir = this->workingDir.absoluteFilePath(
+              QString("linglong/output/%1").arg(develop ? "develop" : "binary"));
+            auto result = this->repo.remove(*ref, develop);
+            if (!result) {
+                qWarning() << "remove" << ref->toString() << result.error().message();
+            }
+            auto localLayer = this->repo.importLayerDir(outputLayerDir);
+            if (!localLayer) {
+                return LINGLONG_ERR(localLayer);
+            }
+        }
+
+        return LINGLONG_OK;
+    };
+
+    // skip the build if nothing changed since the last successful one
+    QStringList dependLayerDirs{ baseLayerDir->absolutePath() };
+    if (!runtimeLayerDir.isEmpty()) {
+        dependLayerDirs.append(runtimeLayerDir);
+    }
+    auto inputsDigest =
+      buildInputsDigest(this->project, this->cfg, this->workingDir, args, dependLayerDirs);
+    const auto stampPath = this->workingDir.absoluteFilePath("linglong/build.stamp");
+    std::optional<BuildStamp> stamp;
+    if (!cfg.force.value_or(false) && !cfg.skipRunContainer.value_or(false)
+        && !cfg.skipCommitOutput.value_or(false)) {
+        if (auto loaded = loadBuildStamp(stampPath); loaded) {
+            stamp = *loaded;
+        }
+    }
+    if (stamp && stamp->inputsDigest == inputsDigest) {
+        if (isBuildUpToDate(*stamp, inputsDigest, this->repo, *ref)) {
+            printMessage("[Build Skipped]");
+            printMessage("Inputs are unchanged, reuse " + ref->toString().toStdString()
+                           + ". Use --force to rebuild.",
+                         2);
+            return LINGLONG_OK;
+        }
+
+        // the commits are gone or replaced, but the output of the last build is still there
+        QDir output = this->workingDir.absoluteFilePath("linglong/output");
+        if (output.exists("binary/info.json") && output.exists("develop/info.json")) {
+            printMessage("[Commit Contents]");
+            auto result = commitOutput();
+            if (!result) {
+                return LINGLONG_ERR(result);
+            }
+            updateBuildStamp(stampPath, inputsDigest, this->repo, *ref);
+            printMessage("Successfully build " + this->project.package.id);
+            return LINGLONG_OK;
+        }
+    }
+
+    if (this->project.sources && !cfg.skipFetchSource) {
+        printMessage("[Processing Sources]");
+        printMessage(QString("%1%2%3%4")
+                       .arg("Name", -20)
+                       .arg("Type", -15)
+                       .arg("Url", -75)
+                       .arg("Status")
+                       .toStdString(),
+                     2);
+        auto fetchCacheDir = this->workingDir.absoluteFilePath("linglong/cache");
+        if (!qgetenv("LINGLONG_FETCH_CACHE").isEmpty()) {
+            fetchCacheDir = qgetenv("LINGLONG_FETCH_CACHE");
+        }
+        // downloads are mostly waiting on the network, run a few of them at once
+        auto jobs = 4;
+        if (auto env = qgetenv("LINGLONG_FETCH_JOBS"); !env.isEmpty()) {
+            jobs = env.toInt();
+        }
+        const auto &sources = *this->project.sources;
+        auto result = fetchSources(
+          sources,
+          this->cfg,
+          fetchCacheDir,
+          this->workingDir.absoluteFilePath("linglong/sources"),
+          jobs,
+          [&sources](std::size_t pos, FetchState state) {
+              QString status = "downloading ...";
+              if (state == FetchState::Complete) {
+                  status = "complete";
+              } else if (state == FetchState::Failed) {
+                  status = "failed";
+              }
+              printMessage(QString("%1%2%3%4")
+                             .arg("Source " + QString::number(pos), -20)
+                             .arg(QString::fromStdString(sources.at(pos).kind), -15)
+                             .arg(QString::fromStdString(sources.at(pos).url.value_or("")), -75)
+                             .arg(status)
+                             .toStdString(),
+                           2);
+          });
+        if (!result) {
+            return LINGLONG_ERR(result);
+        }
+    }
+
     if (cfg.skipRunContainer) {
         return LINGLONG_OK;
     }
 
+    // persistent compiler cache, shared by builds of the same project on the same base and runtime
+    QCryptographicHash cacheKey(QCryptographicHash::Sha256);
+    cacheKey.addData(base->toString().toUtf8());
+    if (runtime) {
+        cacheKey.addData(runtime->toString().toUtf8());
+    }
+    QDir compilerCacheDir =
+      QDir(QString::fromStdString(cfg.cache.value_or(cfg.repo)))
+        .absoluteFilePath(QString("ccache/%1/%2")
+                            .arg(QString::fromStdString(this->project.package.id),
+                                 QString(cacheKey.result().toHex().left(16))));
+    const QString compilerCacheMountPoint = "/project/linglong/ccache";
+    auto compilerCacheSize = qEnvironmentVariable("LINGLONG_BUILD_CACHE_SIZE", "5G");
+    auto useCompilerCache =
+      compilerCacheDir.mkpath(".") && this->workingDir.mkpath("linglong/ccache");
+    if (!useCompilerCache) {
+        qWarning() << "compiler cache is disabled, failed to create" << compilerCacheDir;
+    }
+    // the launcher variables break the build if ccache is missing in both base and runtime
+    auto layerHasCcache = [](const QDir &layerDir) {
+        return layerDir.exists("files/bin/ccache") || layerDir.exists("files/usr/bin/ccache");
+    };
+    auto hasCcache = useCompilerCache
+      && (layerHasCcache(*baseLayerDir)
+          || (!runtimeLayerDir.isEmpty() && layerHasCcache(QDir(runtimeLayerDir))));
+
     QFile entry = this->workingDir.absoluteFilePath("linglong/entry.sh");
     if (entry.exists() && !entry.remove()) {
         return LINGLONG_ERR(entry);
@@ -464,7 +839,14 @@ utils::error::Result<void> Builder::build(const QStringList &args) noexcept
     entry.write("set -e\n\n");
     entry.write("# This file is generated by `build` in linglong.yaml\n");
     entry.write("# DO NOT EDIT IT\n\n");
+    if (hasCcache) {
+        entry.write("ccache --zero-stats > /dev/null\n\n");
+    }
     entry.write(project.build.c_str());
+    if (hasCcache) {
+        entry.write("\n\necho \"# compiler cache statistics\"\n");
+        entry.write("ccache --show-stats\n");
+    }
     entry.close();
     if (entry.error() != QFile::NoError) {
         return LINGLONG_ERR(entry);
@@ -477,6 +859,7 @@ utils::error::Result<void> Builder::build(const QStringList &args) noexcept
     qDebug() << "generated entry.sh success";
 
     // clean output
+    QFile::remove(stampPath);
     QDir(this->workingDir.absoluteFilePath("linglong/output")).removeRecursively();
 
     QDir developOutput = this->workingDir.absoluteFilePath("linglong/output/develop/files");
@@ -485,11 +868,6 @@ utils::error::Result<void> Builder::build(const QStringList &args) noexcept
     }
     qDebug() << "create develop output success";
 
-    auto ref = currentReference(this->project);
-    if (!ref) {
-        return LINGLONG_ERR(ref);
-    }
-
     auto opts = runtime::ContainerOptions{
         .appID = QString::fromStdString(this->project.package.id),
         .containerID = ("linglong-builder-" + ref->toString() + QUuid::createUuid().toString())
@@ -535,6 +913,17 @@ utils::error::Result<void> Builder::build(const QStringList &args) noexcept
       .uidMappings = {},
     });
 
+    if (useCompilerCache) {
+        opts.mounts.push_back({
+          .destination = compilerCacheMountPoint.toStdString(),
+          .gidMappings = {},
+          .options = { { "rbind", "rw" } },
+          .source = compilerCacheDir.absolutePath().toStdString(),
+          .type = "bind",
+          .uidMappings = {},
+        });
+    }
+
     opts.masks.emplace_back("/project/linglong/output");
 
     auto container = this->containerBuilder.create(opts);
@@ -567,6 +956,25 @@ utils::error::Result<void> Builder::build(const QStringList &args) noexcept
         .selinuxLabel = {},
         .terminal = true,
     };
+    if (useCompilerCache) {
+        auto cacheDir = compilerCacheMountPoint.toStdString();
+        auto cacheSize = compilerCacheSize.toStdString();
+        process.env->insert(process.env->end(),
+                            {
+                              "CCACHE_DIR=" + cacheDir,
+                              "CCACHE_MAXSIZE=" + cacheSize,
+                              "CCACHE_BASEDIR=/project",
+                              "SCCACHE_DIR=" + cacheDir + "/sccache",
+                              "SCCACHE_CACHE_SIZE=" + cacheSize,
+                            });
+        if (hasCcache) {
+            process.env->insert(process.env->end(),
+                                {
+                                  "CMAKE_C_COMPILER_LAUNCHER=ccache",
+                                  "CMAKE_CXX_COMPILER_LAUNCHER=ccache",
+                                });
+        }
+    }
     printMessage("[Start Build]");
     auto result = (*container)->run(process);
     if (!result) {
@@ -604,8 +1012,13 @@ utils::error::Result<void> Builder::build(const QStringList &args) noexcept
         return LINGLONG_ERR(output);
     }
 
-    auto ret =
-      splitDevelop(developOutput.absolutePath(), binaryOutput.absolutePath(), installPrefix);
+    util::SizeCounter developSize;
+    util::SizeCounter binarySize;
+    auto ret = splitDevelop(developOutput.absolutePath(),
+                            binaryOutput.absolutePath(),
+                            installPrefix,
+                            developSize,
+                            binarySize);
     if (!ret) {
         return LINGLONG_ERR(ret);
     }
@@ -641,7 +1054,20 @@ utils::error::Result<void> Builder::build(const QStringList &args) noexcept
         if (project.command.value_or(std::vector<std::string>{}).empty()) {
             return LINGLONG_ERR("command field is required, please specify!");
         }
+        // 拆分后新建的入口和链接也属于layer，不需要再遍历整个目录
+        for (const auto &path : { QString("entries"),
+                                  QString("entries/share"),
+                                  QString("files/share"),
+                                  QString("files/share/systemd"),
+                                  QString("files/share/systemd/user") }) {
+            binarySize.add(binaryOutput.absoluteFilePath("../" + path));
+            developSize.add(developOutput.absoluteFilePath("../" + path));
+        }
     }
+    qDebug() << "binary size" << binarySize.apparentSize() << "disk usage"
+             << binarySize.diskSize();
+    qDebug() << "develop size" << developSize.apparentSize() << "disk usage"
+             << developSize.diskSize();
 
     // when the base version is likes 20.0.0.1, warning that it is a full version
     // if the base version is likes 20.0.0, we should also write 20.0.0 to info.json
@@ -664,7 +1090,7 @@ utils::error::Result<void> Builder::build(const QStringList &args) noexcept
         .permissions = this->project.permissions,
         .runtime = {},
         .schemaVersion = PACKAGE_INFO_VERSION,
-        .size = static_cast<int64_t>(util::sizeOfDir(binaryOutput.absoluteFilePath(".."))),
+        .size = static_cast<int64_t>(binarySize.apparentSize()),
         .version = this->project.package.version,
     };
 
@@ -691,7 +1117,7 @@ utils::error::Result<void> Builder::build(const QStringList &args) noexcept
     infoFile.close();
 
     info.packageInfoV2Module = "develop";
-    info.size = util::sizeOfDir(developOutput.absoluteFilePath(".."));
+    info.size = static_cast<int64_t>(developSize.apparentSize());
 
     infoFile.setFileName(developOutput.absoluteFilePath("../info.json"));
     if (!infoFile.open(QIODevice::WriteOnly | QIODevice::Truncate)) {
@@ -703,25 +1129,18 @@ utils::error::Result<void> Builder::build(const QStringList &args) noexcept
         return LINGLONG_ERR(infoFile);
     }
     infoFile.close();
-    package::LayerDir binaryOutputLayerDir = binaryOutput.absoluteFilePath("..");
-    result = this->repo.remove(*ref);
+    result = commitOutput();
     if (!result) {
-        qWarning() << "remove" << ref->toString() << result.error().message();
-    }
-    auto localLayer = this->repo.importLayerDir(binaryOutputLayerDir);
-    if (!localLayer) {
-        return LINGLONG_ERR(localLayer);
+        return LINGLONG_ERR(result);
     }
 
-    package::LayerDir developOutputLayerDir = developOutput.absoluteFilePath("..");
-    result = this->repo.remove(*ref, true);
-    if (!result) {
-        qWarning() << "remove" << ref->toString() << result.error().message();
-    }
-    localLayer = this->repo.importLayerDir(developOutputLayerDir);
-    if (!localLayer) {
-        return LINGLONG_ERR(localLayer);
-    }
+    // Record the inputs as they are after the build. Fetching sources and in-tree builds (qmake
+    // or make in /project) rewrite files of the project, the next build starts from this state.
+    updateBuildStamp(
+      stampPath,
+      buildInputsDigest(this->project, this->cfg, this->workingDir, args, dependLayerDirs),
+      this->repo,
+      *ref);
 
     printMessage("Successfully build " + this->project.package.id);
     return LINGLONG_OK;
@@ -744,6 +1163,12 @@ utils::error::Result<void> Builder::exportUAB(const QString &destination, const
         }
     }
 
+    if (!option.compressor.isEmpty()) {
+        if (auto ret = packager.setCompressor(option.compressor); !ret) {
+            return LINGLONG_ERR(ret);
+        }
+    }
+
     auto baseRef = pullDependency(QString::fromStdString(this->project.base),
                                   this->repo,
                                   false,
@@ -755,7 +1180,47 @@ utils::error::Result<void> Builder::exportUAB(const QString &destination, const
     if (!baseDir) {
         return LINGLONG_ERR(baseDir);
     }
-    packager.appendLayer(*baseDir);
+
+    QList<QRegularExpression> allowlist;
+    if (!option.minifyAllowlist.isEmpty()) {
+        QFile file(option.minifyAllowlist);
+        if (!file.open(QIODevice::ReadOnly | QIODevice::Text)) {
+            return LINGLONG_ERR(file);
+        }
+        for (const auto &line : QString::fromUtf8(file.readAll()).split('\n')) {
+            const auto pattern = line.trimmed();
+            if (pattern.isEmpty() || pattern.startsWith('#')) {
+                continue;
+            }
+            allowlist.append(QRegularExpression(QRegularExpression::anchoredPattern(
+              QRegularExpression::wildcardToRegularExpression(pattern))));
+        }
+    }
+    auto minifyFilter =
+      [&](const QString &id) -> utils::error::Result<std::optional<package::MinifyFilter>> {
+        LINGLONG_TRACE("minify " + id);
+
+        if (!option.minify) {
+            return std::nullopt;
+        }
+
+        const auto traceFile = accessTraceFile(this->workingDir, id);
+        if (!QFileInfo::exists(traceFile)) {
+            return LINGLONG_ERR("no access trace of " + id
+                                + ", please run 'll-builder run --trace-access' first");
+        }
+        auto files = loadAccessTrace(traceFile);
+        if (!files) {
+            return LINGLONG_ERR(files);
+        }
+        return package::MinifyFilter{ .files = std::move(files).value(), .allowlist = allowlist };
+    };
+
+    auto baseFilter = minifyFilter(baseRef->id);
+    if (!baseFilter) {
+        return LINGLONG_ERR(baseFilter);
+    }
+    packager.appendLayer(*baseDir, *baseFilter);
 
     if (this->project.runtime) {
         auto ref = pullDependency(QString::fromStdString(*this->project.runtime),
@@ -769,7 +1234,11 @@ utils::error::Result<void> Builder::exportUAB(const QString &destination, const
         if (!runtimeDir) {
             return LINGLONG_ERR(runtimeDir);
         }
-        packager.appendLayer(*runtimeDir);
+        auto runtimeFilter = minifyFilter(ref->id);
+        if (!runtimeFilter) {
+            return LINGLONG_ERR(runtimeFilter);
+        }
+        packager.appendLayer(*runtimeDir, *runtimeFilter);
     }
 
     auto curRef = currentReference(this->project);
@@ -810,45 +1279,43 @@ utils::error::Result<void> Builder::exportLayer(const QString &destination)
         return LINGLONG_ERR(ref);
     }
 
-    auto binaryLayerDir = this->repo.getLayerDir(*ref);
-    if (!binaryLayerDir) {
-        return LINGLONG_ERR(binaryLayerDir);
-    }
-    const auto binaryLayerPath = QString("%1/%2_%3_%4_%5.layer")
-                                   .arg(destDir.absolutePath(),
-                                        ref->id,
-                                        ref->version.toString(),
-                                        ref->arch.toString(),
-                                        "binary");
-
-    auto developLayerDir = this->repo.getLayerDir(*ref, true);
-    const auto develLayerPath = QString("%1/%2_%3_%4_%5.layer")
-                                  .arg(destDir.absolutePath(),
-                                       ref->id,
-                                       ref->version.toString(),
-                                       ref->arch.toString(),
-                                       "develop");
-    if (!developLayerDir) {
-        return LINGLONG_ERR(developLayerDir);
-    }
-
-    package::LayerPackager pkger;
-
-    auto binaryLayer = pkger.pack(*binaryLayerDir, binaryLayerPath);
-    if (!binaryLayer) {
-        return LINGLONG_ERR(binaryLayer);
-    }
-
-    auto develLayer = pkger.pack(*developLayerDir, develLayerPath);
-    if (!develLayer) {
-        return LINGLONG_ERR(develLayer);
+    QMap<QString, package::LayerDir> layerDirs;
+    for (const auto &module : { QString("binary"), QString("develop") }) {
+        auto layerDir = this->repo.getLayerDir(*ref, module == "develop");
+        if (!layerDir) {
+            return LINGLONG_ERR(layerDir);
+        }
+        layerDirs.insert(module, *layerDir);
+    }
+
+    auto exportModule = [&](const QString &module) -> utils::error::Result<void> {
+        LINGLONG_TRACE("export " + module);
+
+        const auto layerPath = QString("%1/%2_%3_%4_%5.layer")
+                                 .arg(destDir.absolutePath(),
+                                      ref->id,
+                                      ref->version.toString(),
+                                      ref->arch.toString(),
+                                      module);
+        // 每个模块使用独立的工作目录
+        package::LayerPackager pkger;
+        auto layer = pkger.pack(layerDirs.value(module), layerPath);
+        if (!layer) {
+            return LINGLONG_ERR(layer);
+        }
+        return LINGLONG_OK;
+    };
+    auto result = forEachModule("Export Layer", layerDirs.keys(), exportModule);
+    if (!result) {
+        return LINGLONG_ERR(result);
     }
 
     return LINGLONG_OK;
 }
 
 utils::error::Result<void> Builder::extractLayer(const QString &layerPath,
-                                                 const QString &destination)
+                                                 const QString &destination,
+                                                 package::ExtractMethod method)
 {
     LINGLONG_TRACE("extract " + layerPath + " to " + destination);
 
@@ -863,16 +1330,9 @@ utils::error::Result<void> Builder::extractLayer(const QString &layerPath,
     }
 
     package::LayerPackager pkg;
-    auto layerDir = pkg.unpack(*(*layerFile));
-    if (!layerDir) {
-        return LINGLONG_ERR(layerDir);
-    }
-
-    auto output = utils::command::Exec("cp",
-                                       QStringList() << "-r" << layerDir->absolutePath()
-                                                     << destDir.absolutePath());
-    if (!output) {
-        return LINGLONG_ERR(output);
+    auto result = pkg.extract(*(*layerFile), destDir, method);
+    if (!result) {
+        return LINGLONG_ERR(result);
     }
     return LINGLONG_OK;
 }
@@ -908,15 +1368,14 @@ linglong::utils::error::Result<void> Builder::push(bool pushWithDevel,
         return LINGLONG_ERR(result);
     }
 
+    QStringList modules{ "binary" };
     if (pushWithDevel) {
-        result = repo.push(*ref, true);
-
-        if (!result) {
-            return LINGLONG_ERR(result);
-        }
+        modules.append("develop");
     }
 
-    result = repo.push(*ref);
+    result = forEachModule("Push Layer", modules, [this, &ref](const QString &module) {
+        return this->repo.push(*ref, module == "develop");
+    });
     if (!result) {
         return LINGLONG_ERR(result);
     }
@@ -948,7 +1407,7 @@ utils::error::Result<void> Builder::importLayer(const QString &path)
     return LINGLONG_OK;
 }
 
-utils::error::Result<void> Builder::run(const QStringList &args)
+utils::error::Result<void> Builder::run(const QStringList &args, bool traceAccess)
 {
     LINGLONG_TRACE("run application");
 
@@ -991,6 +1450,7 @@ utils::error::Result<void> Builder::run(const QStringList &args)
     }
     options.baseDir = QDir(baseDir->absolutePath());
 
+    QString runtimeID;
     if (this->project.runtime) {
         auto ref = pullDependency(QString::fromStdString(*this->project.runtime),
                                   this->repo,
@@ -1004,6 +1464,7 @@ utils::error::Result<void> Builder::run(const QStringList &args)
             return LINGLONG_ERR(dir);
         }
         options.runtimeDir = QDir(dir->absolutePath());
+        runtimeID = ref->id;
     }
 
     if (this->project.package.kind == "runtime") {
@@ -1056,6 +1517,25 @@ utils::error::Result<void> Builder::run(const QStringList &args)
 
     options.mounts = std::move(applicationMounts);
 
+    // 只记录依赖的base和runtime，应用自身不需要精简
+    QMap<QString, QString> tracedLayers;
+    std::unique_ptr<AccessTracer> tracer;
+    if (traceAccess) {
+        if (this->project.package.kind != "app") {
+            return LINGLONG_ERR("access trace is only supported by app");
+        }
+        tracedLayers.insert(baseRef->id, options.baseDir.absolutePath());
+        if (!runtimeID.isEmpty()) {
+            tracedLayers.insert(runtimeID, options.runtimeDir->absolutePath());
+        }
+
+        auto ret = AccessTracer::create(tracedLayers.values());
+        if (!ret) {
+            return LINGLONG_ERR(ret);
+        }
+        tracer = std::move(ret).value();
+    }
+
     auto container = this->containerBuilder.create(options);
     if (!container) {
         return LINGLONG_ERR(container);
@@ -1080,6 +1560,42 @@ utils::error::Result<void> Builder::run(const QStringList &args)
         return LINGLONG_ERR(result);
     }
 
+    if (tracer) {
+        const auto accessed = tracer->stop();
+        printMessage("[Access Trace]");
+        for (auto it = tracedLayers.cbegin(); it != tracedLayers.cend(); ++it) {
+            const auto traceFile = accessTraceFile(this->workingDir, it.key());
+            QSet<QString> files;
+            if (QFileInfo::exists(traceFile)) {
+                auto ret = loadAccessTrace(traceFile);
+                if (!ret) {
+                    return LINGLONG_ERR(ret);
+                }
+                files = std::move(ret).value();
+            }
+
+            const auto prefix = it.value() + "/";
+            for (const auto &path : accessed) {
+                if (path.startsWith(prefix)) {
+                    files.insert(path.mid(prefix.length()));
+                }
+            }
+
+            auto lines = files.values();
+            lines.sort();
+            if (!QDir().mkpath(QFileInfo(traceFile).path())) {
+                return LINGLONG_ERR("mkpath " + QFileInfo(traceFile).path() + ": failed");
+            }
+            QFile file(traceFile);
+            if (!file.open(QIODevice::WriteOnly | QIODevice::Truncate | QIODevice::Text)
+                || file.write((lines.join('\n') + '\n').toUtf8()) < 0) {
+                return LINGLONG_ERR(file);
+            }
+            printMessage(QString("%1%2 files").arg(it.key(), -40).arg(lines.size()).toStdString(),
+                         2);
+        }
+    }
+
     return LINGLONG_OK;
 }
 
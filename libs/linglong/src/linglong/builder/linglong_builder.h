@@ -9,6 +9,8 @@
 
 #include "linglong/api/types/v1/BuilderConfig.hpp"
 #include "linglong/api/types/v1/BuilderProject.hpp"
+#include "linglong/builder/file.h"
+#include "linglong/package/layer_packager.h"
 #include "linglong/repo/ostree_repo.h"
 #include "linglong/runtime/container_builder.h"
 #include "linglong/utils/error/error.h"
@@ -20,8 +22,35 @@ struct UABOption
     QString iconPath;
     bool exportDevelop{ false };
     bool exportI18n{ false };
+    QString compressor; // 为空时使用默认的压缩方式
+    bool minify{ false }; // 根据run --trace-access的记录精简base和runtime
+    QString minifyAllowlist;
 };
 
+// 上一次成功构建的输入摘要和提交结果，保存在linglong/build.stamp
+struct BuildStamp
+{
+    QString inputsDigest;
+    QString binaryCommit;
+    QString developCommit;
+};
+
+auto loadBuildStamp(const QString &path) noexcept -> utils::error::Result<BuildStamp>;
+auto saveBuildStamp(const QString &path, const BuildStamp &stamp) noexcept
+  -> utils::error::Result<void>;
+// 构建输入的摘要：linglong.yaml、构建参数、依赖的layer，以及项目目录和linglong/sources中
+// 文件的元数据。ll-builder自己写入的output、cache、ccache、minify等不参与计算
+auto buildInputsDigest(const api::types::v1::BuilderProject &project,
+                       const api::types::v1::BuilderConfig &cfg,
+                       const QDir &workingDir,
+                       const QStringList &args,
+                       const QStringList &dependLayerDirs) noexcept -> QString;
+// 输入没有变化，并且仓库中的binary和develop仍是上次构建提交的内容时，才可以跳过构建
+auto isBuildUpToDate(const BuildStamp &stamp,
+                     const QString &inputsDigest,
+                     const repo::OSTreeRepo &repo,
+                     const package::Reference &ref) noexcept -> bool;
+
 class Builder
 {
 public:
@@ -43,7 +72,9 @@ public:
     auto exportLayer(const QString &destination) -> utils::error::Result<void>;
 
     auto extractLayer(const QString &layerPath,
-                      const QString &destination) -> utils::error::Result<void>;
+                      const QString &destination,
+                      package::ExtractMethod method = package::ExtractMethod::Auto)
+      -> utils::error::Result<void>;
 
     auto push(bool pushWithDevel = true,
               const QString &repoUrl = "",
@@ -53,14 +84,17 @@ public:
 
     auto importLayer(const QString &path) -> utils::error::Result<void>;
 
-    auto run(const QStringList &args = { QString("bash") }) -> utils::error::Result<void>;
+    auto run(const QStringList &args = { QString("bash") },
+             bool traceAccess = false) -> utils::error::Result<void>;
 
     auto appimageConvert(const QStringList &templateArgs) -> utils::error::Result<void>;
 
 private:
     auto splitDevelop(QDir developOutput,
                       QDir runtimeOutput,
-                      QString prefix) -> utils::error::Result<void>;
+                      QString prefix,
+                      util::SizeCounter &developSize,
+                      util::SizeCounter &binarySize) -> utils::error::Result<void>;
 
     repo::OSTreeRepo &repo;
     QDir workingDir;
@@ -12,7 +12,13 @@
 #include "linglong/utils/global/initialize.h"
 
 #include <QDir>
+#include <QMutex>
 #include <QTemporaryDir>
+#include <QThreadPool>
+#include <QtConcurrent/QtConcurrent>
+
+#include <algorithm>
+#include <atomic>
 
 namespace linglong::builder {
 
@@ -89,6 +95,63 @@ QString SourceFetcher::getSourceName()
     return "unknown";
 }
 
+auto fetchSources(const std::vector<api::types::v1::BuilderProjectSource> &sources,
+                  const api::types::v1::BuilderConfig &cfg,
+                  const QDir &cacheDir,
+                  const QDir &destination,
+                  int jobs,
+                  const std::function<void(std::size_t, FetchState)> &progress) noexcept
+  -> utils::error::Result<void>
+{
+    LINGLONG_TRACE("fetch sources to " + destination.absolutePath());
+
+    QThreadPool pool;
+    pool.setMaxThreadCount(std::max(jobs, 1));
+
+    QMutex progressMutex;
+    auto report = [&progress, &progressMutex](std::size_t pos, FetchState state) {
+        if (!progress) {
+            return;
+        }
+        QMutexLocker locker(&progressMutex);
+        progress(pos, state);
+    };
+
+    // stop starting new fetchers once one of them failed
+    std::atomic_bool failed = false;
+    std::vector<utils::error::Result<void>> results(sources.size());
+    QList<QFuture<void>> futures;
+    for (std::size_t pos = 0; pos < sources.size(); ++pos) {
+        futures.append(QtConcurrent::run(&pool, [&, pos]() {
+            if (failed) {
+                return;
+            }
+
+            report(pos, FetchState::Downloading);
+            SourceFetcher sf(sources.at(pos), cfg, cacheDir);
+            results[pos] = sf.fetch(destination);
+            if (!results[pos]) {
+                failed = true;
+                report(pos, FetchState::Failed);
+                return;
+            }
+            report(pos, FetchState::Complete);
+        }));
+    }
+
+    for (auto &future : futures) {
+        future.waitForFinished();
+    }
+
+    for (auto &result : results) {
+        if (!result) {
+            return LINGLONG_ERR(result);
+        }
+    }
+
+    return LINGLONG_OK;
+}
+
 SourceFetcher::SourceFetcher(api::types::v1::BuilderProjectSource s,
                              api::types::v1::BuilderConfig cfg,
                              const QDir &cacheDir)
@@ -16,6 +16,8 @@
 #include <QUrl>
 #include <QDir>
 
+#include <functional>
+
 namespace linglong::builder {
 
 class SourceFetcher
@@ -34,6 +36,19 @@ private:
     api::types::v1::BuilderConfig cfg;
 };
 
+enum class FetchState { Downloading, Complete, Failed };
+
+// Fetch all sources into destination, running at most `jobs` fetchers at the same time.
+// Fetchers share cacheDir, the fetch scripts keep it consistent even across concurrent
+// builds. progress is called from worker threads, but never concurrently.
+auto fetchSources(const std::vector<api::types::v1::BuilderProjectSource> &sources,
+                  const api::types::v1::BuilderConfig &cfg,
+                  const QDir &cacheDir,
+                  const QDir &destination,
+                  int jobs,
+                  const std::function<void(std::size_t, FetchState)> &progress = nullptr) noexcept
+  -> utils::error::Result<void>;
+
 } // namespace linglong::builder
 
 #endif // LINGLONG_SRC_BUILDER_SOURCE_FETCHER_H_
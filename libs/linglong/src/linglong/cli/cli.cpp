@@ -185,6 +185,29 @@ utils::error::Result<package::LayerDir> Cli::getDependLayerDir(
     return this->repository.getLayerDir(dependRef, false, subRef);
 }
 
+utils::error::Result<std::vector<ocppi::types::ContainerListItem>>
+Cli::listContainers(const QString &appID) const noexcept
+{
+    LINGLONG_TRACE("list containers");
+
+    // NOTE: Only ll-box maintains the container registry, other OCI runtimes have to be asked.
+    if (this->ociCLI.bin().filename() != "ll-box") {
+        auto containers = this->ociCLI.list();
+        if (!containers) {
+            return LINGLONG_ERR(containers);
+        }
+
+        return *containers;
+    }
+
+    auto containers = appID.isEmpty() ? this->registry.list() : this->registry.listByApp(appID);
+    if (!containers) {
+        return LINGLONG_ERR(containers);
+    }
+
+    return containers;
+}
+
 int Cli::run(std::map<std::string, docopt::value> &args)
 {
     LINGLONG_TRACE("command run");
@@ -280,7 +303,8 @@ int Cli::run(std::map<std::string, docopt::value> &args)
     }
     auto execArgs = filePathMapping(args, command);
 
-    auto containers = this->ociCLI.list().value_or(std::vector<ocppi::types::ContainerListItem>{});
+    auto containers =
+      this->listContainers(curAppRef->id).value_or(std::vector<ocppi::types::ContainerListItem>{});
     for (const auto &container : containers) {
         const auto &decodedID = QString(QByteArray::fromBase64(container.id.c_str()));
         if (!decodedID.startsWith(curAppRef->toString())) {
@@ -386,7 +410,7 @@ int Cli::exec(std::map<std::string, docopt::value> &args)
 {
     LINGLONG_TRACE("ll-cli exec");
 
-    auto containers = this->ociCLI.list();
+    auto containers = this->listContainers();
     if (!containers) {
         auto err = LINGLONG_ERRV(containers);
         this->printer.printErr(err);
@@ -447,7 +471,7 @@ int Cli::ps(std::map<std::string, docopt::value> & /*args*/)
 {
     LINGLONG_TRACE("command ps");
 
-    auto containers = this->ociCLI.list();
+    auto containers = this->listContainers();
     if (!containers) {
         auto err = LINGLONG_ERRV(containers);
         this->printer.printErr(err);
@@ -474,7 +498,7 @@ int Cli::kill(std::map<std::string, docopt::value> &args)
 {
     LINGLONG_TRACE("command kill");
 
-    auto containers = this->ociCLI.list();
+    auto containers = this->listContainers();
     if (!containers) {
         auto err = LINGLONG_ERRV(containers);
         this->printer.printErr(err);
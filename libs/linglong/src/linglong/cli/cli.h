@@ -11,6 +11,7 @@
 #include "linglong/cli/printer.h"
 #include "linglong/repo/ostree_repo.h"
 #include "linglong/runtime/container_builder.h"
+#include "linglong/runtime/container_registry.h"
 
 #include <docopt.h>
 
@@ -46,6 +47,7 @@ private:
     runtime::ContainerBuilder &containerBuilder;
     repo::OSTreeRepo &repository;
     api::dbus::v1::PackageManager &pkgMan;
+    runtime::ContainerRegistry registry;
     QString taskID;
     bool taskDone{ true };
     service::InstallTask::Status lastStatus;
@@ -57,6 +59,8 @@ private:
     void updateAM() noexcept;
     [[nodiscard]] utils::error::Result<package::LayerDir> getDependLayerDir(
       const package::Reference &appRef, const package::Reference &ref) const noexcept;
+    [[nodiscard]] utils::error::Result<std::vector<ocppi::types::ContainerListItem>>
+    listContainers(const QString &appID = "") const noexcept;
 
 public:
     int run(std::map<std::string, docopt::value> &args);
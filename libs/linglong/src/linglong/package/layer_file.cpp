@@ -8,15 +8,70 @@
 
 #include "linglong/api/types/v1/LayerInfo.hpp"
 #include "linglong/api/types/v1/Generators.hpp"
-#include "linglong/utils/serialize/json.h"
+#include "linglong/utils/finally/finally.h"
 
-#include <QDataStream>
 #include <QFileInfo>
+#include <QtEndian>
+
+#include <algorithm>
+#include <cstring>
+
+#include <fcntl.h>
+#include <unistd.h>
 
 namespace linglong::package {
 
 using nlohmann::json;
 
+namespace {
+
+// 元信息只有几KB，限制长度，避免按照损坏的头部分配过多内存
+constexpr quint32 maxMetaInfoLength = 16 * 1024 * 1024;
+
+// 使用pread读取，不改变与调用者共享的读写位置
+utils::error::Result<void> readAt(int fd, char *buf, size_t length, off_t offset) noexcept
+{
+    LINGLONG_TRACE("read layer");
+
+    size_t done = 0;
+    while (done < length) {
+        auto ret = ::pread(fd, buf + done, length - done, offset + static_cast<off_t>(done));
+        if (ret == -1 && errno == EINTR) {
+            continue;
+        }
+        if (ret == -1) {
+            return LINGLONG_ERR(QString{ "pread failed: %1" }.arg(::strerror(errno)));
+        }
+        if (ret == 0) {
+            return LINGLONG_ERR("unexpected end of layer file");
+        }
+        done += static_cast<size_t>(ret);
+    }
+
+    return LINGLONG_OK;
+}
+
+utils::error::Result<void> writeAll(int fd, const char *buf, size_t length) noexcept
+{
+    LINGLONG_TRACE("write layer");
+
+    size_t done = 0;
+    while (done < length) {
+        auto ret = ::write(fd, buf + done, length - done);
+        if (ret == -1 && errno == EINTR) {
+            continue;
+        }
+        if (ret == -1) {
+            return LINGLONG_ERR(QString{ "write failed: %1" }.arg(::strerror(errno)));
+        }
+        done += static_cast<size_t>(ret);
+    }
+
+    return LINGLONG_OK;
+}
+
+} // namespace
+
 LayerFile::LayerFile(const QString &path)
     : QFile(path)
 {
@@ -24,9 +79,42 @@ LayerFile::LayerFile(const QString &path)
         throw std::runtime_error("open layer failed");
     }
 
-    if (this->read(magicNumber.size()) != magicNumber) {
+    this->readHeader();
+}
+
+LayerFile::LayerFile(int fd)
+{
+    auto dupFd = ::fcntl(fd, F_DUPFD_CLOEXEC, 0);
+    if (dupFd == -1) {
+        throw std::runtime_error(std::string{ "dup layer descriptor failed: " }
+                                 + ::strerror(errno));
+    }
+
+    if (!this->open(dupFd, QIODevice::ReadOnly, QFileDevice::AutoCloseHandle)) {
+        ::close(dupFd);
+        throw std::runtime_error("open layer failed");
+    }
+
+    this->readHeader();
+}
+
+// 头部固定44字节，只读取头部并校验元信息长度，元信息在需要时再读取
+void LayerFile::readHeader()
+{
+    const auto headerSize = magicNumber.size() + sizeof(quint32);
+    QByteArray header(int(headerSize), '\0');
+    auto ret = readAt(this->handle(), header.data(), headerSize, 0);
+    if (!ret || !header.startsWith(magicNumber)) {
         throw std::runtime_error("invalid magic number, this is not a layer");
     }
+
+    auto length = qFromLittleEndian<quint32>(header.constData() + magicNumber.size());
+    if (length == 0 || length > maxMetaInfoLength
+        || headerSize + length > quint64(this->size())) {
+        throw std::runtime_error("invalid meta info length");
+    }
+
+    this->metaInfoLengthValue = length;
 }
 
 LayerFile::~LayerFile()
@@ -46,6 +134,21 @@ try {
     return LINGLONG_ERR(e);
 }
 
+utils::error::Result<QSharedPointer<LayerFile>> LayerFile::New(int fd) noexcept
+
+try {
+    QSharedPointer<LayerFile> layerFile(new LayerFile(fd));
+    return layerFile;
+} catch (const std::exception &e) {
+    LINGLONG_TRACE("open layer from descriptor");
+    return LINGLONG_ERR(e);
+}
+
+QString LayerFile::descriptorPath() const noexcept
+{
+    return QString("/dev/fd/%1").arg(this->handle());
+}
+
 void LayerFile::setCleanStatus(bool status) noexcept
 {
     this->cleanup = status;
@@ -55,60 +158,90 @@ utils::error::Result<api::types::v1::LayerInfo> LayerFile::metaInfo() noexcept
 {
     LINGLONG_TRACE("get layer file info");
 
-    auto ret = this->metaInfoLength();
-    if (!ret) {
-        return LINGLONG_ERR(ret);
+    if (this->metaInfoValue) {
+        return *this->metaInfoValue;
     }
 
-    auto rawData = this->read(qint64(*ret));
-
-    auto layerInfo = utils::serialize::LoadJSON<api::types::v1::LayerInfo>(rawData);
-    if (!layerInfo) {
-        return LINGLONG_ERR(layerInfo);
-    }
-
-    return layerInfo;
-}
-
-utils::error::Result<quint32> LayerFile::metaInfoLength()
-{
-    LINGLONG_TRACE("read meta info length");
-
-    if (metaInfoLengthValue > 0) {
-        return metaInfoLengthValue;
+    std::string rawData(this->metaInfoLengthValue, '\0');
+    auto ret = readAt(this->handle(),
+                      rawData.data(),
+                      rawData.size(),
+                      magicNumber.size() + sizeof(quint32));
+    if (!ret) {
+        return LINGLONG_ERR(ret);
     }
 
-    QDataStream layerDataStream(this);
-
-    layerDataStream.startTransaction();
-    layerDataStream.setByteOrder(QDataStream::LittleEndian);
-    layerDataStream >> metaInfoLengthValue;
-
-    if (!layerDataStream.commitTransaction()) {
-        return LINGLONG_ERR("unknown error.");
+    try {
+        this->metaInfoValue = json::parse(rawData).get<api::types::v1::LayerInfo>();
+    } catch (const std::exception &e) {
+        return LINGLONG_ERR("parse meta info", e);
     }
 
-    return metaInfoLengthValue;
+    return *this->metaInfoValue;
 }
 
 utils::error::Result<quint32> LayerFile::binaryDataOffset() noexcept
 {
-    LINGLONG_TRACE("get binary data offset");
-
-    auto size = this->metaInfoLength();
-    if (!size) {
-        return LINGLONG_ERR(size);
-    }
-
-    return magicNumber.size() + *size + sizeof(quint32);
+    return magicNumber.size() + sizeof(quint32) + this->metaInfoLengthValue;
 }
 
 utils::error::Result<void> LayerFile::saveTo(const QString &destination) noexcept
 {
     LINGLONG_TRACE(QString("save layer file to %1").arg(destination));
 
-    if (!this->copy(destination)) {
-        return LINGLONG_ERR(*this);
+    auto out = ::open(destination.toLocal8Bit().constData(),
+                      O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC,
+                      0644);
+    if (out == -1) {
+        return LINGLONG_ERR(QString("open %1: %2").arg(destination, ::strerror(errno)));
+    }
+    auto closeOut = utils::finally::finally([out] {
+        ::close(out);
+    });
+
+    // 直接从描述符复制，使用显式偏移，不改变与调用者共享的读写位置。
+    // copy_file_range在同一文件系统上可以使用reflink，不支持时退回到pread/write
+    const auto fileSize = this->size();
+    off_t inOffset = 0;
+    bool fallback = false;
+    while (inOffset < fileSize) {
+        if (!fallback) {
+            auto ret = ::copy_file_range(this->handle(),
+                                         &inOffset,
+                                         out,
+                                         nullptr,
+                                         fileSize - inOffset,
+                                         0);
+            if (ret > 0) {
+                continue;
+            }
+            if (ret == -1 && errno == EINTR) {
+                continue;
+            }
+            if (ret == -1
+                && (errno == EXDEV || errno == ENOSYS || errno == EINVAL
+                    || errno == EOPNOTSUPP)) {
+                fallback = true;
+                continue;
+            }
+            ::unlink(destination.toLocal8Bit().constData());
+            if (ret == 0) {
+                return LINGLONG_ERR("unexpected end of layer file");
+            }
+            return LINGLONG_ERR(QString("copy_file_range: %1").arg(::strerror(errno)));
+        }
+
+        char buf[64 * 1024];
+        auto length = std::min<qint64>(sizeof(buf), fileSize - inOffset);
+        auto ret = readAt(this->handle(), buf, length, inOffset);
+        if (ret) {
+            ret = writeAll(out, buf, length);
+        }
+        if (!ret) {
+            ::unlink(destination.toLocal8Bit().constData());
+            return LINGLONG_ERR(ret);
+        }
+        inOffset += length;
     }
 
     return LINGLONG_OK;
@@ -12,6 +12,8 @@
 
 #include <QFile>
 
+#include <optional>
+
 namespace linglong::package {
 
 const QByteArray magicNumber =
@@ -24,6 +26,9 @@ const QByteArray magicNumber =
 // meta info length  4                 40
 // meta info         meta info length  44
 // binary data                         44 + meta info length
+//
+// 打开时只读取并校验头部，元信息在第一次使用时按照头部记录的位置读取，数据部分由调用者
+// 通过描述符按流读取。文件可能来自普通用户，全部使用pread读取，文件被截断只会导致读取失败。
 class LayerFile : public QFile
 {
 public:
@@ -39,17 +44,25 @@ public:
 
     utils::error::Result<void> saveTo(const QString &destination) noexcept;
 
+    // 指向当前打开的描述符的/dev/fd路径，文件被删除或替换后依然有效。
+    // 外部进程（如erofsfuse）需要通过utils::command::Exec继承handle()之后才能使用该路径
+    [[nodiscard]] QString descriptorPath() const noexcept;
+
     // NOTE: Maybe should be removed. and use QTemporaryFile
     void setCleanStatus(bool status) noexcept;
 
     static utils::error::Result<QSharedPointer<LayerFile>> New(const QString &path) noexcept;
+    // 使用已经打开的描述符，内部会复制一份，不会改变原描述符的读写位置
+    static utils::error::Result<QSharedPointer<LayerFile>> New(int fd) noexcept;
 
 private:
     explicit LayerFile(const QString &path);
-    utils::error::Result<quint32> metaInfoLength();
+    explicit LayerFile(int fd);
+    void readHeader();
 
     bool cleanup = false;
     quint32 metaInfoLengthValue = 0;
+    std::optional<api::types::v1::LayerInfo> metaInfoValue;
 };
 
 } // namespace linglong::package
@@ -9,9 +9,19 @@
 #include "linglong/api/types/v1/Generators.hpp"
 #include "linglong/api/types/v1/LayerInfo.hpp"
 #include "linglong/utils/command/env.h"
+#include "linglong/utils/finally/finally.h"
 
 #include <QDataStream>
 #include <QSysInfo>
+#include <QThread>
+#include <QThreadPool>
+#include <QtConcurrent/QtConcurrent>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <vector>
 
 namespace linglong::package {
 
@@ -52,7 +62,16 @@ LayerPackager::pack(const LayerDir &dir, const QString &layerFilePath) const
 {
     LINGLONG_TRACE("pack layer");
 
-    QFile layer(layerFilePath);
+    // 先写入临时文件，完成后再重命名，失败时不会留下不完整的layer文件
+    const auto partFilePath = layerFilePath + ".part";
+    bool done = false;
+    auto cleanPart = utils::finally::finally([&partFilePath, &done]() {
+        if (!done) {
+            QFile::remove(partFilePath);
+        }
+    });
+
+    QFile layer(partFilePath);
     if (layer.exists()) {
         layer.remove();
     }
@@ -99,7 +118,9 @@ LayerPackager::pack(const LayerDir &dir, const QString &layerFilePath) const
     layer.close();
 
     // compress data with erofs
-    const auto &compressedFilePath = this->workDir.absoluteFilePath("tmp.erofs");
+    // 同一个packager可能同时打包多个layer，临时文件不能重名
+    const auto &compressedFilePath =
+      this->workDir.absoluteFilePath(QFileInfo(layerFilePath).fileName() + ".erofs");
     const auto &ignoreRegex = QString{ "--exclude-regex=minified*" };
     auto ret =
       utils::command::Exec("mkfs.erofs",
@@ -110,11 +131,18 @@ LayerPackager::pack(const LayerDir &dir, const QString &layerFilePath) const
 
     ret = utils::command::Exec(
       "sh",
-      { "-c", QString("cat %1 >> %2").arg(compressedFilePath, layerFilePath) });
+      { "-c", QString("cat %1 >> %2").arg(compressedFilePath, partFilePath) });
+    QFile::remove(compressedFilePath);
     if (!ret) {
-        LINGLONG_ERR(ret);
+        return LINGLONG_ERR(ret);
     }
 
+    if (::rename(partFilePath.toLocal8Bit(), layerFilePath.toLocal8Bit()) != 0) {
+        return LINGLONG_ERR(QString("rename %1 to %2: %3")
+                              .arg(partFilePath, layerFilePath, ::strerror(errno)));
+    }
+    done = true;
+
     auto result = LayerFile::New(layerFilePath);
     Q_ASSERT(result.has_value());
 
@@ -128,8 +156,6 @@ utils::error::Result<LayerDir> LayerPackager::unpack(LayerFile &file)
     auto unpackDir = QDir(this->workDir.absoluteFilePath("unpack"));
     unpackDir.mkpath(".");
 
-    QFileInfo fileInfo(file);
-
     auto offset = file.binaryDataOffset();
     if (!offset) {
         return LINGLONG_ERR(offset);
@@ -137,8 +163,9 @@ utils::error::Result<LayerDir> LayerPackager::unpack(LayerFile &file)
 
     auto ret = utils::command::Exec("erofsfuse",
                                     { QString("--offset=%1").arg(*offset),
-                                      fileInfo.absoluteFilePath(),
-                                      unpackDir.absolutePath() });
+                                      file.descriptorPath(),
+                                      unpackDir.absolutePath() },
+                                    { file.handle() });
     if (!ret) {
         return LINGLONG_ERR(ret);
     }
@@ -146,4 +173,76 @@ utils::error::Result<LayerDir> LayerPackager::unpack(LayerFile &file)
     return unpackDir.absolutePath();
 }
 
+utils::error::Result<void>
+LayerPackager::extract(LayerFile &file, const QDir &destination, ExtractMethod method)
+{
+    LINGLONG_TRACE("extract layer file to " + destination.absolutePath());
+
+    if (method != ExtractMethod::Fuse) {
+        auto offset = file.binaryDataOffset();
+        if (!offset) {
+            return LINGLONG_ERR(offset);
+        }
+
+        // fsck.erofs在进程内解压镜像，保留xattr和文件属性，不需要经过fuse逐个读取文件
+        auto ret = utils::command::Exec("fsck.erofs",
+                                        { QString("--offset=%1").arg(*offset),
+                                          "--extract=" + destination.absolutePath(),
+                                          "--xattrs",
+                                          "--preserve",
+                                          file.descriptorPath() },
+                                        { file.handle() });
+        if (ret) {
+            return LINGLONG_OK;
+        }
+        if (method == ExtractMethod::Fsck) {
+            return LINGLONG_ERR(ret);
+        }
+
+        qWarning() << "extract with fsck.erofs failed, fallback to erofsfuse:" << ret.error();
+        QDir(destination).removeRecursively();
+    }
+
+    auto layerDir = this->unpack(file);
+    if (!layerDir) {
+        return LINGLONG_ERR(layerDir);
+    }
+
+    if (!destination.mkpath(".")) {
+        return LINGLONG_ERR("mkpath " + destination.absolutePath() + ": failed");
+    }
+
+    // 每个顶层条目由一个cp -a整体复制，顶层目录的xattr、属主和时间戳也随之保留。
+    // --sparse和--reflink避免写入空洞和重复数据
+    const auto entries =
+      layerDir->entryList(QDir::AllEntries | QDir::NoDotAndDotDot | QDir::Hidden | QDir::System);
+
+    QThreadPool pool;
+    pool.setMaxThreadCount(std::max(QThread::idealThreadCount(), 1));
+    std::vector<utils::error::Result<QString>> results(entries.size());
+    QList<QFuture<void>> futures;
+    for (int pos = 0; pos < entries.size(); ++pos) {
+        futures.append(QtConcurrent::run(&pool, [&, pos]() {
+            results[pos] = utils::command::Exec("cp",
+                                                { "-a",
+                                                  "--reflink=auto",
+                                                  "--sparse=always",
+                                                  "--no-target-directory",
+                                                  layerDir->absoluteFilePath(entries.at(pos)),
+                                                  destination.absoluteFilePath(entries.at(pos)) });
+        }));
+    }
+    for (auto &future : futures) {
+        future.waitForFinished();
+    }
+
+    for (auto &result : results) {
+        if (!result) {
+            return LINGLONG_ERR(result);
+        }
+    }
+
+    return LINGLONG_OK;
+}
+
 } // namespace linglong::package
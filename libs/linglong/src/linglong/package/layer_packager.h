@@ -16,6 +16,13 @@
 
 namespace linglong::package {
 
+// 将layer文件解压到目录的方式
+enum class ExtractMethod {
+    Auto, // 优先使用fsck.erofs，失败时回退到erofsfuse
+    Fsck, // fsck.erofs直接读取镜像，不经过fuse
+    Fuse, // erofsfuse挂载后并发复制
+};
+
 class LayerPackager : public QObject
 {
 public:
@@ -29,6 +36,9 @@ public:
     utils::error::Result<QSharedPointer<LayerFile>> pack(const LayerDir &dir,
                                                          const QString &layerFilePath) const;
     utils::error::Result<LayerDir> unpack(LayerFile &file);
+    utils::error::Result<void> extract(LayerFile &file,
+                                       const QDir &destination,
+                                       ExtractMethod method = ExtractMethod::Auto);
 
 private:
     QDir workDir;
@@ -15,8 +15,42 @@
 #include <QFileInfo>
 #include <QStandardPaths>
 
+#include <algorithm>
+#include <cstring>
+#include <vector>
+
+#include <fcntl.h>
+#include <unistd.h>
+
 namespace linglong::package {
 
+namespace {
+
+// uab可能来自普通用户，读取时文件可能被截断，使用pread而不是mmap，截断只会导致读取失败
+utils::error::Result<void> readAt(int fd, char *buf, size_t length, GElf_Off offset) noexcept
+{
+    LINGLONG_TRACE("read uab")
+
+    size_t done = 0;
+    while (done < length) {
+        auto ret = ::pread(fd, buf + done, length - done, static_cast<off_t>(offset + done));
+        if (ret == -1 && errno == EINTR) {
+            continue;
+        }
+        if (ret == -1) {
+            return LINGLONG_ERR(QString{ "pread failed: %1" }.arg(::strerror(errno)));
+        }
+        if (ret == 0) {
+            return LINGLONG_ERR("unexpected end of uab file");
+        }
+        done += static_cast<size_t>(ret);
+    }
+
+    return LINGLONG_OK;
+}
+
+} // namespace
+
 /**
  * In the package_manager.cpp file, the method installFromUAB attempts to move a lambda to
  * QCoreApplication::instance() via QMetaObject::invokeMethod, which has a object of type
@@ -42,15 +76,38 @@ utils::error::Result<std::shared_ptr<UABFile>> UABFile::loadFromFile(const QStri
         return LINGLONG_ERR(QString{ "open uab failed: %1" }.arg(file->errorString()));
     }
 
-    auto fd = file->handle();
+    auto ret = file->loadSections();
+    if (!ret) {
+        return LINGLONG_ERR(ret);
+    }
 
-    elf_version(EV_CURRENT);
-    auto *elf = elf_begin(fd, ELF_C_READ, nullptr);
-    if (elf == nullptr) {
-        return LINGLONG_ERR(QString{ "libelf err:" }.arg(elf_errmsg(errno)));
+    return file;
+}
+
+utils::error::Result<std::shared_ptr<UABFile>> UABFile::loadFromFile(int fd)
+{
+    struct EnableMaker : public UABFile
+    {
+        using UABFile::UABFile;
+    };
+
+    LINGLONG_TRACE("load uab file from descriptor")
+    auto file = std::make_shared<EnableMaker>();
+
+    auto dupFd = ::fcntl(fd, F_DUPFD_CLOEXEC, 0);
+    if (dupFd == -1) {
+        return LINGLONG_ERR(QString{ "dup uab descriptor failed: %1" }.arg(::strerror(errno)));
     }
 
-    file->e = elf;
+    if (!file->open(dupFd, QIODevice::ReadOnly, QFileDevice::AutoCloseHandle)) {
+        ::close(dupFd);
+        return LINGLONG_ERR(QString{ "open uab failed: %1" }.arg(file->errorString()));
+    }
+
+    auto ret = file->loadSections();
+    if (!ret) {
+        return LINGLONG_ERR(ret);
+    }
 
     return file;
 }
@@ -63,35 +120,64 @@ UABFile::~UABFile()
             qCritical() << "failed to umount " << mountPoint << ", please umount it manually";
         }
     }
+}
 
-    elf_end(this->e);
+QString UABFile::descriptorPath() const noexcept
+{
+    return QString("/dev/fd/%1").arg(handle());
 }
 
-utils::error::Result<GElf_Shdr> UABFile::getSectionHeader(const QString &section) const noexcept
+utils::error::Result<void> UABFile::loadSections() noexcept
 {
-    LINGLONG_TRACE("get uab section header")
+    LINGLONG_TRACE("load uab sections")
+
+    elf_version(EV_CURRENT);
+    auto *elf = elf_begin(handle(), ELF_C_READ, nullptr);
+    if (elf == nullptr) {
+        return LINGLONG_ERR(QString{ "libelf err: %1" }.arg(elf_errmsg(-1)));
+    }
+    auto closeElf = utils::finally::finally([elf] {
+        elf_end(elf);
+    });
 
     size_t shdrstrndx{ 0 };
-    if (elf_getshdrstrndx(this->e, &shdrstrndx) == -1) {
+    if (elf_getshdrstrndx(elf, &shdrstrndx) == -1) {
         return LINGLONG_ERR(
-          QString{ "failed to get section header index of bundle: %1" }.arg(elf_errmsg(errno)));
+          QString{ "failed to get section header index of bundle: %1" }.arg(elf_errmsg(-1)));
     }
 
     Elf_Scn *scn{ nullptr };
-    while ((scn = elf_nextscn(this->e, scn)) != nullptr) {
+    while ((scn = elf_nextscn(elf, scn)) != nullptr) {
         GElf_Shdr shdr;
         if (gelf_getshdr(scn, &shdr) == nullptr) {
             return LINGLONG_ERR(
-              QString{ "failed to get section header of bundle: %1" }.arg(elf_errmsg(errno)));
+              QString{ "failed to get section header of bundle: %1" }.arg(elf_errmsg(-1)));
         }
 
-        auto *sname = elf_strptr(this->e, shdrstrndx, shdr.sh_name);
-        if (section.compare(sname) == 0) {
-            return shdr;
+        auto *sname = elf_strptr(elf, shdrstrndx, shdr.sh_name);
+        if (sname == nullptr) {
+            continue;
+        }
+        // 与之前的线性查找保持一致，同名section以第一个为准
+        const auto name = QString::fromUtf8(sname);
+        if (!this->sections.contains(name)) {
+            this->sections.insert(name, shdr);
         }
     }
 
-    return LINGLONG_ERR(QString{ "couldn't found section %1" }.arg(section));
+    return LINGLONG_OK;
+}
+
+utils::error::Result<GElf_Shdr> UABFile::getSectionHeader(const QString &section) const noexcept
+{
+    LINGLONG_TRACE("get uab section header")
+
+    auto it = this->sections.constFind(section);
+    if (it == this->sections.constEnd()) {
+        return LINGLONG_ERR(QString{ "couldn't found section %1" }.arg(section));
+    }
+
+    return it.value();
 }
 
 utils::error::Result<std::reference_wrapper<const api::types::v1::UabMetaInfo>>
@@ -108,19 +194,22 @@ UABFile::getMetaInfo() noexcept
         return LINGLONG_ERR(metaSh.error());
     }
 
-    seek(metaSh->sh_offset);
-    auto backToHead = utils::finally::finally([this] {
-        seek(0);
-    });
+    // meta section只有几KB，限制大小，避免按照损坏的section头分配过多内存
+    constexpr GElf_Xword maxMetaSize = 16 * 1024 * 1024;
+    if (metaSh->sh_size == 0 || metaSh->sh_size > maxMetaSize
+        || metaSh->sh_offset + metaSh->sh_size > static_cast<GElf_Xword>(size())) {
+        return LINGLONG_ERR("couldn't read metaInfo from uab: invalid section");
+    }
 
-    auto metaInfo = read(metaSh->sh_size).toStdString();
-    if (metaInfo.empty()) {
-        return LINGLONG_ERR(QString{ "couldn't read metaInfo from uab: %1" }.arg(errorString()));
+    std::string metaData(metaSh->sh_size, '\0');
+    auto ret = readAt(handle(), metaData.data(), metaData.size(), metaSh->sh_offset);
+    if (!ret) {
+        return LINGLONG_ERR(ret);
     }
 
     nlohmann::json content;
     try {
-        content = nlohmann::json::parse(metaInfo);
+        content = nlohmann::json::parse(metaData);
     } catch (nlohmann::json::parse_error &e) {
         return LINGLONG_ERR(QString{ "parsing metaInfo error: %1" }.arg(e.what()));
     } catch (...) {
@@ -141,7 +230,7 @@ utils::error::Result<bool> UABFile::verify() noexcept
         return LINGLONG_ERR(metaInfoRet.error());
     }
 
-    auto metaInfo = metaInfoRet->get();
+    const auto &metaInfo = metaInfoRet->get();
     auto expectedDigest = metaInfo.digest;
     auto bundleSection = QString::fromStdString(metaInfo.sections.bundle);
     auto bundleSh = getSectionHeader(bundleSection);
@@ -150,30 +239,26 @@ utils::error::Result<bool> UABFile::verify() noexcept
           QString{ "couldn't find bundle section which named %1" }.arg(bundleSection));
     }
 
-    std::array<char, 4096> buf{};
+    if (bundleSh->sh_offset + bundleSh->sh_size > static_cast<GElf_Xword>(size())) {
+        return LINGLONG_ERR("unexpected end of uab file");
+    }
+
     std::string digest;
     QCryptographicHash cryptor{ QCryptographicHash::Sha256 };
 
-    seek(bundleSh->sh_offset);
-    auto backToHead = utils::finally::finally([this] {
-        seek(0);
-    });
-
-    auto bundleLength = bundleSh->sh_size;
-    auto readBytes = buf.size();
-    int bytesRead{ 0 };
-    while ((bytesRead = read(buf.data(), readBytes)) != 0) {
-        if (bytesRead == -1) {
-            return LINGLONG_ERR(QString{ "read error: %1" }.arg(errorString()));
-        }
-
-        cryptor.addData(buf.data(), bytesRead);
-        bundleLength -= bytesRead;
-        if (bundleLength <= 0) {
-            digest = cryptor.result().toHex().toStdString();
-            break;
+    // 只读取bundle section的内容，section后面可能还有其他数据
+    // 按块读取，QCryptographicHash::addData的长度是int
+    constexpr GElf_Xword chunkSize = 1 << 20;
+    std::vector<char> buf(chunkSize);
+    for (GElf_Xword done = 0; done < bundleSh->sh_size; done += chunkSize) {
+        auto length = std::min(chunkSize, bundleSh->sh_size - done);
+        auto ret = readAt(handle(), buf.data(), length, bundleSh->sh_offset + done);
+        if (!ret) {
+            return LINGLONG_ERR(ret);
         }
+        cryptor.addData(buf.data(), static_cast<int>(length));
     }
+    digest = cryptor.result().toHex().toStdString();
 
     return (expectedDigest == digest);
 }
@@ -187,13 +272,13 @@ utils::error::Result<QDir> UABFile::mountUab() noexcept
         return LINGLONG_ERR(metaInfoRet.error());
     }
 
-    auto bundleSh = getSectionHeader(QString::fromStdString(metaInfo->sections.bundle));
+    const auto &metaInfo = metaInfoRet->get();
+    auto bundleSh = getSectionHeader(QString::fromStdString(metaInfo.sections.bundle));
     if (!bundleSh) {
         return LINGLONG_ERR(bundleSh.error());
     }
 
     auto bundleOffset = bundleSh->sh_offset;
-    auto metaInfo = metaInfoRet->get();
     auto uuid = metaInfo.uuid;
     QDir destination{ QStandardPaths::writableLocation(QStandardPaths::RuntimeLocation) };
     QDir uabDir = destination.absoluteFilePath("linglong" % QDir::separator() % "UAB"
@@ -205,7 +290,8 @@ utils::error::Result<QDir> UABFile::mountUab() noexcept
 
     auto ret = utils::command::Exec(
       "erofsfuse",
-      { QString{ "--offset=%1" }.arg(bundleOffset), fileName(), uabDir.absolutePath() });
+      { QString{ "--offset=%1" }.arg(bundleOffset), descriptorPath(), uabDir.absolutePath() },
+      { handle() });
     if (!ret) {
         return LINGLONG_ERR(ret.error());
     }
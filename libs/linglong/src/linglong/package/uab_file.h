@@ -12,6 +12,7 @@
 #include <libelf.h>
 
 #include <QDir>
+#include <QHash>
 #include <QScopedPointer>
 #include <QString>
 
@@ -21,21 +22,28 @@ class UABFile : public QFile
 {
 public:
     static utils::error::Result<std::shared_ptr<UABFile>> loadFromFile(const QString &input);
+    // 使用已经打开的描述符，内部会复制一份，读取时不会改变原描述符的读写位置
+    static utils::error::Result<std::shared_ptr<UABFile>> loadFromFile(int fd);
     UABFile(UABFile &&) = delete;
     UABFile &operator=(UABFile &&) = delete;
     ~UABFile() override;
 
     utils::error::Result<bool> verify() noexcept;
     utils::error::Result<QDir> mountUab() noexcept;
+    // 指向当前打开的描述符的/dev/fd路径，文件被删除或替换后依然有效，
+    // 外部进程需要通过utils::command::Exec继承handle()之后才能使用
+    [[nodiscard]] QString descriptorPath() const noexcept;
     [[nodiscard]] utils::error::Result<std::reference_wrapper<const api::types::v1::UabMetaInfo>>
     getMetaInfo() noexcept;
 
 private:
     [[nodiscard]] utils::error::Result<GElf_Shdr>
     getSectionHeader(const QString &section) const noexcept;
+    utils::error::Result<void> loadSections() noexcept;
     UABFile() = default;
 
-    Elf *e{ nullptr };
+    // 加载时解析一次section表，之后按名字查找
+    QHash<QString, GElf_Shdr> sections;
     std::unique_ptr<api::types::v1::UabMetaInfo> metaInfo{ nullptr };
     QString mountPoint;
 };
@@ -9,15 +9,27 @@
 #include "linglong/package/architecture.h"
 #include "linglong/utils/command/env.h"
 #include "linglong/utils/configure.h"
+#include "linglong/utils/finally/finally.h"
 
 #include <QCryptographicHash>
+#include <QDirIterator>
+#include <QMap>
+#include <QProcess>
 #include <QStandardPaths>
+#include <QSysInfo>
 
+#include <algorithm>
+#include <array>
+#include <cerrno>
+#include <cstddef>
+#include <cstring>
 #include <filesystem>
 #include <utility>
+#include <vector>
 
 #include <fcntl.h>
 #include <sys/mman.h>
+#include <sys/stat.h>
 #include <unistd.h>
 
 namespace linglong::package {
@@ -33,6 +45,7 @@ elfHelper::elfHelper(QByteArray path, int fd, Elf *ptr)
 
 elfHelper::elfHelper(elfHelper &&other) noexcept
     : filePath(std::move(other).filePath)
+    , pendingSections(std::move(other).pendingSections)
     , elfFd(other.elfFd)
     , e(other.e)
 {
@@ -49,6 +62,7 @@ elfHelper &elfHelper::operator=(elfHelper &&other) noexcept
     this->e = other.e;
     this->elfFd = other.elfFd;
     this->filePath = std::move(other).filePath;
+    this->pendingSections = std::move(other).pendingSections;
 
     other.e = nullptr;
     other.elfFd = -1;
@@ -91,20 +105,306 @@ utils::error::Result<elfHelper> elfHelper::create(const QByteArray &filePath) no
 }
 
 utils::error::Result<void> elfHelper::addNewSection(const QByteArray &sectionName,
-                                                    const QFileInfo &dataFile) const noexcept
+                                                    const QFileInfo &dataFile) noexcept
 {
     LINGLONG_TRACE(QString{ "add section:%1" }.arg(QString{ sectionName }))
 
-    auto ret = utils::command::Exec(
-      "objcopy",
-      { QString{ "--add-section" },
-        QString{ "%1=%2" }.arg(QString{ sectionName }).arg(dataFile.absoluteFilePath()),
-        this->elfPath(),
-        this->elfPath() });
+    if (!dataFile.isFile()) {
+        return LINGLONG_ERR(QString{ "%1 isn't a file" }.arg(dataFile.absoluteFilePath()));
+    }
+
+    this->pendingSections.append({ sectionName, dataFile });
+    return LINGLONG_OK;
+}
+
+namespace {
+
+// bundle的压缩方式和对应的mkfs.erofs参数。
+// 压缩后使用-Ededupe在多个layer之间去除重复数据，不压缩时按块去重。
+// lz4/lz4hc解压最快，适合优先启动速度；lzma压缩率最高，适合优先体积
+const QMap<QString, QStringList> &bundleCompressors() noexcept
+{
+    static const QMap<QString, QStringList> compressors{
+        { "none", { "--chunksize=4096" } },
+        { "lz4", { "-zlz4", "-Ededupe" } },
+        { "lz4hc", { "-zlz4hc,12", "-Ededupe" } },
+        { "lzma", { "-zlzma,9", "-Ededupe", "-C1048576" } },
+        { "zstd", { "-zzstd,15", "-Ededupe", "-C262144" } },
+    };
+    return compressors;
+}
+
+// 旧版本的mkfs.erofs不支持部分压缩算法和扩展参数，根据帮助信息检查参数中用到的功能
+bool mkfsErofsSupports(const QStringList &args) noexcept
+{
+    static const auto help = [] {
+        QProcess process;
+        process.setProcessChannelMode(QProcess::MergedChannels);
+        process.start("mkfs.erofs", { "--help" });
+        process.waitForFinished();
+        return QString::fromUtf8(process.readAll());
+    }();
+
+    return std::all_of(args.cbegin(), args.cend(), [](const QString &arg) {
+        QString feature;
+        if (arg.startsWith("-z")) {
+            feature = arg.mid(2).section(',', 0, 0);
+        } else if (arg.startsWith("-E")) {
+            feature = arg.mid(2);
+        } else if (arg.startsWith("--")) {
+            feature = arg.mid(2).section('=', 0, 0);
+        }
+
+        return feature.isEmpty()
+          || help.contains(
+            QRegularExpression("\\b" + QRegularExpression::escape(feature) + "\\b"));
+    });
+}
+
+// 优先使用copy_file_range，数据不经过用户态，文件系统支持时还可以共享数据块
+utils::error::Result<void> copyRange(int in, int out, off_t outOffset, off_t size) noexcept
+{
+    LINGLONG_TRACE("copy section data")
+
+    off_t inOffset{ 0 };
+    while (inOffset < size) {
+        auto ret = ::copy_file_range(in, &inOffset, out, &outOffset, size - inOffset, 0);
+        if (ret > 0) {
+            continue;
+        }
+        if (ret == 0) {
+            return LINGLONG_ERR("unexpected end of file");
+        }
+        if (errno == EINTR) {
+            continue;
+        }
+        if (errno != EXDEV && errno != ENOSYS && errno != EINVAL && errno != EOPNOTSUPP) {
+            return LINGLONG_ERR(QString{ "copy_file_range: %1" }.arg(::strerror(errno)));
+        }
+
+        std::array<char, 1024 * 1024> buf{};
+        while (inOffset < size) {
+            auto bytesRead = ::pread(in, buf.data(), buf.size(), inOffset);
+            if (bytesRead == -1 && errno == EINTR) {
+                continue;
+            }
+            if (bytesRead <= 0) {
+                return LINGLONG_ERR(QString{ "read: %1" }.arg(::strerror(errno)));
+            }
+
+            for (ssize_t written = 0; written < bytesRead;) {
+                auto ret = ::pwrite(out, buf.data() + written, bytesRead - written, outOffset);
+                if (ret == -1 && errno == EINTR) {
+                    continue;
+                }
+                if (ret == -1) {
+                    return LINGLONG_ERR(QString{ "write: %1" }.arg(::strerror(errno)));
+                }
+                written += ret;
+                outOffset += ret;
+            }
+            inOffset += bytesRead;
+        }
+    }
+
+    return LINGLONG_OK;
+}
+
+utils::error::Result<void> writeAll(int fd, const void *data, size_t size, off_t offset) noexcept
+{
+    LINGLONG_TRACE("write data")
+
+    const auto *ptr = static_cast<const char *>(data);
+    while (size > 0) {
+        auto ret = ::pwrite(fd, ptr, size, offset);
+        if (ret == -1 && errno == EINTR) {
+            continue;
+        }
+        if (ret == -1) {
+            return LINGLONG_ERR(QString{ "write: %1" }.arg(::strerror(errno)));
+        }
+        ptr += ret;
+        size -= ret;
+        offset += ret;
+    }
+
+    return LINGLONG_OK;
+}
+
+template<typename Shdr>
+QByteArray serializeSectionHeaders(const std::vector<GElf_Shdr> &shdrs)
+{
+    QByteArray table;
+    table.reserve(static_cast<int>(shdrs.size() * sizeof(Shdr)));
+    for (const auto &shdr : shdrs) {
+        Shdr sh{};
+        sh.sh_name = shdr.sh_name;
+        sh.sh_type = shdr.sh_type;
+        sh.sh_flags = shdr.sh_flags;
+        sh.sh_addr = shdr.sh_addr;
+        sh.sh_offset = shdr.sh_offset;
+        sh.sh_size = shdr.sh_size;
+        sh.sh_link = shdr.sh_link;
+        sh.sh_info = shdr.sh_info;
+        sh.sh_addralign = shdr.sh_addralign;
+        sh.sh_entsize = shdr.sh_entsize;
+        table.append(reinterpret_cast<const char *>(&sh), sizeof(sh));
+    }
+
+    return table;
+}
+
+template<typename Ehdr>
+utils::error::Result<void> updateElfHeader(int fd, GElf_Off shoff, GElf_Half shnum) noexcept
+{
+    LINGLONG_TRACE("update elf header")
+
+    decltype(Ehdr::e_shoff) off = shoff;
+    if (auto ret = writeAll(fd, &off, sizeof(off), offsetof(Ehdr, e_shoff)); !ret) {
+        return LINGLONG_ERR(ret);
+    }
+
+    if (auto ret = writeAll(fd, &shnum, sizeof(shnum), offsetof(Ehdr, e_shnum)); !ret) {
+        return LINGLONG_ERR(ret);
+    }
+
+    return LINGLONG_OK;
+}
+
+} // namespace
+
+utils::error::Result<void> elfHelper::writeSections() noexcept
+{
+    LINGLONG_TRACE(QString{ "write sections to %1" }.arg(QString{ this->filePath }))
+
+    // section数据按页对齐，便于直接mmap或通过offset挂载
+    constexpr off_t sectionAlign = 4096;
+    auto alignUp = [](off_t offset, off_t align) {
+        return (offset + align - 1) / align * align;
+    };
+
+    auto fd = ::open(this->filePath.constData(), O_RDWR | O_CLOEXEC);
+    if (fd == -1) {
+        return LINGLONG_ERR(QString{ "open %1: %2" }
+                              .arg(QString{ this->filePath })
+                              .arg(::strerror(errno)));
+    }
+    auto closeFd = utils::finally::finally([fd] {
+        ::close(fd);
+    });
+
+    elf_version(EV_CURRENT);
+    auto *elf = elf_begin(fd, ELF_C_READ, nullptr);
+    if (elf == nullptr) {
+        return LINGLONG_ERR(QString{ "libelf err: %1" }.arg(elf_errmsg(-1)));
+    }
+    auto endElf = utils::finally::finally([elf] {
+        elf_end(elf);
+    });
+
+    GElf_Ehdr ehdr;
+    if (gelf_getehdr(elf, &ehdr) == nullptr) {
+        return LINGLONG_ERR(QString{ "failed to get elf header: %1" }.arg(elf_errmsg(-1)));
+    }
+
+    // uab header总是为当前架构编译的，不需要处理字节序转换
+    const auto hostData = QSysInfo::ByteOrder == QSysInfo::LittleEndian ? ELFDATA2LSB : ELFDATA2MSB;
+    if (ehdr.e_ident[EI_DATA] != hostData) {
+        return LINGLONG_ERR("byte order of uab header doesn't match the host");
+    }
+
+    size_t shnum{ 0 };
+    size_t shstrndx{ 0 };
+    if (elf_getshdrnum(elf, &shnum) == -1 || elf_getshdrstrndx(elf, &shstrndx) == -1) {
+        return LINGLONG_ERR(QString{ "failed to get section headers: %1" }.arg(elf_errmsg(-1)));
+    }
+    if (ehdr.e_shnum == 0 || shstrndx >= shnum
+        || shnum + this->pendingSections.size() >= SHN_LORESERVE) {
+        return LINGLONG_ERR("extended section numbering isn't supported");
+    }
+
+    std::vector<GElf_Shdr> shdrs(shnum);
+    for (size_t i = 0; i < shnum; ++i) {
+        if (gelf_getshdr(elf_getscn(elf, i), &shdrs[i]) == nullptr) {
+            return LINGLONG_ERR(
+              QString{ "failed to get section header %1: %2" }.arg(i).arg(elf_errmsg(-1)));
+        }
+    }
+
+    const auto strtab = shdrs[shstrndx];
+    QByteArray names(static_cast<int>(strtab.sh_size), '\0');
+    if (::pread(fd, names.data(), names.size(), static_cast<off_t>(strtab.sh_offset))
+        != names.size()) {
+        return LINGLONG_ERR(QString{ "failed to read section names: %1" }.arg(::strerror(errno)));
+    }
+
+    struct stat fileStat{};
+    if (::fstat(fd, &fileStat) == -1) {
+        return LINGLONG_ERR(QString{ "fstat: %1" }.arg(::strerror(errno)));
+    }
+
+    // 原有的section header table和名称表保留在原位置，新的内容全部追加到文件末尾
+    auto offset = fileStat.st_size;
+    for (const auto &[sectionName, dataFile] : std::as_const(this->pendingSections)) {
+        auto in = ::open(dataFile.absoluteFilePath().toLocal8Bit().constData(),
+                         O_RDONLY | O_CLOEXEC);
+        if (in == -1) {
+            return LINGLONG_ERR(QString{ "open %1: %2" }
+                                  .arg(dataFile.absoluteFilePath())
+                                  .arg(::strerror(errno)));
+        }
+        auto closeIn = utils::finally::finally([in] {
+            ::close(in);
+        });
+
+        struct stat dataStat{};
+        if (::fstat(in, &dataStat) == -1) {
+            return LINGLONG_ERR(QString{ "fstat: %1" }.arg(::strerror(errno)));
+        }
+
+        offset = alignUp(offset, sectionAlign);
+        if (auto ret = copyRange(in, fd, offset, dataStat.st_size); !ret) {
+            return LINGLONG_ERR(QString{ "failed to write section %1" }.arg(QString{ sectionName }),
+                                ret);
+        }
+
+        GElf_Shdr shdr{};
+        shdr.sh_name = names.size();
+        shdr.sh_type = SHT_PROGBITS;
+        shdr.sh_offset = offset;
+        shdr.sh_size = dataStat.st_size;
+        shdr.sh_addralign = 1;
+        shdrs.push_back(shdr);
+
+        names.append(sectionName);
+        names.append('\0');
+        offset += dataStat.st_size;
+    }
+
+    shdrs[shstrndx].sh_offset = offset;
+    shdrs[shstrndx].sh_size = names.size();
+    if (auto ret = writeAll(fd, names.constData(), names.size(), offset); !ret) {
+        return LINGLONG_ERR(ret);
+    }
+    offset += names.size();
+
+    const auto elfClass = gelf_getclass(elf);
+    auto table = elfClass == ELFCLASS64 ? serializeSectionHeaders<Elf64_Shdr>(shdrs)
+                                        : serializeSectionHeaders<Elf32_Shdr>(shdrs);
+    offset = alignUp(offset, 8);
+    if (auto ret = writeAll(fd, table.constData(), table.size(), offset); !ret) {
+        return LINGLONG_ERR(ret);
+    }
+
+    // 最后更新ELF头，之前的步骤失败时原文件仍然可用
+    auto ret = elfClass == ELFCLASS64
+      ? updateElfHeader<Elf64_Ehdr>(fd, offset, static_cast<GElf_Half>(shdrs.size()))
+      : updateElfHeader<Elf32_Ehdr>(fd, offset, static_cast<GElf_Half>(shdrs.size()));
     if (!ret) {
-        return LINGLONG_ERR(ret.error());
+        return LINGLONG_ERR(ret);
     }
 
+    this->pendingSections.clear();
     return LINGLONG_OK;
 }
 
@@ -157,7 +457,24 @@ utils::error::Result<void> UABPackager::setIcon(const QFileInfo &newIcon)
     return LINGLONG_OK;
 }
 
-utils::error::Result<void> UABPackager::appendLayer(const LayerDir &layer)
+utils::error::Result<void> UABPackager::setCompressor(const QString &newCompressor)
+{
+    LINGLONG_TRACE("set compressor of uab bundle")
+
+    const QMap<QString, QString> presets{ { "fast", "lz4hc" }, { "small", "lzma" } };
+    auto name = presets.value(newCompressor, newCompressor);
+    if (!bundleCompressors().contains(name)) {
+        return LINGLONG_ERR(
+          QString{ "unsupported compressor %1, available: %2, fast, small" }
+            .arg(newCompressor, bundleCompressors().keys().join(", ")));
+    }
+
+    compressor = name;
+    return LINGLONG_OK;
+}
+
+utils::error::Result<void> UABPackager::appendLayer(const LayerDir &layer,
+                                                    std::optional<MinifyFilter> filter)
 {
     LINGLONG_TRACE("append layer to uab")
 
@@ -166,6 +483,9 @@ utils::error::Result<void> UABPackager::appendLayer(const LayerDir &layer)
     }
 
     layers.append(layer);
+    if (filter) {
+        minifyFilters.insert(layer.absolutePath(), std::move(filter).value());
+    }
     return LINGLONG_OK;
 }
 
@@ -209,6 +529,10 @@ utils::error::Result<void> UABPackager::pack(const QString &uabFilename)
         return ret;
     }
 
+    if (auto ret = this->uab.writeSections(); !ret) {
+        return LINGLONG_ERR(ret);
+    }
+
     auto exportPath =
       QFileInfo{ this->buildDir.absolutePath() }.dir().absoluteFilePath(uabFilename);
 
@@ -221,7 +545,9 @@ utils::error::Result<void> UABPackager::pack(const QString &uabFilename)
           QString{ "file %1 already exist and could't remove it" }.arg(exportPath));
     }
 
-    if (!QFile::copy(this->uab.elfPath(), exportPath)) {
+    // 构建目录和导出目录在同一个文件系统中，重命名即可，不需要再复制一次
+    if (!QFile::rename(this->uab.elfPath(), exportPath)
+        && !QFile::copy(this->uab.elfPath(), exportPath)) {
         return LINGLONG_ERR(QString{ "export uab from %1 to %2 failed" }
                               .arg(QString{ this->uab.elfPath() })
                               .arg(exportPath));
@@ -233,7 +559,7 @@ utils::error::Result<void> UABPackager::pack(const QString &uabFilename)
         return LINGLONG_ERR("couldn't set executable permission to uab");
     }
 
-    if (!QFile::remove(this->uab.elfPath())) {
+    if (QFileInfo::exists(this->uab.elfPath()) && !QFile::remove(this->uab.elfPath())) {
         qWarning() << "couldn't remove" << this->uab.elfPath() << ", please remove it manually";
     }
 
@@ -260,6 +586,113 @@ utils::error::Result<void> UABPackager::packIcon() noexcept
     return LINGLONG_OK;
 }
 
+namespace {
+
+// bundle目录只作为mkfs.erofs的输入，不会被修改，优先使用硬链接避免复制layer中的文件。
+// 仓库和构建目录不在同一个文件系统时回退到cp，支持reflink的文件系统上仍然不需要复制数据
+utils::error::Result<void> stageComponent(const QString &src, const QString &dest) noexcept
+{
+    LINGLONG_TRACE(QString{ "stage %1 to %2" }.arg(src, dest))
+
+    std::error_code ec;
+    std::filesystem::copy(src.toStdString(),
+                          dest.toStdString(),
+                          std::filesystem::copy_options::copy_symlinks
+                            | std::filesystem::copy_options::recursive
+                            | std::filesystem::copy_options::create_hard_links,
+                          ec);
+    if (!ec) {
+        return LINGLONG_OK;
+    }
+
+    if (ec != std::errc::cross_device_link && ec != std::errc::operation_not_permitted
+        && ec != std::errc::too_many_links) {
+        return LINGLONG_ERR("couldn't link from " % src % " to " % dest % " "
+                            % QString::fromStdString(ec.message()));
+    }
+
+    qCDebug(uab_packager) << "couldn't hardlink" << src
+                          << "fallback to copy:" << ec.message().c_str();
+    std::filesystem::remove_all(dest.toStdString(), ec);
+    if (ec) {
+        return LINGLONG_ERR("couldn't remove " % dest % " " % QString::fromStdString(ec.message()));
+    }
+
+    auto ret = utils::command::Exec("cp",
+                                    { "--archive",
+                                      "--reflink=auto",
+                                      "--no-preserve=ownership",
+                                      "--no-target-directory",
+                                      src,
+                                      dest });
+    if (!ret) {
+        return LINGLONG_ERR(ret);
+    }
+
+    return LINGLONG_OK;
+}
+
+} // namespace
+
+// 只保留filter中的文件，目录、符号链接和layer顶层的文件总是保留
+utils::error::Result<void>
+stageMinifiedLayer(const QDir &layer, const QDir &dest, const MinifyFilter &filter) noexcept
+{
+    LINGLONG_TRACE(QString{ "stage minified layer %1" }.arg(layer.absolutePath()))
+
+    const auto root = layer.absolutePath();
+    std::size_t kept{ 0 };
+    std::size_t dropped{ 0 };
+    QDirIterator it(root,
+                    QDir::AllEntries | QDir::NoDotAndDotDot | QDir::Hidden | QDir::System,
+                    QDirIterator::Subdirectories);
+    while (it.hasNext()) {
+        it.next();
+        const auto info = it.fileInfo();
+        const auto relative = it.filePath().mid(root.length() + 1);
+        if (relative.startsWith("minified")) {
+            continue;
+        }
+
+        const auto target = dest.absoluteFilePath(relative).toStdString();
+        std::error_code ec;
+        std::filesystem::create_directories(std::filesystem::path{ target }.parent_path(), ec);
+        if (ec) {
+            return LINGLONG_ERR("couldn't create parent of " % relative % " "
+                                % QString::fromStdString(ec.message()));
+        }
+        if (info.isSymLink()) {
+            std::filesystem::copy_symlink(info.absoluteFilePath().toStdString(), target, ec);
+        } else if (info.isDir()) {
+            std::filesystem::create_directories(target, ec);
+        } else {
+            auto keep = !relative.contains('/') || filter.files.contains(relative)
+              || std::any_of(filter.allowlist.cbegin(),
+                             filter.allowlist.cend(),
+                             [&relative](const QRegularExpression &pattern) {
+                                 return pattern.match(relative).hasMatch();
+                             });
+            if (!keep) {
+                ++dropped;
+                continue;
+            }
+
+            ++kept;
+            std::filesystem::create_hard_link(info.absoluteFilePath().toStdString(), target, ec);
+            if (ec) {
+                std::filesystem::copy_file(info.absoluteFilePath().toStdString(), target, ec);
+            }
+        }
+        if (ec) {
+            return LINGLONG_ERR("couldn't stage " % relative % " "
+                                % QString::fromStdString(ec.message()));
+        }
+    }
+
+    qCInfo(uab_packager) << "minified" << root << "keep" << kept << "files, drop" << dropped;
+    return LINGLONG_OK;
+}
+
 utils::error::Result<void> UABPackager::prepareBundle(const QDir &bundleDir) noexcept
 {
     LINGLONG_TRACE("prepare layers for make a bundle")
@@ -308,6 +741,16 @@ utils::error::Result<void> UABPackager::prepareBundle(const QDir &bundleDir) noe
               QString{ "couldn't create directory %1" }.arg(moduleDir.absolutePath()));
         }
 
+        if (auto filter = this->minifyFilters.find(layer.absolutePath());
+            filter != this->minifyFilters.end()) {
+            auto ret = stageMinifiedLayer(layer, moduleDir, filter.value());
+            if (!ret) {
+                return LINGLONG_ERR(ret);
+            }
+            this->meta.layers.push_back({ .info = info, .minified = true });
+            continue;
+        }
+
         // copy all files currently
         for (const auto &info :
              layer.entryInfoList(QDir::Dirs | QDir::Files | QDir::NoDotAndDotDot)) {
@@ -316,17 +759,10 @@ utils::error::Result<void> UABPackager::prepareBundle(const QDir &bundleDir) noe
                 continue;
             }
 
-            std::error_code ec;
-            std::filesystem::copy(info.absoluteFilePath().toStdString(),
-                                  moduleDir.absoluteFilePath(componentName).toStdString(),
-                                  std::filesystem::copy_options::copy_symlinks
-                                    | std::filesystem::copy_options::recursive
-                                    | std::filesystem::copy_options::update_existing,
-                                  ec);
-            if (ec) {
-                return LINGLONG_ERR("couldn't copy from " % info.absoluteFilePath() % " to "
-                                    % moduleDir.absoluteFilePath(componentName) % " "
-                                    % QString::fromStdString(ec.message()));
+            auto ret = stageComponent(info.absoluteFilePath(),
+                                      moduleDir.absoluteFilePath(componentName));
+            if (!ret) {
+                return LINGLONG_ERR(ret);
             }
         };
 
@@ -455,8 +891,25 @@ utils::error::Result<void> UABPackager::packBundle() noexcept
             return ret;
         }
 
-        if (auto ret = utils::command::Exec("mkfs.erofs", { bundleFile, bundleDir.absolutePath() });
-            !ret) {
+        auto name = compressor.isEmpty() ? QString{ "lz4hc" } : compressor;
+        auto args = bundleCompressors().value(name);
+        if (!mkfsErofsSupports(args)) {
+            if (!compressor.isEmpty()) {
+                return LINGLONG_ERR(
+                  QString{ "compressor %1 isn't supported by mkfs.erofs" }.arg(compressor));
+            }
+
+            qCWarning(uab_packager)
+              << "mkfs.erofs doesn't support" << name << ", make bundle without compression";
+            name = "none";
+            args = bundleCompressors().value(name);
+            if (!mkfsErofsSupports(args)) {
+                args.clear();
+            }
+        }
+        args << bundleFile << bundleDir.absolutePath();
+        qCDebug(uab_packager) << "make bundle with" << name;
+        if (auto ret = utils::command::Exec("mkfs.erofs", args); !ret) {
             return LINGLONG_ERR(ret);
         }
     }
@@ -13,7 +13,10 @@
 #include <libelf.h>
 
 #include <QDir>
+#include <QHash>
 #include <QLoggingCategory>
+#include <QRegularExpression>
+#include <QSet>
 #include <QString>
 #include <QUuid>
 
@@ -45,17 +48,34 @@ struct elfHelper
 
     [[nodiscard]] auto ElfPtr() const { return e; }
 
-    [[nodiscard]] utils::error::Result<void>
-    addNewSection(const QByteArray &sectionName, const QFileInfo &dataFile) const noexcept;
+    // 只记录需要添加的section，由writeSections统一写入
+    [[nodiscard]] utils::error::Result<void> addNewSection(const QByteArray &sectionName,
+                                                           const QFileInfo &dataFile) noexcept;
+
+    // 在文件末尾依次写入所有section的数据、名称表和新的section header table，
+    // 每个section的数据只会被写入一次
+    [[nodiscard]] utils::error::Result<void> writeSections() noexcept;
 
 private:
     elfHelper(QByteArray path, int fd, Elf *ptr);
 
     QByteArray filePath;
+    QList<QPair<QByteArray, QFileInfo>> pendingSections;
     int elfFd{ -1 };
     Elf *e{ nullptr };
 };
 
+// 精简layer时保留的文件，路径都相对于layer目录
+struct MinifyFilter
+{
+    QSet<QString> files;
+    QList<QRegularExpression> allowlist;
+};
+
+// 把layer中filter保留的文件硬链接到dest，目录、符号链接和layer顶层的文件总是保留
+utils::error::Result<void>
+stageMinifiedLayer(const QDir &layer, const QDir &dest, const MinifyFilter &filter) noexcept;
+
 class UABPackager
 {
 public:
@@ -65,7 +85,9 @@ public:
     UABPackager(UABPackager &&) = delete;
 
     utils::error::Result<void> setIcon(const QFileInfo &icon);
-    utils::error::Result<void> appendLayer(const LayerDir &layer);
+    utils::error::Result<void> setCompressor(const QString &compressor);
+    utils::error::Result<void> appendLayer(const LayerDir &layer,
+                                           std::optional<MinifyFilter> filter = std::nullopt);
     utils::error::Result<void> pack(const QString &uabFilename);
 
 private:
@@ -76,7 +98,10 @@ private:
 
     elfHelper uab;
     QList<LayerDir> layers;
+    QHash<QString, MinifyFilter> minifyFilters;
     std::optional<QFileInfo> icon{ std::nullopt };
+    // 为空时使用默认的lz4hc，mkfs.erofs不支持时退回到不压缩
+    QString compressor;
     api::types::v1::UabMetaInfo meta;
     QDir buildDir;
 };
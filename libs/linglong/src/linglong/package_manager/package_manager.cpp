@@ -21,6 +21,7 @@
 #include <QDBusUnixFileDescriptor>
 #include <QDebug>
 #include <QEventLoop>
+#include <QFileInfo>
 #include <QJsonArray>
 #include <QMetaObject>
 #include <QSettings>
@@ -91,25 +92,77 @@ auto PackageManager::setConfiguration(const QVariantMap &parameters) noexcept ->
         return toDBusReply(cfg);
     }
 
+    const auto enableHardlink = cfg->hardlinkLayers.value_or(false)
+      && !this->repo.getConfig().hardlinkLayers.value_or(false);
+
     auto result = this->repo.setConfig(*cfg);
     if (!result) {
         return toDBusReply(result);
     }
 
-    return toDBusReply(0, "Set repository configuration success.");
+    if (!enableHardlink) {
+        return toDBusReply(0, "Set repository configuration success.");
+    }
+
+    // 新安装的layer会直接硬链接仓库对象，已经安装的layer在开启时以任务的形式统一处理一次，
+    // 处理时间和已安装的layer数量有关，不能阻塞D-Bus调用
+    auto task = InstallTask::createTemporaryTask();
+    if (std::find(this->taskList.cbegin(), this->taskList.cend(), task) != this->taskList.cend()) {
+        return toDBusReply(-1, "installed layers are being deduplicated");
+    }
+
+    auto &taskRef = this->taskList.emplace_back(std::move(task));
+    connect(&taskRef, &InstallTask::TaskChanged, this, &PackageManager::TaskChanged);
+
+    QMetaObject::invokeMethod(
+      QCoreApplication::instance(),
+      [this, &taskRef] {
+          auto removeTask = utils::finally::finally([&taskRef, this] {
+              auto elem = std::find(this->taskList.begin(), this->taskList.end(), taskRef);
+              if (elem == this->taskList.end()) {
+                  qCritical() << "the status of package manager is invalid";
+                  return;
+              }
+              this->taskList.erase(elem);
+          });
+
+          taskRef.updateStatus(InstallTask::postInstall, "deduplicate installed layers");
+          auto saved = this->repo.deduplicateLayers([&taskRef](std::size_t done,
+                                                               std::size_t total) {
+              taskRef.updateTask(static_cast<double>(done),
+                                 static_cast<double>(total),
+                                 QString("%1 of %2 layers deduplicated").arg(done).arg(total));
+          });
+          if (!saved) {
+              taskRef.updateStatus(InstallTask::Failed, std::move(saved).error());
+              return;
+          }
+
+          qInfo() << "deduplicate installed layers," << *saved << "bytes saved";
+          taskRef.updateStatus(InstallTask::Success,
+                               QString("deduplicate installed layers, %1 bytes saved.")
+                                 .arg(*saved));
+      },
+      Qt::QueuedConnection);
+
+    return utils::serialize::toQVariantMap(api::types::v1::PackageManager1ResultWithTaskID{
+      .taskID = taskRef.taskID().toStdString(),
+      .code = 0,
+      .message = "Set repository configuration success, deduplicating installed layers.",
+    });
 }
 
 QVariantMap PackageManager::installFromLayer(const QDBusUnixFileDescriptor &fd) noexcept
 {
-    auto layerFileRet =
-      package::LayerFile::New(QString("/proc/%1/fd/%2").arg(getpid()).arg(fd.fileDescriptor()));
+    // 整个安装过程只使用客户端传来的描述符，客户端之后删除或替换文件都不受影响
+    auto layerFileRet = package::LayerFile::New(fd.fileDescriptor());
     if (!layerFileRet) {
         return toDBusReply(layerFileRet);
     }
     Q_ASSERT(*layerFileRet != nullptr);
 
     const auto &layerFile = *layerFileRet;
-    auto realFile = layerFile->symLinkTarget();
+    auto realFile = QFileInfo{ layerFile->descriptorPath() }.symLinkTarget();
     auto metaInfoRet = layerFile->metaInfo();
     if (!metaInfoRet) {
         return toDBusReply(metaInfoRet);
@@ -154,7 +207,6 @@ QVariantMap PackageManager::installFromLayer(const QDBusUnixFileDescriptor &fd)
 
     auto installer =
       [this,
-       fdDup = fd, // keep file descriptor don't close by the destructor of QDBusUnixFileDescriptor
        &taskRef,
        packageRef = std::move(packageRefRet).value(),
        layerFile = *layerFileRet]() {
@@ -261,13 +313,12 @@ utils::error::Result<api::types::v1::MinifiedInfo> PackageManager::updateMinifie
 
 QVariantMap PackageManager::installFromUAB(const QDBusUnixFileDescriptor &fd) noexcept
 {
-    auto uabRet = package::UABFile::loadFromFile(
-      QString("/proc/%1/fd/%2").arg(getpid()).arg(fd.fileDescriptor()));
+    auto uabRet = package::UABFile::loadFromFile(fd.fileDescriptor());
     if (!uabRet) {
         return toDBusReply(uabRet);
     }
     const auto &uab = *uabRet;
-    auto realFile = uab->symLinkTarget();
+    auto realFile = QFileInfo{ uab->descriptorPath() }.symLinkTarget();
 
     auto metaInfoRet = uab->getMetaInfo();
     if (!metaInfoRet) {
@@ -323,7 +374,6 @@ QVariantMap PackageManager::installFromUAB(const QDBusUnixFileDescriptor &fd) no
     auto installer =
       [this,
        &taskRef,
-       fdDup = fd, // keep file descriptor don't close by the destructor of QDBusUnixFileDescriptor
        uab = std::move(uabRet).value(),
        layerInfos = std::move(layerInfos),
        metaInfo = std::move(metaInfoRet).value(),
@@ -343,6 +393,28 @@ QVariantMap PackageManager::installFromUAB(const QDBusUnixFileDescriptor &fd) no
               return;
           }
 
+          // uab头部根据应用layer中的.uab-<uuid>标记判断导入是否已经完成，只能在事务提交之后写入
+          auto writeImportedTag = [uuid = QString::fromStdString(metaInfo.get().uuid)](
+                                    const QDir &appLayerDir) {
+              QFile importedTag = appLayerDir.absoluteFilePath(QString{ ".uab-%1" }.arg(uuid));
+              if (!importedTag.open(QIODevice::WriteOnly)) {
+                  qWarning() << "couldn't create" << importedTag.fileName() << ":"
+                             << importedTag.errorString();
+              }
+          };
+
+          // 应用已经从仓库、其他uab或者旧版本的玲珑安装过时不再导入，只补上标记，
+          // 否则uab每次启动都会重新在后台导入。同一个应用的其他任务在创建任务时已经排除，
+          // 导入失败时layer目录会被回滚删除，所以这里存在的layer目录都是完整的检出
+          auto installedApp = this->repo.getLayerDir(
+            appRef, layerInfos.front().info.packageInfoV2Module == "develop");
+          if (installedApp) {
+              writeImportedTag(*installedApp);
+              taskRef.updateStatus(InstallTask::Success,
+                                   appRef.toString() + " has already been installed");
+              return;
+          }
+
           taskRef.updateStatus(InstallTask::preInstall, "prepare for installing uab");
           auto verifyRet = uab->verify();
           if (!verifyRet) {
@@ -380,9 +452,18 @@ QVariantMap PackageManager::installFromUAB(const QDBusUnixFileDescriptor &fd) no
               return;
           }
 
-          utils::Transaction transaction;
+          // 已经安装的依赖直接跳过，其余的layer并发导入
+          struct ImportingLayer
+          {
+              package::Reference ref;
+              api::types::v1::PackageInfoV2 info;
+              QString subRef;
+              bool isAppLayer;
+          };
+
           const auto &uabLayersDir = QDir{ uabLayersDirInfo.absoluteFilePath() };
-          package::LayerDir appLayerDir;
+          std::vector<ImportingLayer> importing;
+          std::vector<std::pair<package::LayerDir, QString>> importingDirs;
           for (const auto &layer : layerInfos) {
               if (taskRef.currentStatus() == InstallTask::Canceled) {
                   qInfo() << "task" << taskRef.taskID() << "has been canceled by user, layer"
@@ -426,73 +507,100 @@ QVariantMap PackageManager::installFromUAB(const QDBusUnixFileDescriptor &fd) no
                   subRef.clear();
               }
 
-              auto ret = this->repo.importLayerDir(layerDir, subRef);
-              if (!ret) {
-                  if (ret.error().code() == 0
-                      && !isAppLayer) { // if dependency already exist, skip it
-                      continue;
+              // if dependency already exist, skip it
+              const auto isDevel = info.packageInfoV2Module == "develop";
+              if (!isAppLayer && this->repo.getLayerDir(ref, isDevel, subRef)) {
+                  qInfo() << "skip" << ref.toString() << subRef << ", it has been installed";
+                  continue;
+              }
+
+              importing.push_back({ ref, std::move(info), subRef, isAppLayer });
+              importingDirs.emplace_back(layerDir, subRef);
+          }
+
+          taskRef.updateStatus(InstallTask::installApplication,
+                               QString{ "importing %1 layers" }.arg(importingDirs.size()));
+          std::size_t imported = 0;
+          auto layerDirs = this->repo.importLayerDirs(
+            importingDirs,
+            [&taskRef, &importing, &imported, total = importingDirs.size()](std::size_t pos) {
+                ++imported;
+                taskRef.updateTask(static_cast<double>(imported),
+                                   static_cast<double>(total),
+                                   importing[pos].ref.toString() + " imported");
+            });
+          if (!layerDirs) {
+              taskRef.updateStatus(InstallTask::Failed, std::move(layerDirs).error());
+              return;
+          }
+
+          utils::Transaction transaction;
+          package::LayerDir appLayerDir;
+          for (std::size_t pos = 0; pos < importing.size(); ++pos) {
+              const auto &layer = importing[pos];
+              transaction.addRollBack([this, layer]() noexcept {
+                  auto ret = this->repo.remove(layer.ref,
+                                               layer.info.packageInfoV2Module == "develop",
+                                               layer.subRef);
+                  if (!ret) {
+                      qCritical() << "rollback importLayerDir failed:" << ret.error().message();
                   }
-                  taskRef.updateStatus(InstallTask::Failed, std::move(ret).error());
+              });
+
+              if (layer.isAppLayer) {
+                  appLayerDir = layerDirs->at(pos);
+              }
+          }
+
+          for (const auto &layer : importing) {
+              if (layer.subRef.isEmpty()) {
+                  continue;
+              }
+
+              const auto &ref = layer.ref;
+              QFile tagFile = appLayerDir.absoluteFilePath(QString{ ".minified-%1" }.arg(ref.id));
+              if (!tagFile.open(QIODevice::NewOnly | QIODevice::WriteOnly)) {
+                  taskRef.updateStatus(InstallTask::Failed, tagFile.errorString());
                   return;
               }
 
-              transaction.addRollBack(
-                [this, layerInfo = std::move(info), layerRef = ref, subRef]() noexcept {
-                    auto ret = this->repo.remove(layerRef,
-                                                 layerInfo.packageInfoV2Module == "develop",
-                                                 subRef);
-                    if (!ret) {
-                        qCritical() << "rollback importLayerDir failed:" << ret.error().message();
-                    }
-                });
-
-              if (isAppLayer) {
-                  appLayerDir = *ret;
+              auto completedLayer = this->repo.getLayerDir(ref);
+              if (!completedLayer) {
+                  taskRef.updateStatus(InstallTask::Failed, std::move(completedLayer).error());
+                  return;
               }
 
-              if (!subRef.isEmpty()) {
-                  QFile tagFile =
-                    appLayerDir.absoluteFilePath(QString{ ".minified-%1" }.arg(ref.id));
-                  if (!tagFile.open(QIODevice::NewOnly | QIODevice::WriteOnly)) {
-                      taskRef.updateStatus(InstallTask::Failed, tagFile.errorString());
-                      return;
-                  }
+              const auto &minifiedPath = completedLayer->absoluteFilePath("minified.json");
+              auto ret = this->updateMinifiedInfo(minifiedPath,
+                                                  appRef.toString(),
+                                                  QString::fromStdString(metaInfo.get().uuid));
+              if (!ret) {
+                  taskRef.updateStatus(InstallTask::Failed, std::move(ret).error());
+                  return;
+              }
 
-                  const auto &completedLayer = this->repo.getLayerDir(ref);
-                  if (!completedLayer) {
-                      taskRef.updateStatus(InstallTask::Failed, std::move(ret).error());
+              transaction.addRollBack([minifiedPath, originalInfo = *ret]() noexcept {
+                  QFile minifiedFile{ minifiedPath };
+                  if (!minifiedFile.open(QIODevice::WriteOnly | QIODevice::Truncate
+                                         | QIODevice::Text)) {
+                      qCritical() << minifiedFile.errorString();
                       return;
                   }
 
-                  const auto &minifiedPath = completedLayer->absoluteFilePath("minified.json");
-                  auto ret = this->updateMinifiedInfo(minifiedPath,
-                                                      appRef.toString(),
-                                                      QString::fromStdString(metaInfo.get().uuid));
-                  if (!ret) {
-                      taskRef.updateStatus(InstallTask::Failed, std::move(ret).error());
-                      return;
-                  }
+                  QTextStream ofs{ &minifiedFile };
+                  ofs << QString::fromStdString(nlohmann::json(originalInfo).dump());
+                  ofs.flush();
 
-                  transaction.addRollBack([minifiedPath, originalInfo = *ret]() noexcept {
-                      QFile minifiedFile{ minifiedPath };
-                      if (!minifiedFile.open(QIODevice::WriteOnly | QIODevice::Truncate
-                                             | QIODevice::Text)) {
-                          qCritical() << minifiedFile.errorString();
-                          return;
-                      }
-
-                      QTextStream ofs{ &minifiedFile };
-                      ofs << QString::fromStdString(nlohmann::json(originalInfo).dump());
-                      ofs.flush();
-
-                      if (ofs.status() == QTextStream::WriteFailed) {
-                          qCritical() << "couldn't rollback to the original minified.json";
-                      }
-                  });
-              }
+                  if (ofs.status() == QTextStream::WriteFailed) {
+                      qCritical() << "couldn't rollback to the original minified.json";
+                  }
+              });
           }
 
           transaction.commit();
+
+          writeImportedTag(appLayerDir);
+
           this->repo.exportReference(appRef);
 
           taskRef.updateStatus(InstallTask::Success, "install uab successfully");
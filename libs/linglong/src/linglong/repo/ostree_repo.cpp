@@ -25,12 +25,21 @@
 #include <ostree-repo.h>
 
 #include <QDir>
+#include <QDirIterator>
+#include <QEventLoop>
 #include <QProcess>
+#include <QThreadPool>
+#include <QtConcurrent>
 #include <QtWebSockets/QWebSocket>
 
+#include <algorithm>
+#include <condition_variable>
 #include <cstddef>
+#include <deque>
+#include <mutex>
 
 #include <fcntl.h>
+#include <sys/stat.h>
 
 namespace linglong::repo {
 
@@ -283,20 +292,16 @@ utils::error::Result<void> removeOstreeRef(OstreeRepo *repo, const char *ref) no
     return LINGLONG_OK;
 }
 
-utils::error::Result<QString> commitDirToRepo(GFile *dir,
-                                              OstreeRepo *repo,
-                                              const char *refspec) noexcept
+// 把目录写入ostree仓库并生成commit，需要在事务中调用。
+// 同一事务中的写入可以在多个线程中同时进行
+utils::error::Result<QString> writeDirToRepo(GFile *dir, OstreeRepo *repo) noexcept
 {
     Q_ASSERT(dir != nullptr);
     Q_ASSERT(repo != nullptr);
 
-    LINGLONG_TRACE("commit to ostree linglong repo");
+    LINGLONG_TRACE("write directory to ostree linglong repo");
 
     g_autoptr(GError) gErr = nullptr;
-    if (ostree_repo_prepare_transaction(repo, NULL, NULL, &gErr) == FALSE) {
-        return LINGLONG_ERR("ostree_repo_prepare_transaction", gErr);
-    }
-
     g_autoptr(OstreeMutableTree) mtree = ostree_mutable_tree_new();
     g_autoptr(OstreeRepoCommitModifier) modifier = nullptr;
     modifier =
@@ -329,18 +334,82 @@ utils::error::Result<QString> commitDirToRepo(GFile *dir,
         return LINGLONG_ERR("ostree_repo_write_commit", gErr);
     }
 
-    ostree_repo_transaction_set_ref(repo, NULL, refspec, commit);
+    return QString{ commit };
+}
 
-    if (ostree_repo_commit_transaction(repo, NULL, NULL, &gErr) == FALSE) {
-        return LINGLONG_ERR("ostree_repo_commit_transaction", gErr);
+// 在线程池中并发执行count个任务，调用线程阻塞等待所有任务结束。
+// 调用时通常有未完成的ostree事务，等待期间不能处理事件，否则其他请求会在事务中途重入仓库。
+// 每个任务成功结束后，按完成的顺序在调用线程中执行onFinished；
+// 一个任务失败不会打断其他任务，所有任务结束后返回第一个错误
+utils::error::Result<void>
+runConcurrently(std::size_t count,
+                const std::function<utils::error::Result<void>(std::size_t)> &task,
+                const std::function<void(std::size_t)> &onFinished) noexcept
+{
+    LINGLONG_TRACE("run tasks concurrently");
+
+    QThreadPool pool;
+    pool.setMaxThreadCount(std::clamp(QThread::idealThreadCount(),
+                                      1,
+                                      static_cast<int>(std::max<std::size_t>(count, 1))));
+
+    std::vector<utils::error::Result<void>> results(count);
+    std::mutex mutex;
+    std::condition_variable finished;
+    std::deque<std::size_t> done;
+    QList<QFuture<void>> futures;
+    for (std::size_t pos = 0; pos < count; ++pos) {
+        futures.append(QtConcurrent::run(&pool, [&, pos]() {
+            auto result = task(pos);
+            std::lock_guard<std::mutex> lock{ mutex };
+            results[pos] = std::move(result);
+            done.push_back(pos);
+            finished.notify_one();
+        }));
+    }
+
+    for (std::size_t reported = 0; reported < count; ++reported) {
+        std::size_t pos{ 0 };
+        {
+            std::unique_lock<std::mutex> lock{ mutex };
+            finished.wait(lock, [&done] {
+                return !done.empty();
+            });
+            pos = done.front();
+            done.pop_front();
+        }
+
+        if (results[pos] && onFinished) {
+            onFinished(pos);
+        }
+    }
+
+    for (auto &future : futures) {
+        future.waitForFinished();
+    }
+
+    for (std::size_t pos = 0; pos < count; ++pos) {
+        if (!results[pos]) {
+            return LINGLONG_ERR(results[pos]);
+        }
     }
 
-    return commit;
+    return LINGLONG_OK;
+}
+
+// bare-user-only仓库中的文件对象是按内容寻址的普通文件，以USER模式检出时ostree直接硬链接对象，
+// 内容相同的文件在所有layer之间共享同一个inode，不在同一个文件系统时会退回到复制
+OstreeRepoCheckoutAtOptions hardlinkCheckoutOptions() noexcept
+{
+    OstreeRepoCheckoutAtOptions options{};
+    options.mode = OSTREE_REPO_CHECKOUT_MODE_USER;
+    return options;
 }
 
 utils::error::Result<void> handleRepositoryUpdate(OstreeRepo *repo,
                                                   QDir layerDir,
-                                                  const char *refspec) noexcept
+                                                  const char *refspec,
+                                                  bool hardlink) noexcept
 {
     LINGLONG_TRACE(QString("checkout %1 from ostree repository to layers dir").arg(refspec));
 
@@ -349,6 +418,9 @@ utils::error::Result<void> handleRepositoryUpdate(OstreeRepo *repo,
         close(root);
     });
 
+    auto hardlinkOptions = hardlinkCheckoutOptions();
+    auto *checkoutOptions = hardlink ? &hardlinkOptions : nullptr;
+
     auto path = layerDir.absolutePath();
     path = path.right(path.length() - 1);
     const auto *minifiedJson = "minified.json";
@@ -382,7 +454,8 @@ utils::error::Result<void> handleRepositoryUpdate(OstreeRepo *repo,
                                currentName = minified.absoluteFilePath(),
                                originalName = layerDir.absoluteFilePath(minifiedJson),
                                &repo,
-                               root] {
+                               root,
+                               checkoutOptions] {
           if (!isMinified) {
               return;
           }
@@ -426,7 +499,7 @@ utils::error::Result<void> handleRepositoryUpdate(OstreeRepo *repo,
                                + QString::fromStdString(item.uuid))
                                 .toLocal8Bit();
               if (ostree_repo_checkout_at(repo,
-                                          nullptr,
+                                          checkoutOptions,
                                           root,
                                           destPath.constData(),
                                           commit,
@@ -446,7 +519,13 @@ utils::error::Result<void> handleRepositoryUpdate(OstreeRepo *repo,
         return LINGLONG_ERR("ostree_repo_resolve_rev", gErr);
     }
 
-    if (ostree_repo_checkout_at(repo, nullptr, root, path.toUtf8().constData(), commit, NULL, &gErr)
+    if (ostree_repo_checkout_at(repo,
+                                checkoutOptions,
+                                root,
+                                path.toUtf8().constData(),
+                                commit,
+                                NULL,
+                                &gErr)
         == FALSE) {
         return LINGLONG_ERR(QString("ostree_repo_checkout_at %1").arg(path), gErr);
     }
@@ -880,55 +959,142 @@ utils::error::Result<package::LayerDir> OSTreeRepo::importLayerDir(const package
 {
     LINGLONG_TRACE("import layer dir");
 
-    if (!dir.exists()) {
-        return LINGLONG_ERR(QString("layer directory %1 not exists").arg(dir.absolutePath()));
+    auto layerDirs = this->importLayerDirs({ { dir, subRef } });
+    if (!layerDirs) {
+        return LINGLONG_ERR(layerDirs);
     }
 
-    utils::Transaction transaction;
+    return layerDirs->front();
+}
+
+utils::error::Result<std::vector<package::LayerDir>> OSTreeRepo::importLayerDirs(
+  const std::vector<std::pair<package::LayerDir, QString>> &dirs,
+  const std::function<void(std::size_t)> &onImported) noexcept
+{
+    LINGLONG_TRACE("import layer dirs");
+
+    struct ImportingLayer
+    {
+        QByteArray refspec;
+        QDir layerDir;
+        QString commit;
+    };
 
-    g_autoptr(GFile) gFile = g_file_new_for_path(dir.absolutePath().toUtf8());
-    if (gFile == nullptr) {
-        qFatal("g_file_new_for_path");
+    std::vector<ImportingLayer> layers;
+    for (const auto &[dir, subRef] : dirs) {
+        if (!dir.exists()) {
+            return LINGLONG_ERR(QString("layer directory %1 not exists").arg(dir.absolutePath()));
+        }
+
+        auto info = dir.info();
+        if (!info) {
+            return LINGLONG_ERR(info);
+        }
+
+        auto reference = package::Reference::fromPackageInfo(*info);
+        if (!reference) {
+            return LINGLONG_ERR(reference);
+        }
+
+        const auto isDevel = info->packageInfoV2Module == "develop";
+
+        if (this->getLayerDir(*reference, isDevel, subRef)) {
+            return LINGLONG_ERR(reference->toString() + " exists.", 0);
+        }
+
+        layers.push_back({ ostreeSpecFromReferenceV2(*reference, isDevel, subRef).toLocal8Bit(),
+                           this->getLayerQDirV2(*reference, isDevel, subRef),
+                           {} });
     }
 
-    auto info = dir.info();
-    if (!info) {
-        return LINGLONG_ERR(info);
+    if (layers.empty()) {
+        return std::vector<package::LayerDir>{};
     }
 
-    auto reference = package::Reference::fromPackageInfo(*info);
-    if (!reference) {
-        return LINGLONG_ERR(reference);
+    // 所有layer在同一个事务中并发写入，最后一起更新ref
+    g_autoptr(GError) gErr = nullptr;
+    if (ostree_repo_prepare_transaction(this->ostreeRepo.get(), NULL, NULL, &gErr) == FALSE) {
+        return LINGLONG_ERR("ostree_repo_prepare_transaction", gErr);
     }
 
-    const auto isDevel = info->packageInfoV2Module == "develop";
+    auto written = runConcurrently(
+      layers.size(),
+      [this, &dirs, &layers](std::size_t pos) -> utils::error::Result<void> {
+          LINGLONG_TRACE("write " + dirs[pos].first.absolutePath());
+
+          g_autoptr(GFile) gFile = g_file_new_for_path(dirs[pos].first.absolutePath().toUtf8());
+          if (gFile == nullptr) {
+              qFatal("g_file_new_for_path");
+          }
 
-    if (this->getLayerDir(*reference, isDevel, subRef)) {
-        return LINGLONG_ERR(reference->toString() + " exists.", 0);
+          auto commit = writeDirToRepo(gFile, this->ostreeRepo.get());
+          if (!commit) {
+              return LINGLONG_ERR(commit);
+          }
+          layers[pos].commit = *commit;
+          return LINGLONG_OK;
+      },
+      nullptr);
+    if (!written) {
+        ostree_repo_abort_transaction(this->ostreeRepo.get(), nullptr, nullptr);
+        return LINGLONG_ERR(written);
     }
 
-    auto refspec = ostreeSpecFromReferenceV2(*reference, isDevel, subRef).toLocal8Bit();
-    auto commitID = commitDirToRepo(gFile, this->ostreeRepo.get(), refspec);
-    if (!commitID) {
-        return LINGLONG_ERR(commitID);
+    for (const auto &layer : layers) {
+        ostree_repo_transaction_set_ref(this->ostreeRepo.get(),
+                                        NULL,
+                                        layer.refspec.constData(),
+                                        layer.commit.toUtf8().constData());
     }
 
-    transaction.addRollBack([this, &refspec]() noexcept {
-        auto result = removeOstreeRef(this->ostreeRepo.get(), refspec);
-        if (!result) {
-            qCritical() << result.error();
-            Q_ASSERT(false);
-        }
-    });
+    if (ostree_repo_commit_transaction(this->ostreeRepo.get(), NULL, NULL, &gErr) == FALSE) {
+        ostree_repo_abort_transaction(this->ostreeRepo.get(), nullptr, nullptr);
+        return LINGLONG_ERR("ostree_repo_commit_transaction", gErr);
+    }
 
-    auto layerDir = this->getLayerQDirV2(*reference, isDevel, subRef);
-    auto result = handleRepositoryUpdate(this->ostreeRepo.get(), layerDir, refspec);
-    if (!result) {
-        return LINGLONG_ERR(result);
+    utils::Transaction transaction;
+    for (const auto &layer : layers) {
+        transaction.addRollBack([this, refspec = layer.refspec]() noexcept {
+            auto result = removeOstreeRef(this->ostreeRepo.get(), refspec);
+            if (!result) {
+                qCritical() << result.error();
+                Q_ASSERT(false);
+            }
+        });
+    }
+
+    // 检出失败时已经检出的layer目录也要删除，否则重新安装时会因为目录已存在而失败
+    for (const auto &layer : layers) {
+        transaction.addRollBack([layerDir = layer.layerDir]() noexcept {
+            auto dir = layerDir;
+            if (dir.exists() && !dir.removeRecursively()) {
+                qCritical() << "failed to remove" << layerDir.absolutePath();
+                Q_ASSERT(false);
+            }
+        });
+    }
+
+    auto checkedOut = runConcurrently(
+      layers.size(),
+      [this, &layers](std::size_t pos) -> utils::error::Result<void> {
+          return handleRepositoryUpdate(this->ostreeRepo.get(),
+                                        layers[pos].layerDir,
+                                        layers[pos].refspec,
+                                        this->cfg.hardlinkLayers.value_or(false));
+      },
+      onImported);
+    if (!checkedOut) {
+        return LINGLONG_ERR(checkedOut);
     }
 
     transaction.commit();
-    return package::LayerDir{ layerDir.absolutePath() };
+
+    std::vector<package::LayerDir> result;
+    result.reserve(layers.size());
+    for (const auto &layer : layers) {
+        result.emplace_back(layer.layerDir.absolutePath());
+    }
+    return result;
 }
 
 utils::error::Result<void> OSTreeRepo::push(const package::Reference &ref,
@@ -1234,6 +1400,112 @@ utils::error::Result<void> OSTreeRepo::prune()
     return LINGLONG_OK;
 }
 
+utils::error::Result<quint64> OSTreeRepo::deduplicateLayers(
+  const std::function<void(std::size_t, std::size_t)> &onDeduplicated) noexcept
+{
+    LINGLONG_TRACE("deduplicate layers");
+
+    g_autoptr(GHashTable) refs = nullptr;
+    g_autoptr(GError) gErr = nullptr;
+    if (ostree_repo_list_refs_ext(this->ostreeRepo.get(),
+                                  nullptr,
+                                  &refs,
+                                  OSTREE_REPO_LIST_REFS_EXT_EXCLUDE_REMOTES,
+                                  nullptr,
+                                  &gErr)
+        == FALSE) {
+        return LINGLONG_ERR("ostree_repo_list_refs_ext", gErr);
+    }
+
+    int root = open("/", O_DIRECTORY);
+    auto _ = utils::finally::finally([root]() {
+        close(root);
+    });
+
+    // 在已有的检出上合并检出同一个提交，ostree会把每个文件替换为对象的硬链接
+    auto options = hardlinkCheckoutOptions();
+    options.overwrite_mode = OSTREE_REPO_CHECKOUT_OVERWRITE_UNION_FILES;
+
+    QMap<QString, QByteArray> layerRefs;
+    GHashTableIter iter;
+    gpointer key = nullptr;
+    gpointer value = nullptr;
+    g_hash_table_iter_init(&iter, refs);
+    while (g_hash_table_iter_next(&iter, &key, &value) == TRUE) {
+        layerRefs.insert(static_cast<const char *>(key), static_cast<const char *>(value));
+    }
+
+    // 与pull保持一致：回退拉取的旧ref（模块为runtime）检出在binary目录中，
+    // 同时存在binary的ref时该目录属于binary的ref；更早的版本直接检出在runtime目录中
+    auto checkoutDirOf = [this, &layerRefs](const QString &refspec) -> QDir {
+        auto parts = refspec.split('/');
+        if (parts.size() == 5 && parts.last() == "runtime") {
+            parts.last() = "binary";
+            auto binaryRef = parts.join('/');
+            QDir binaryDir = this->repoDir.absoluteFilePath("layers/" + binaryRef);
+            if (!layerRefs.contains(binaryRef) && binaryDir.exists()) {
+                return binaryDir;
+            }
+        }
+        return this->repoDir.absoluteFilePath("layers/" + refspec);
+    };
+
+    quint64 saved = 0;
+    std::size_t processed = 0;
+    auto reportProgress = [&processed, &onDeduplicated, total = std::size_t(layerRefs.size())] {
+        ++processed;
+        if (onDeduplicated) {
+            onDeduplicated(processed, total);
+        }
+    };
+    for (auto ref = layerRefs.cbegin(); ref != layerRefs.cend(); ++ref) {
+        const auto &refspec = ref.key();
+        const auto *commit = ref.value().constData();
+        QDir layerDir = checkoutDirOf(refspec);
+        if (!layerDir.exists()) {
+            reportProgress();
+            continue;
+        }
+
+        // 只统计独占磁盘空间的文件，已经是硬链接的文件不会再节省空间
+        QHash<QString, quint64> unshared;
+        QDirIterator it(layerDir.absolutePath(),
+                        QDir::Files | QDir::Hidden | QDir::System | QDir::NoSymLinks,
+                        QDirIterator::Subdirectories);
+        while (it.hasNext()) {
+            auto path = it.next();
+            struct stat st{};
+            if (::lstat(path.toLocal8Bit().constData(), &st) == 0 && S_ISREG(st.st_mode)
+                && st.st_nlink == 1) {
+                unshared.insert(path, quint64(st.st_blocks) * 512);
+            }
+        }
+
+        auto path = layerDir.absolutePath().mid(1).toUtf8();
+        if (ostree_repo_checkout_at(this->ostreeRepo.get(),
+                                    &options,
+                                    root,
+                                    path.constData(),
+                                    commit,
+                                    nullptr,
+                                    &gErr)
+            == FALSE) {
+            return LINGLONG_ERR(QString("ostree_repo_checkout_at %1").arg(refspec), gErr);
+        }
+
+        for (auto file = unshared.cbegin(); file != unshared.cend(); ++file) {
+            struct stat st{};
+            if (::lstat(file.key().toLocal8Bit().constData(), &st) == 0 && st.st_nlink > 1) {
+                saved += file.value();
+            }
+        }
+
+        reportProgress();
+    }
+
+    return saved;
+}
+
 void OSTreeRepo::pull(service::InstallTask &taskContext,
                       const package::Reference &reference,
                       bool develop) noexcept
@@ -1292,7 +1564,8 @@ void OSTreeRepo::pull(service::InstallTask &taskContext,
 
     auto result = handleRepositoryUpdate(this->ostreeRepo.get(),
                                          this->getLayerQDirV2(reference, develop),
-                                         refString);
+                                         refString,
+                                         this->cfg.hardlinkLayers.value_or(false));
     if (!result) {
         taskContext.updateStatus(service::InstallTask::Failed, LINGLONG_ERRV(result));
         return;
@@ -1705,6 +1978,27 @@ auto OSTreeRepo::getLayerDir(const package::Reference &ref, bool develop, const
     return dir.absolutePath();
 }
 
+auto OSTreeRepo::getCommit(const package::Reference &ref,
+                           bool develop,
+                           const QString &subRef) const noexcept -> utils::error::Result<QString>
+{
+    LINGLONG_TRACE("get commit of " + ref.toString());
+
+    auto refspec = ostreeSpecFromReferenceV2(ref, develop, subRef);
+    g_autoptr(GError) gErr = nullptr;
+    g_autofree char *commit = nullptr;
+    if (ostree_repo_resolve_rev(this->ostreeRepo.get(),
+                                refspec.toUtf8().constData(),
+                                FALSE,
+                                &commit,
+                                &gErr)
+        == FALSE) {
+        return LINGLONG_ERR("ostree_repo_resolve_rev", gErr);
+    }
+
+    return QString::fromUtf8(commit);
+}
+
 OSTreeRepo::~OSTreeRepo() = default;
 
 } // namespace linglong::repo
@@ -24,6 +24,9 @@
 #include <QScopedPointer>
 #include <QThread>
 
+#include <functional>
+#include <vector>
+
 namespace linglong::repo {
 
 struct clearReferenceOption
@@ -51,11 +54,21 @@ public:
 
     utils::error::Result<package::LayerDir> importLayerDir(const package::LayerDir &dir,
                                                            const QString &subRef = "") noexcept;
+    // 并发导入多个layer目录，每个layer检出完成后立即在调用线程中执行onImported；
+    // 任意layer失败时删除本次导入的ref和已检出的layer目录
+    utils::error::Result<std::vector<package::LayerDir>>
+    importLayerDirs(const std::vector<std::pair<package::LayerDir, QString>> &dirs,
+                    const std::function<void(std::size_t)> &onImported = nullptr) noexcept;
 
     utils::error::Result<package::LayerDir> getLayerDir(const package::Reference &ref,
                                                         bool develop = false,
                                                         const QString &subRef = "") const noexcept;
 
+    // 返回layer在ostree仓库中对应的提交
+    utils::error::Result<QString> getCommit(const package::Reference &ref,
+                                            bool develop = false,
+                                            const QString &subRef = "") const noexcept;
+
     utils::error::Result<void> push(const package::Reference &reference,
                                     bool develop = false) const noexcept;
 
@@ -74,6 +87,10 @@ public:
                                       bool develop = false,
                                       const QString &subRef = "") noexcept;
     utils::error::Result<void> prune();
+    // 将已安装layer中的文件替换为仓库对象的硬链接，返回节省的磁盘空间（字节），
+    // 每处理完一个ref执行一次onDeduplicated(已处理数量, 总数)
+    utils::error::Result<quint64> deduplicateLayers(
+      const std::function<void(std::size_t, std::size_t)> &onDeduplicated = nullptr) noexcept;
 
     void removeDanglingXDGIntergation() noexcept;
     void exportReference(const package::Reference &ref) noexcept;
@@ -16,11 +16,18 @@
 
 #include <qglobal.h>
 #include <qstandardpaths.h>
-#include <qtemporarydir.h>
+
+#include <QCryptographicHash>
+#include <QProcessEnvironment>
+#include <QRegularExpression>
+#include <QSaveFile>
 
 #include <fstream>
 #include <unordered_set>
 
+#include <sys/stat.h>
+#include <unistd.h>
+
 namespace linglong::runtime {
 
 namespace {
@@ -188,13 +195,10 @@ void applyPatches(ocppi::runtime::config::types::Config &cfg,
     }
 }
 
-auto getOCIConfig(const ContainerOptions &opts) noexcept
-  -> utils::error::Result<ocppi::runtime::config::types::Config>
+auto getContainerConfigFilePath() noexcept -> utils::error::Result<QString>
 {
-    LINGLONG_TRACE("get origin OCI configuration file");
+    LINGLONG_TRACE("get OCI configuration file path");
 
-    QTemporaryDir dir;
-    dir.setAutoRemove(false);
     QString containerConfigFilePath = qgetenv("LINGLONG_CONTAINER_CONFIG");
     if (containerConfigFilePath.isEmpty()) {
         containerConfigFilePath = LINGLONG_INSTALL_PREFIX "/lib/linglong/container/config.json";
@@ -206,6 +210,14 @@ auto getOCIConfig(const ContainerOptions &opts) noexcept
         }
     }
 
+    return containerConfigFilePath;
+}
+
+auto getOCIConfig(const QString &containerConfigFilePath, const ContainerOptions &opts) noexcept
+  -> utils::error::Result<ocppi::runtime::config::types::Config>
+{
+    LINGLONG_TRACE("get origin OCI configuration file");
+
     auto config = utils::serialize::LoadJSONFile<ocppi::runtime::config::types::Config>(
       containerConfigFilePath);
     if (!config) {
@@ -383,8 +395,293 @@ auto fixMount(ocppi::runtime::config::types::Config config) noexcept
     return config;
 };
 
+auto getConfigCacheFile(const QString &appID) noexcept -> QString
+{
+    QDir cacheDir = QStandardPaths::writableLocation(QStandardPaths::GenericCacheLocation);
+    return cacheDir.absoluteFilePath(QString("linglong/container-config/%1.json").arg(appID));
+}
+
+auto loadCachedConfig(const QString &appID, const QByteArray &key) noexcept
+  -> utils::error::Result<ocppi::runtime::config::types::Config>
+{
+    LINGLONG_TRACE("load cached OCI configuration of " + appID);
+
+    QFile file{ getConfigCacheFile(appID) };
+    if (!file.exists()) {
+        return LINGLONG_ERR("cache miss");
+    }
+
+    if (!file.open(QFile::ReadOnly)) {
+        return LINGLONG_ERR("open", file);
+    }
+
+    ocppi::runtime::config::types::Config config;
+    try {
+        auto content = nlohmann::json::parse(file.readAll().toStdString());
+        if (content.at("key").get<std::string>() != key.toStdString()) {
+            return LINGLONG_ERR("cache miss");
+        }
+        config = content.at("config").get<ocppi::runtime::config::types::Config>();
+    } catch (const std::exception &e) {
+        return LINGLONG_ERR("parse", e);
+    }
+
+    auto ret = checkCachedConfig(config);
+    if (!ret) {
+        return LINGLONG_ERR(ret);
+    }
+
+    return config;
+}
+
+void saveCachedConfig(const QString &appID,
+                      const QByteArray &key,
+                      const ocppi::runtime::config::types::Config &config) noexcept
+{
+    auto path = getConfigCacheFile(appID);
+    if (!QFileInfo(path).dir().mkpath(".")) {
+        qWarning() << "failed to create directory for" << path;
+        return;
+    }
+
+    QSaveFile file{ path };
+    if (!file.open(QFile::WriteOnly)) {
+        qWarning() << "failed to open" << path << file.errorString();
+        return;
+    }
+
+    nlohmann::json content{
+        { "key", key.toStdString() },
+        { "config", config },
+    };
+    file.write(QByteArray::fromStdString(content.dump()));
+    if (!file.commit()) {
+        qWarning() << "failed to save" << path << file.errorString();
+    }
+}
+
+auto writeEnvShFile(const std::string &envShFile, const std::vector<std::string> &envs) noexcept
+  -> utils::error::Result<void>
+{
+    LINGLONG_TRACE("write " + QString::fromStdString(envShFile));
+
+    std::ofstream ofs(envShFile);
+    Q_ASSERT(ofs.is_open());
+    if (!ofs.is_open()) {
+        return LINGLONG_ERR("create 00env.sh failed in bundle directory");
+    }
+
+    for (const auto &env : envs) {
+        const QString envStr = QString::fromStdString(env);
+        auto pos = envStr.indexOf("=");
+        auto value = envStr.mid(pos + 1, envStr.length());
+        // here we process environment variables with single quotes.
+        // A=a'b ===> A='a'\''b'
+        value.replace("'", R"('\'')");
+
+        // We need to quote the values environment variables
+        // avoid loading errors when some environment variables have multiple values, such as
+        // (a;b).
+        const auto fixEnv = QString(R"(%1='%2')").arg(envStr.mid(0, pos)).arg(value);
+        ofs << "export " << fixEnv.toStdString() << std::endl;
+    }
+    ofs.close();
+
+    return LINGLONG_OK;
+}
+
 } // namespace
 
+// NOTE: The resolved configuration only depends on the layers, the configuration files and
+// generators under config.d, the application configuration and the state of the host. Everything
+// below is folded into the cache key, if any of them changed the configuration is regenerated.
+auto getConfigCacheKey(const QString &containerConfigFilePath,
+                       const ContainerOptions &opts) noexcept -> QByteArray
+{
+    QCryptographicHash hash{ QCryptographicHash::Sha256 };
+
+    auto addStat = [&hash](const QString &path) {
+        struct stat64 buf
+        {
+        };
+
+        hash.addData(path.toUtf8());
+        if (::stat64(path.toUtf8().constData(), &buf) != 0) {
+            hash.addData("-");
+            return;
+        }
+
+        hash.addData(QByteArray::number(static_cast<qulonglong>(buf.st_ino)));
+        hash.addData(QByteArray::number(static_cast<qulonglong>(buf.st_mode)));
+        hash.addData(QByteArray::number(static_cast<qlonglong>(buf.st_size)));
+        hash.addData(QByteArray::number(static_cast<qlonglong>(buf.st_mtim.tv_sec)));
+        hash.addData(QByteArray::number(static_cast<qlonglong>(buf.st_mtim.tv_nsec)));
+    };
+
+    auto addContent = [&hash](const QString &path) {
+        hash.addData(path.toUtf8());
+        QFile file{ path };
+        if (!file.open(QFile::ReadOnly)) {
+            hash.addData("-");
+            return;
+        }
+        hash.addData(&file);
+    };
+
+    // NOTE: ostree checkout files have a fixed mtime, but every checkout creates new directories.
+    // So the inode and mtime of the layer directory identify the commit which was checked out.
+    auto addLayer = [&addStat, &addContent](const QDir &dir) {
+        addStat(dir.absolutePath());
+        addStat(dir.absoluteFilePath("files"));
+        addContent(dir.absoluteFilePath("info.json"));
+    };
+
+    hash.addData(opts.appID.toUtf8());
+    addLayer(opts.baseDir);
+    if (opts.runtimeDir) {
+        addLayer(*opts.runtimeDir);
+    }
+    if (opts.appDir) {
+        addLayer(*opts.appDir);
+    }
+
+    addContent(containerConfigFilePath);
+    QDir configDotDDir = QFileInfo(containerConfigFilePath).dir().filePath("config.d");
+    for (const auto &info : configDotDDir.entryInfoList(QDir::Files, QDir::Name)) {
+        addContent(info.absoluteFilePath());
+    }
+
+    auto appConfig = QStandardPaths::locate(QStandardPaths::ConfigLocation,
+                                            "linglong/" + opts.appID + "/config.yaml");
+    if (!appConfig.isEmpty()) {
+        addContent(appConfig);
+    }
+
+    hash.addData(QByteArray::fromStdString(nlohmann::json(opts.patches).dump()));
+    hash.addData(QByteArray::fromStdString(nlohmann::json(opts.mounts).dump()));
+    hash.addData(QByteArray::fromStdString(nlohmann::json(opts.masks).dump()));
+
+    // host fingerprint
+    hash.addData(QByteArray::number(::getuid()));
+    hash.addData(QByteArray::number(::getgid()));
+
+    auto env = QProcessEnvironment::systemEnvironment();
+    hash.addData(configCacheEnvironment(env).join('\n').toUtf8());
+
+    // NOTE: Every path probed by the generators under config.d must be listed here, otherwise
+    // the cached configuration will miss a bind mount which appeared after it was generated.
+    // Directories created by the generators themselves (e.g. ~/.linglong/<appID>) are checked
+    // by checkCachedConfig instead, including them would make the next launch always miss.
+    auto home = env.value("HOME");
+    auto runtimeDir = env.value("XDG_RUNTIME_DIR");
+    auto dataHome = env.value("XDG_DATA_HOME", home + "/.local/share");
+    auto cacheHome = env.value("XDG_CACHE_HOME", home + "/.cache");
+    auto sessionBus = env.value("DBUS_SESSION_BUS_ADDRESS");
+    sessionBus.remove(QRegularExpression("^unix:path="));
+    for (const auto &path : QStringList{
+           // 20-devices
+           "/dev",
+           "/dev/dri",
+           "/dev/snd",
+           "/run/udev",
+           // 30-user-home
+           home,
+           dataHome,
+           cacheHome + "/deepin/dde-api",
+           home + "/.config/user-dirs.dirs",
+           home + "/.config/user-dirs.locale",
+           "/etc/skel/.bashrc",
+           // 40-host-ipc
+           "/tmp/.X11-unix",
+           "/run/dbus/system_bus_socket",
+           "/var/run/dbus/system_bus_socket",
+           env.value("DBUS_SYSTEM_BUS_ADDRESS"),
+           sessionBus,
+           home + "/.Xauthority",
+           env.value("XAUTHORITY"),
+           runtimeDir,
+           runtimeDir + "/" + env.value("WAYLAND_DISPLAY"),
+           runtimeDir + "/bus",
+           runtimeDir + "/pulse",
+           runtimeDir + "/gvfs",
+           runtimeDir + "/dconf",
+           // 90-legacy
+           "/etc/resolv.conf",
+           "/etc/resolvconf",
+           "/etc/localtime",
+           "/etc/machine-id",
+           "/etc/ssl/certs",
+           "/var/cache/fontconfig",
+           "/usr/share/fonts",
+           "/usr/lib/locale",
+           "/usr/share/themes",
+           "/usr/share/icons",
+           "/usr/share/zoneinfo",
+         }) {
+        addStat(path);
+    }
+
+    return hash.result().toHex();
+}
+
+// NOTE: Generators under config.d may read any variable of the environment, so only the variables
+// which change on every launch without affecting the generated configuration are dropped here.
+auto configCacheEnvironment(const QProcessEnvironment &env) noexcept -> QStringList
+{
+    static const QStringList volatileKeys{
+        "_",
+        "OLDPWD",
+        "PWD",
+        "SHLVL",
+        // set by systemd and desktop launchers for every started process
+        "DESKTOP_STARTUP_ID",
+        "GIO_LAUNCHED_DESKTOP_FILE_PID",
+        "INVOCATION_ID",
+        "JOURNAL_STREAM",
+        "SYSTEMD_EXEC_PID",
+        "XDG_ACTIVATION_TOKEN",
+    };
+
+    QStringList result;
+    for (const auto &key : env.keys()) {
+        if (volatileKeys.contains(key)) {
+            continue;
+        }
+        result.append(key + "=" + env.value(key));
+    }
+    result.sort();
+    return result;
+}
+
+// NOTE: Generators have no side effects besides creating the directories which are bind mounted
+// into the container, such as ~/.linglong/<appID>. Those directories are exactly the absolute bind
+// sources of the generated configuration, so if all of them still exist, skipping the generators
+// leaves the host in the same state as running them again. If one of them was removed, the cached
+// configuration is rejected and the generators recreate it.
+auto checkCachedConfig(const ocppi::runtime::config::types::Config &config) noexcept
+  -> utils::error::Result<void>
+{
+    LINGLONG_TRACE("check cached OCI configuration");
+
+    if (!config.mounts || !config.process || !config.process->env) {
+        return LINGLONG_ERR("invalid cached configuration");
+    }
+
+    for (const auto &mount : *config.mounts) {
+        if (mount.type.value_or("") != "bind" || !mount.source || mount.source->empty()
+            || mount.source->at(0) != '/') {
+            continue;
+        }
+
+        auto source = QString::fromStdString(*mount.source);
+        if (!QFileInfo::exists(source)) {
+            return LINGLONG_ERR(QString("bind source %1 disappeared").arg(source));
+        }
+    }
+
+    return LINGLONG_OK;
+}
+
 ContainerBuilder::ContainerBuilder(ocppi::cli::CLI &cli)
     : cli(cli)
 {
@@ -395,9 +692,9 @@ auto ContainerBuilder::create(const ContainerOptions &opts) noexcept
 {
     LINGLONG_TRACE("create container");
 
-    auto originalConfig = getOCIConfig(opts);
-    if (!originalConfig) {
-        return LINGLONG_ERR(originalConfig);
+    auto containerConfigFilePath = getContainerConfigFilePath();
+    if (!containerConfigFilePath) {
+        return LINGLONG_ERR(containerConfigFilePath);
     }
 
     QDir runtimeDir = QStandardPaths::writableLocation(QStandardPaths::RuntimeLocation);
@@ -408,43 +705,50 @@ auto ContainerBuilder::create(const ContainerOptions &opts) noexcept
     }
 
     // save env to /run/user/1000/linglong/xxx/00env.sh, mount it to /etc/profile.d/00env.sh
+    const auto *envShDestination = "/etc/profile.d/00env.sh";
     std::string envShFile = bundle.absoluteFilePath("00env.sh").toStdString();
-    {
-        std::ofstream ofs(envShFile);
-        Q_ASSERT(ofs.is_open());
-        if (!ofs.is_open()) {
-            return LINGLONG_ERR("create 00env.sh failed in bundle directory");
+
+    auto cacheKey = getConfigCacheKey(*containerConfigFilePath, opts);
+    auto config = loadCachedConfig(opts.appID, cacheKey);
+    if (config) {
+        for (auto &mount : *config->mounts) {
+            if (mount.destination == envShDestination) {
+                mount.source = envShFile;
+            }
         }
 
-        for (const auto &env : originalConfig->process->env.value()) {
-            const QString envStr = QString::fromStdString(env);
-            auto pos = envStr.indexOf("=");
-            auto value = envStr.mid(pos + 1, envStr.length());
-            // here we process environment variables with single quotes.
-            // A=a'b ===> A='a'\''b'
-            value.replace("'", R"('\'')");
-
-            // We need to quote the values environment variables
-            // avoid loading errors when some environment variables have multiple values, such as
-            // (a;b).
-            const auto fixEnv = QString(R"(%1='%2')").arg(envStr.mid(0, pos)).arg(value);
-            ofs << "export " << fixEnv.toStdString() << std::endl;
+        auto ret = writeEnvShFile(envShFile, config->process->env.value());
+        if (!ret) {
+            return LINGLONG_ERR(ret);
         }
-        ofs.close();
+        return QSharedPointer<Container>::create(*config, opts.appID, opts.containerID, this->cli);
+    }
+    qDebug() << config.error();
+
+    auto originalConfig = getOCIConfig(*containerConfigFilePath, opts);
+    if (!originalConfig) {
+        return LINGLONG_ERR(originalConfig);
+    }
+
+    auto ret = writeEnvShFile(envShFile, originalConfig->process->env.value());
+    if (!ret) {
+        return LINGLONG_ERR(ret);
     }
 
     originalConfig->mounts->push_back(ocppi::runtime::config::types::Mount{
-      .destination = "/etc/profile.d/00env.sh",
+      .destination = envShDestination,
       .options = { { "ro", "rbind" } },
       .source = envShFile,
       .type = "bind",
     });
 
-    auto config = fixMount(*originalConfig);
+    config = fixMount(*originalConfig);
     if (!config) {
         return LINGLONG_ERR(config);
     }
 
+    saveCachedConfig(opts.appID, cacheKey, *config);
+
     return QSharedPointer<Container>::create(*config, opts.appID, opts.containerID, this->cli);
 }
 
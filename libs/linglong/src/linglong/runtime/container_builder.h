@@ -11,10 +11,12 @@
 #include "linglong/runtime/container.h"
 #include "linglong/utils/error/error.h"
 #include "ocppi/cli/CLI.hpp"
+#include "ocppi/runtime/config/types/Config.hpp"
 #include "ocppi/runtime/config/types/Mount.hpp"
 
 #include <QDir>
 #include <QProcess>
+#include <QProcessEnvironment>
 
 namespace linglong::runtime {
 
@@ -32,6 +34,17 @@ struct ContainerOptions
     std::vector<std::string> masks;
 };
 
+// 计算OCI配置缓存键时使用的环境变量，去掉了每次启动都会变化的变量
+auto configCacheEnvironment(const QProcessEnvironment &env) noexcept -> QStringList;
+
+// 计算OCI配置缓存键，包含层、config.d中的配置与生成器、应用配置以及生成器会探测的宿主机路径
+auto getConfigCacheKey(const QString &containerConfigFilePath,
+                       const ContainerOptions &opts) noexcept -> QByteArray;
+
+// 检查缓存的OCI配置是否仍然可用，所有绑定挂载的源路径都必须存在
+auto checkCachedConfig(const ocppi::runtime::config::types::Config &config) noexcept
+  -> utils::error::Result<void>;
+
 class ContainerBuilder : public QObject
 {
     Q_OBJECT
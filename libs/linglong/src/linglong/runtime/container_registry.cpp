@@ -0,0 +1,98 @@
+/*
+ * SPDX-FileCopyrightText: 2024 UnionTech Software Technology Co., Ltd.
+ *
+ * SPDX-License-Identifier: LGPL-3.0-or-later
+ */
+
+#include "linglong/runtime/container_registry.h"
+
+#include "linglong/utils/serialize/json.h"
+#include "ocppi/types/Generators.hpp"
+
+#include <cerrno>
+#include <csignal>
+#include <utility>
+
+#include <unistd.h>
+
+namespace linglong::runtime {
+
+ContainerRegistry::ContainerRegistry(QDir dir, QObject *parent)
+    : QObject(parent)
+    , dir(std::move(dir))
+{
+}
+
+QDir ContainerRegistry::defaultDir() noexcept
+{
+    // NOTE: keep in sync with ll-box, see apps/ll-box/src/container/helper.cpp
+    return QString("/run/user/%1/linglong/box").arg(::getuid());
+}
+
+utils::error::Result<std::vector<ocppi::types::ContainerListItem>>
+ContainerRegistry::listDir(const QDir &dir) const noexcept
+{
+    LINGLONG_TRACE("list containers in " + dir.absolutePath());
+
+    std::vector<ocppi::types::ContainerListItem> containers;
+    if (!dir.exists()) {
+        return containers;
+    }
+
+    // NOTE: QDir::Files follows the symlinks in by-app and skips dangling ones. Hidden temporary
+    // files written by ll-box are skipped as QDir::Hidden isn't set.
+    for (const auto &info : dir.entryInfoList({ "*.json" }, QDir::Files)) {
+        auto item = utils::serialize::LoadJSONFile<ocppi::types::ContainerListItem>(
+          info.absoluteFilePath());
+        if (!item) {
+            // the container may exit while we are reading
+            qDebug() << item.error();
+            continue;
+        }
+
+        // ll-box removes the file of dead containers on its next run, ignore them here.
+        if (item->pid <= 0 || (::kill(static_cast<pid_t>(item->pid), 0) != 0 && errno == ESRCH)) {
+            continue;
+        }
+
+        containers.push_back(std::move(*item));
+    }
+
+    return containers;
+}
+
+utils::error::Result<std::vector<ocppi::types::ContainerListItem>>
+ContainerRegistry::list() const noexcept
+{
+    return this->listDir(this->dir);
+}
+
+utils::error::Result<std::vector<ocppi::types::ContainerListItem>>
+ContainerRegistry::listByApp(const QString &appID) const noexcept
+{
+    return this->listDir(this->dir.absoluteFilePath("by-app/" + appID));
+}
+
+utils::error::Result<void> ContainerRegistry::watch() noexcept
+{
+    LINGLONG_TRACE("watch container registry " + this->dir.absolutePath());
+
+    if (!this->dir.mkpath(".")) {
+        return LINGLONG_ERR("failed to create " + this->dir.absolutePath());
+    }
+
+    if (!this->watcher.directories().contains(this->dir.absolutePath())
+        && !this->watcher.addPath(this->dir.absolutePath())) {
+        return LINGLONG_ERR("failed to watch " + this->dir.absolutePath());
+    }
+
+    QObject::connect(&this->watcher,
+                     &QFileSystemWatcher::directoryChanged,
+                     this,
+                     &ContainerRegistry::changed,
+                     Qt::UniqueConnection);
+
+    return LINGLONG_OK;
+}
+
+} // namespace linglong::runtime
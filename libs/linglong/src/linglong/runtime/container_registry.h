@@ -0,0 +1,53 @@
+/*
+ * SPDX-FileCopyrightText: 2024 UnionTech Software Technology Co., Ltd.
+ *
+ * SPDX-License-Identifier: LGPL-3.0-or-later
+ */
+
+#ifndef LINGLONG_RUNTIME_CONTAINER_REGISTRY_H_
+#define LINGLONG_RUNTIME_CONTAINER_REGISTRY_H_
+
+#include "linglong/utils/error/error.h"
+#include "ocppi/types/ContainerListItem.hpp"
+
+#include <QDir>
+#include <QFileSystemWatcher>
+#include <QObject>
+
+namespace linglong::runtime {
+
+// ContainerRegistry reads the per-user container registry maintained by ll-box, which lives in
+// /run/user/<uid>/linglong/box. Every running container has an <id>.json file there, and
+// by-app/<appID>/<id>.json links to it, so looking up the containers of an application
+// doesn't need to spawn the OCI runtime or read every other container.
+class ContainerRegistry : public QObject
+{
+    Q_OBJECT
+public:
+    explicit ContainerRegistry(QDir dir = defaultDir(), QObject *parent = nullptr);
+
+    static QDir defaultDir() noexcept;
+
+    [[nodiscard]] utils::error::Result<std::vector<ocppi::types::ContainerListItem>>
+    list() const noexcept;
+    [[nodiscard]] utils::error::Result<std::vector<ocppi::types::ContainerListItem>>
+    listByApp(const QString &appID) const noexcept;
+
+    // watch starts watching the registry with inotify, changed is emitted after a container was
+    // created or has exited.
+    utils::error::Result<void> watch() noexcept;
+
+Q_SIGNALS:
+    void changed();
+
+private:
+    [[nodiscard]] utils::error::Result<std::vector<ocppi::types::ContainerListItem>>
+    listDir(const QDir &dir) const noexcept;
+
+    QDir dir;
+    QFileSystemWatcher watcher;
+};
+
+} // namespace linglong::runtime
+
+#endif
@@ -0,0 +1,42 @@
+/*
+ * SPDX-FileCopyrightText: 2024 UnionTech Software Technology Co., Ltd.
+ *
+ * SPDX-License-Identifier: LGPL-3.0-or-later
+ */
+
+#include <gtest/gtest.h>
+
+#include "linglong/package/layer_file.h"
+#include "linglong/package/layer_test_helper.h"
+
+#include <QElapsedTimer>
+#include <QTemporaryDir>
+
+using namespace linglong::package;
+
+TEST(LayerFileBenchmark, MetaInfoExtraction)
+{
+    constexpr auto layerCount = 2000;
+
+    QTemporaryDir tmp;
+    ASSERT_TRUE(tmp.isValid());
+    for (int i = 0; i < layerCount; ++i) {
+        test::createLayerFile(tmp.filePath(QString("%1.layer").arg(i)),
+                              QString("org.deepin.test%1").arg(i).toStdString());
+        if (HasFatalFailure()) {
+            return;
+        }
+    }
+
+    QElapsedTimer timer;
+    timer.start();
+    for (int i = 0; i < layerCount; ++i) {
+        auto layer = LayerFile::New(tmp.filePath(QString("%1.layer").arg(i)));
+        ASSERT_TRUE(layer.has_value());
+        auto info = (*layer)->metaInfo();
+        ASSERT_TRUE(info.has_value());
+        ASSERT_EQ(info->info.at("id").get<std::string>(),
+                  QString("org.deepin.test%1").arg(i).toStdString());
+    }
+    RecordProperty("usPerLayer", int(timer.nsecsElapsed() / layerCount / 1000));
+}
@@ -0,0 +1,45 @@
+/*
+ * SPDX-FileCopyrightText: 2024 UnionTech Software Technology Co., Ltd.
+ *
+ * SPDX-License-Identifier: LGPL-3.0-or-later
+ */
+
+#include <gtest/gtest.h>
+
+#include "linglong/package/uab_file.h"
+#include "linglong/package/uab_test_helper.h"
+
+#include <QElapsedTimer>
+#include <QTemporaryDir>
+
+using namespace linglong::package;
+
+TEST(UABFileBenchmark, MetaLookupWithManySections)
+{
+    constexpr auto rounds = 200;
+
+    if (!test::hasUABHeader()) {
+        GTEST_SKIP() << "no executable to use as uab header";
+    }
+
+    QTemporaryDir tmp;
+    ASSERT_TRUE(tmp.isValid());
+    const auto uabPath = tmp.filePath("test.uab");
+    linglong::api::types::v1::UabMetaInfo meta;
+    test::createUAB(tmp, uabPath, QByteArray("erofs bundle").repeated(4096), 512, meta);
+    if (HasFatalFailure()) {
+        return;
+    }
+
+    QElapsedTimer timer;
+    timer.start();
+    for (int i = 0; i < rounds; ++i) {
+        auto uab = UABFile::loadFromFile(uabPath);
+        ASSERT_TRUE(uab.has_value());
+        auto metaInfo = (*uab)->getMetaInfo();
+        ASSERT_TRUE(metaInfo.has_value());
+        ASSERT_EQ(metaInfo->get().uuid, meta.uuid);
+    }
+    // 结果记录在gtest的输出中，使用--gtest_output=json:<file>可以收集
+    RecordProperty("usPerLookup", int(timer.nsecsElapsed() / rounds / 1000));
+}
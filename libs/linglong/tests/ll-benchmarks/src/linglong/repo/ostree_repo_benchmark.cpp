@@ -0,0 +1,79 @@
+/*
+ * SPDX-FileCopyrightText: 2024 UnionTech Software Technology Co., Ltd.
+ *
+ * SPDX-License-Identifier: LGPL-3.0-or-later
+ */
+
+#include <gtest/gtest.h>
+
+#include "linglong/package/layer_dir.h"
+#include "linglong/repo/client_factory.h"
+#include "linglong/repo/ostree_repo.h"
+#include "linglong/repo/repo_test_helper.h"
+
+#include <QElapsedTimer>
+#include <QTemporaryDir>
+
+using namespace linglong;
+
+namespace {
+
+// 接近一个精简base中的文件数量
+constexpr auto baseFiles = 5000;
+constexpr auto appFiles = 200;
+
+auto openRepo(const QString &path, repo::ClientFactory &clientFactory)
+  -> std::unique_ptr<repo::OSTreeRepo>
+{
+    api::types::v1::RepoConfig cfg;
+    cfg.defaultRepo = "stable";
+    cfg.repos = { { "stable", "https://localhost" } };
+    cfg.version = 1;
+    cfg.hardlinkLayers = true;
+    return std::make_unique<repo::OSTreeRepo>(QDir(path), cfg, clientFactory);
+}
+
+} // namespace
+
+// 安装UAB时已经安装的依赖会被跳过，对比base未安装与已安装两种情况的导入耗时
+TEST(OSTreeRepoBenchmark, ImportUABWithInstalledBase)
+{
+    QTemporaryDir tmp;
+    ASSERT_TRUE(tmp.isValid());
+    repo::test::createLayer(tmp.filePath("input/base"),
+                            "org.deepin.base",
+                            "base",
+                            "23.1.0.0",
+                            baseFiles);
+    repo::test::createLayer(tmp.filePath("input/app"),
+                            "org.deepin.demo",
+                            "app",
+                            "1.0.0.0",
+                            appFiles);
+    if (HasFatalFailure()) {
+        return;
+    }
+
+    const package::LayerDir base{ tmp.filePath("input/base") };
+    const package::LayerDir app{ tmp.filePath("input/app") };
+    repo::ClientFactory clientFactory{ QString("https://localhost") };
+
+    auto fresh = openRepo(tmp.filePath("fresh"), clientFactory);
+    QElapsedTimer timer;
+    timer.start();
+    auto imported = fresh->importLayerDirs({ { base, {} }, { app, {} } });
+    const auto freshMs = timer.elapsed();
+    ASSERT_TRUE(imported.has_value()) << imported.error().message().toStdString();
+
+    auto installed = openRepo(tmp.filePath("installed"), clientFactory);
+    imported = installed->importLayerDirs({ { base, {} } });
+    ASSERT_TRUE(imported.has_value()) << imported.error().message().toStdString();
+    timer.restart();
+    imported = installed->importLayerDirs({ { app, {} } });
+    const auto installedMs = timer.elapsed();
+    ASSERT_TRUE(imported.has_value()) << imported.error().message().toStdString();
+
+    RecordProperty("msWithoutBase", int(freshMs));
+    RecordProperty("msWithInstalledBase", int(installedMs));
+    EXPECT_LT(installedMs, freshMs);
+}
@@ -0,0 +1,108 @@
+/*
+ * SPDX-FileCopyrightText: 2024 UnionTech Software Technology Co., Ltd.
+ *
+ * SPDX-License-Identifier: LGPL-3.0-or-later
+ */
+
+#include <gtest/gtest.h>
+
+#include "linglong/runtime/container_builder.h"
+#include "ocppi/cli/crun/Crun.hpp"
+
+#include <QDir>
+#include <QElapsedTimer>
+#include <QFile>
+#include <QTemporaryDir>
+
+using namespace linglong::runtime;
+
+namespace {
+
+// 与misc/lib/linglong/container/config.d中生成器数量一致
+constexpr auto generatorCount = 7;
+constexpr auto launchCount = 50;
+
+void writeFile(const QString &path, const QByteArray &content)
+{
+    QFile file{ path };
+    ASSERT_TRUE(file.open(QFile::WriteOnly | QFile::Truncate));
+    ASSERT_EQ(file.write(content), content.size());
+}
+
+} // namespace
+
+// 对比命中OCI配置缓存与每次运行全部生成器的启动耗时
+TEST(ContainerBuilderBenchmark, CachedConfigHitVersusMiss)
+{
+    QTemporaryDir tmp;
+    ASSERT_TRUE(tmp.isValid());
+    QDir root = tmp.path();
+    ASSERT_TRUE(root.mkpath("base/files/usr"));
+    ASSERT_TRUE(root.mkpath("container/config.d"));
+    ASSERT_TRUE(root.mkpath("cache"));
+    ASSERT_TRUE(root.mkpath("runtime"));
+    ASSERT_TRUE(QFile::setPermissions(root.filePath("runtime"),
+                                      QFile::ReadOwner | QFile::WriteOwner | QFile::ExeOwner));
+
+    writeFile(root.filePath("container/config.json"), R"({
+        "ociVersion": "1.0.1",
+        "process": { "args": [ "/bin/bash" ], "cwd": "/", "env": [] },
+        "root": { "path": "/" },
+        "mounts": [],
+        "linux": {}
+    })");
+    for (int i = 0; i < generatorCount; ++i) {
+        const auto generator = root.filePath(QString("container/config.d/%1-generator").arg(i));
+        writeFile(generator, "#!/bin/sh\nexec cat\n");
+        if (HasFatalFailure()) {
+            return;
+        }
+        ASSERT_TRUE(QFile::setPermissions(generator, QFile::ReadOwner | QFile::ExeOwner));
+    }
+
+    qputenv("LINGLONG_CONTAINER_CONFIG", root.filePath("container/config.json").toUtf8());
+    qputenv("XDG_CACHE_HOME", root.filePath("cache").toUtf8());
+    qputenv("XDG_RUNTIME_DIR", root.filePath("runtime").toUtf8());
+
+    auto cli = ocppi::cli::crun::Crun::New("/bin/sh");
+    ASSERT_TRUE(cli.has_value());
+    ContainerBuilder builder{ **cli };
+
+    ContainerOptions opts;
+    opts.appID = "org.deepin.benchmark";
+    opts.baseDir = root.filePath("base");
+
+    auto launch = [&builder, &opts, &root](const QString &containerID, bool dropCache) {
+        if (dropCache) {
+            QDir(root.filePath("cache/linglong")).removeRecursively();
+        }
+        opts.containerID = containerID;
+        auto container = builder.create(opts);
+        ASSERT_TRUE(container.has_value()) << container.error().message().toStdString();
+    };
+
+    QElapsedTimer timer;
+    timer.start();
+    for (int i = 0; i < launchCount; ++i) {
+        launch(QString("miss-%1").arg(i), true);
+        if (HasFatalFailure()) {
+            return;
+        }
+    }
+    const auto missNs = timer.nsecsElapsed();
+
+    // 预热缓存
+    launch("warm", false);
+    timer.restart();
+    for (int i = 0; i < launchCount; ++i) {
+        launch(QString("hit-%1").arg(i), false);
+        if (HasFatalFailure()) {
+            return;
+        }
+    }
+    const auto hitNs = timer.nsecsElapsed();
+
+    RecordProperty("usPerMiss", int(missNs / launchCount / 1000));
+    RecordProperty("usPerHit", int(hitNs / launchCount / 1000));
+    EXPECT_LT(hitNs, missNs);
+}
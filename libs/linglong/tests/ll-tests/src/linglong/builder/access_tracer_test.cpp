@@ -0,0 +1,49 @@
+/*
+ * SPDX-FileCopyrightText: 2024 UnionTech Software Technology Co., Ltd.
+ *
+ * SPDX-License-Identifier: LGPL-3.0-or-later
+ */
+
+#include <gtest/gtest.h>
+
+#include "linglong/builder/access_tracer.h"
+
+#include <QDir>
+#include <QFile>
+#include <QTemporaryDir>
+
+namespace {
+
+void writeFile(const QString &path, const QByteArray &content)
+{
+    QFile file(path);
+    ASSERT_TRUE(file.open(QFile::WriteOnly | QFile::Truncate));
+    file.write(content);
+}
+
+} // namespace
+
+TEST(AccessTracer, RecordsOpenedFiles)
+{
+    QTemporaryDir tmp;
+    ASSERT_TRUE(tmp.isValid());
+    QDir root(tmp.path());
+    ASSERT_TRUE(root.mkpath("lib/deep"));
+    writeFile(root.filePath("lib/deep/used.so"), "used");
+    writeFile(root.filePath("lib/unused.so"), "unused");
+
+    auto tracer = linglong::builder::AccessTracer::create({ root.absolutePath() });
+    if (!tracer) {
+        GTEST_SKIP() << "fanotify is unavailable: " << tracer.error().message().toStdString();
+    }
+
+    {
+        QFile file(root.filePath("lib/deep/used.so"));
+        ASSERT_TRUE(file.open(QFile::ReadOnly));
+        EXPECT_EQ(file.readAll(), "used");
+    }
+
+    auto accessed = (*tracer)->stop();
+    EXPECT_TRUE(accessed.contains(root.absoluteFilePath("lib/deep/used.so")));
+    EXPECT_FALSE(accessed.contains(root.absoluteFilePath("lib/unused.so")));
+}
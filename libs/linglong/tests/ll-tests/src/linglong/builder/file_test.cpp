@@ -0,0 +1,92 @@
+/*
+ * SPDX-FileCopyrightText: 2024 UnionTech Software Technology Co., Ltd.
+ *
+ * SPDX-License-Identifier: LGPL-3.0-or-later
+ */
+
+#include <gtest/gtest.h>
+
+#include "linglong/builder/file.h"
+
+#include <QDir>
+#include <QDirIterator>
+#include <QFile>
+#include <QProcess>
+#include <QTemporaryDir>
+
+#include <unistd.h>
+
+namespace {
+
+void writeFile(const QString &path, const QByteArray &content)
+{
+    QFile file(path);
+    ASSERT_TRUE(file.open(QFile::WriteOnly | QFile::Truncate));
+    file.write(content);
+}
+
+} // namespace
+
+TEST(MetadataHashOfDir, DetectChanges)
+{
+    QTemporaryDir tmp;
+    ASSERT_TRUE(tmp.isValid());
+    QDir dir(tmp.path());
+    ASSERT_TRUE(dir.mkpath("src"));
+    ASSERT_TRUE(dir.mkpath("linglong/output"));
+    writeFile(dir.filePath("linglong.yaml"), "version: 1");
+    writeFile(dir.filePath("src/main.c"), "int main() { return 0; }");
+
+    const QStringList excludes{ "linglong" };
+    auto hash = linglong::util::metadataHashOfDir(dir.path(), excludes);
+    EXPECT_EQ(hash, linglong::util::metadataHashOfDir(dir.path(), excludes));
+
+    // build output doesn't count as input
+    writeFile(dir.filePath("linglong/output/info.json"), "{}");
+    EXPECT_EQ(hash, linglong::util::metadataHashOfDir(dir.path(), excludes));
+
+    writeFile(dir.filePath("src/main.c"), "int main() { return 42; }");
+    auto changed = linglong::util::metadataHashOfDir(dir.path(), excludes);
+    EXPECT_NE(hash, changed);
+
+    ASSERT_TRUE(QFile::link("main.c", dir.filePath("src/link.c")));
+    EXPECT_NE(changed, linglong::util::metadataHashOfDir(dir.path(), excludes));
+}
+
+TEST(SizeCounter, MatchesDuApparentSize)
+{
+    QTemporaryDir tmp;
+    ASSERT_TRUE(tmp.isValid());
+    QDir dir(tmp.path());
+    ASSERT_TRUE(dir.mkpath("files/bin"));
+    ASSERT_TRUE(dir.mkpath("files/share/empty"));
+    writeFile(dir.filePath("files/bin/app"), QByteArray(12345, 'a'));
+    writeFile(dir.filePath("files/share/data"), QByteArray(4097, 'b'));
+    writeFile(dir.filePath("files/share/.hidden"), "");
+    ASSERT_TRUE(QFile::link("../share/data", dir.filePath("files/bin/data")));
+    // 硬链接只能计算一次
+    ASSERT_EQ(::link(dir.filePath("files/bin/app").toLocal8Bit(),
+                     dir.filePath("files/share/app").toLocal8Bit()),
+              0);
+
+    linglong::util::SizeCounter counter;
+    EXPECT_FALSE(counter.add(dir.filePath("not-exists")));
+    ASSERT_TRUE(counter.add(dir.path()));
+    QDirIterator it(dir.path(),
+                    QDir::AllEntries | QDir::NoDotAndDotDot | QDir::Hidden | QDir::System,
+                    QDirIterator::Subdirectories);
+    while (it.hasNext()) {
+        ASSERT_TRUE(counter.add(it.next()));
+    }
+    // 重复添加不会改变结果
+    ASSERT_TRUE(counter.add(dir.filePath("files/share/app")));
+
+    QProcess du;
+    du.start("du", { "--apparent-size", "--block-size=1", "--summarize", dir.path() });
+    if (!du.waitForFinished() || du.exitCode() != 0) {
+        GTEST_SKIP() << "du is not available";
+    }
+    auto output = QString::fromLocal8Bit(du.readAllStandardOutput()).split('\t').first();
+    EXPECT_EQ(counter.apparentSize(), output.toULongLong());
+    EXPECT_GT(counter.diskSize(), 0U);
+}
@@ -0,0 +1,210 @@
+/*
+ * SPDX-FileCopyrightText: 2024 UnionTech Software Technology Co., Ltd.
+ *
+ * SPDX-License-Identifier: LGPL-3.0-or-later
+ */
+
+#include <gtest/gtest.h>
+
+#include "linglong/api/types/v1/Generators.hpp"
+#include "linglong/builder/linglong_builder.h"
+#include "linglong/package/layer_dir.h"
+#include "linglong/package/reference.h"
+#include "linglong/repo/client_factory.h"
+#include "linglong/repo/ostree_repo.h"
+
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QSysInfo>
+#include <QTemporaryDir>
+
+using namespace linglong;
+
+namespace {
+
+api::types::v1::PackageInfoV2 appInfo(const std::string &module)
+{
+    api::types::v1::PackageInfoV2 info;
+    info.arch = { QSysInfo::currentCpuArchitecture().toStdString() };
+    info.base = "main:org.deepin.base/23.1.0/" + info.arch.front();
+    info.channel = "main";
+    info.id = "org.deepin.demo";
+    info.kind = "app";
+    info.packageInfoV2Module = module;
+    info.name = "demo";
+    info.schemaVersion = "1.0";
+    info.size = 0;
+    info.version = "1.0.0.0";
+    return info;
+}
+
+// 模拟ll-builder build在linglong/output下生成的layer
+void createOutput(const QDir &dir, const std::string &module, const QByteArray &content)
+{
+    ASSERT_TRUE(dir.mkpath("files/bin"));
+
+    QFile infoFile(dir.absoluteFilePath("info.json"));
+    ASSERT_TRUE(infoFile.open(QIODevice::WriteOnly));
+    infoFile.write(QByteArray::fromStdString(nlohmann::json(appInfo(module)).dump()));
+    infoFile.close();
+
+    QFile binary(dir.absoluteFilePath("files/bin/demo"));
+    ASSERT_TRUE(binary.open(QIODevice::WriteOnly | QIODevice::Truncate));
+    binary.write(content);
+}
+
+class BuildStampTest : public ::testing::Test
+{
+protected:
+    QTemporaryDir tmp;
+    repo::ClientFactory clientFactory{ QString("https://localhost") };
+    std::unique_ptr<repo::OSTreeRepo> ostreeRepo;
+    std::optional<package::Reference> ref;
+
+    void SetUp() override
+    {
+        ASSERT_TRUE(tmp.isValid());
+        api::types::v1::RepoConfig cfg;
+        cfg.defaultRepo = "stable";
+        cfg.repos = { { "stable", "https://localhost" } };
+        cfg.version = 1;
+        ostreeRepo =
+          std::make_unique<repo::OSTreeRepo>(QDir(tmp.filePath("repo")), cfg, clientFactory);
+
+        auto reference = package::Reference::fromPackageInfo(appInfo("binary"));
+        ASSERT_TRUE(reference.has_value());
+        ref = *reference;
+    }
+
+    // 与Builder::build提交输出的方式相同，先删除旧的再导入
+    void commitOutput(const QByteArray &content)
+    {
+        for (const std::string module : { "binary", "develop" }) {
+            const auto dir = tmp.filePath(QString("output/%1").arg(module.c_str()));
+            QDir(dir).removeRecursively();
+            createOutput(dir, module, content);
+            if (HasFatalFailure()) {
+                return;
+            }
+            ostreeRepo->remove(*ref, module == "develop");
+            auto layer = ostreeRepo->importLayerDir(package::LayerDir(dir));
+            ASSERT_TRUE(layer.has_value()) << layer.error().message().toStdString();
+        }
+    }
+
+    builder::BuildStamp currentStamp(const QString &inputsDigest)
+    {
+        auto binaryCommit = ostreeRepo->getCommit(*ref);
+        auto developCommit = ostreeRepo->getCommit(*ref, true);
+        EXPECT_TRUE(binaryCommit.has_value());
+        EXPECT_TRUE(developCommit.has_value());
+        return { inputsDigest, binaryCommit.value_or(""), developCommit.value_or("") };
+    }
+};
+
+} // namespace
+
+TEST_F(BuildStampTest, NoopRebuild)
+{
+    commitOutput("v1");
+    if (HasFatalFailure()) {
+        return;
+    }
+
+    const auto stampPath = tmp.filePath("build.stamp");
+    ASSERT_TRUE(builder::saveBuildStamp(stampPath, currentStamp("inputs")).has_value());
+    auto stamp = builder::loadBuildStamp(stampPath);
+    ASSERT_TRUE(stamp.has_value()) << stamp.error().message().toStdString();
+
+    // 第二次构建的输入不变，直接复用上次的提交
+    EXPECT_TRUE(builder::isBuildUpToDate(*stamp, "inputs", *ostreeRepo, *ref));
+    EXPECT_FALSE(builder::isBuildUpToDate(*stamp, "changed", *ostreeRepo, *ref));
+
+    // 同一个引用被其他内容覆盖后，检出目录仍然存在，但不能跳过构建
+    commitOutput("v2");
+    if (HasFatalFailure()) {
+        return;
+    }
+    ASSERT_TRUE(ostreeRepo->getLayerDir(*ref).has_value());
+    EXPECT_FALSE(builder::isBuildUpToDate(*stamp, "inputs", *ostreeRepo, *ref));
+
+    const auto rebuilt = currentStamp("inputs");
+    EXPECT_TRUE(builder::isBuildUpToDate(rebuilt, "inputs", *ostreeRepo, *ref));
+    ASSERT_TRUE(ostreeRepo->remove(*ref, true).has_value());
+    EXPECT_FALSE(builder::isBuildUpToDate(rebuilt, "inputs", *ostreeRepo, *ref));
+}
+
+TEST_F(BuildStampTest, RejectLegacyStamp)
+{
+    const auto stampPath = tmp.filePath("build.stamp");
+    QFile file(stampPath);
+    ASSERT_TRUE(file.open(QIODevice::WriteOnly));
+    file.write("0123456789abcdef");
+    file.close();
+
+    EXPECT_FALSE(builder::loadBuildStamp(stampPath).has_value());
+    EXPECT_FALSE(builder::loadBuildStamp(tmp.filePath("not-exists")).has_value());
+}
+
+TEST_F(BuildStampTest, SkipSecondBuildUntilSourcesChange)
+{
+    QDir project = tmp.filePath("project");
+    ASSERT_TRUE(project.mkpath("src"));
+    ASSERT_TRUE(project.mkpath("linglong/sources/demo"));
+    auto writeFile = [&project](const QString &path, const QByteArray &content) {
+        ASSERT_TRUE(project.mkpath(QFileInfo(project.absoluteFilePath(path)).path()));
+        QFile file(project.absoluteFilePath(path));
+        ASSERT_TRUE(file.open(QIODevice::WriteOnly | QIODevice::Truncate));
+        file.write(content);
+    };
+    writeFile("linglong.yaml", "version: '1'");
+    writeFile("src/main.cpp", "int main() {}");
+    writeFile("linglong/sources/demo/demo.c", "int demo;");
+    if (HasFatalFailure()) {
+        return;
+    }
+
+    api::types::v1::BuilderProject buildProject;
+    buildProject.package.id = "org.deepin.demo";
+    api::types::v1::BuilderConfig cfg;
+    const QStringList args{ "/project/linglong/entry.sh" };
+    auto digest = [&]() {
+        return builder::buildInputsDigest(buildProject, cfg, project, args, {});
+    };
+
+    // 第一次构建，ll-builder在linglong/下写入的内容不影响摘要
+    const auto firstDigest = digest();
+    writeFile("linglong/entry.sh", "#!/bin/bash");
+    writeFile("linglong/output/binary/info.json", "{}");
+    writeFile("linglong/cache/archive.tar", "cache");
+    writeFile("linglong/ccache/stats", "stats");
+    writeFile("linglong/minify/org.deepin.base.list", "/usr/lib");
+    if (HasFatalFailure()) {
+        return;
+    }
+    commitOutput("v1");
+    if (HasFatalFailure()) {
+        return;
+    }
+    const auto stampPath = project.absoluteFilePath("linglong/build.stamp");
+    ASSERT_TRUE(builder::saveBuildStamp(stampPath, currentStamp(digest())).has_value());
+    EXPECT_EQ(digest(), firstDigest);
+
+    // 第二次构建没有任何修改，直接跳过
+    auto stamp = builder::loadBuildStamp(stampPath);
+    ASSERT_TRUE(stamp.has_value());
+    EXPECT_TRUE(builder::isBuildUpToDate(*stamp, digest(), *ostreeRepo, *ref));
+
+    // 离线构建不会重新获取源码，需要重新构建
+    cfg.offline = true;
+    EXPECT_FALSE(builder::isBuildUpToDate(*stamp, digest(), *ostreeRepo, *ref));
+    cfg.offline = std::nullopt;
+
+    // 修改解压后的源码也需要重新构建
+    writeFile("linglong/sources/demo/demo.c", "int demo = 1;");
+    if (HasFatalFailure()) {
+        return;
+    }
+    EXPECT_FALSE(builder::isBuildUpToDate(*stamp, digest(), *ostreeRepo, *ref));
+}
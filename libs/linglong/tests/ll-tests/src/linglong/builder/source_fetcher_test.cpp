@@ -0,0 +1,173 @@
+/*
+ * SPDX-FileCopyrightText: 2024 UnionTech Software Technology Co., Ltd.
+ *
+ * SPDX-License-Identifier: LGPL-3.0-or-later
+ */
+
+#include <gtest/gtest.h>
+
+#include "linglong/builder/source_fetcher.h"
+
+#include <QCryptographicHash>
+#include <QDir>
+#include <QFile>
+#include <QProcess>
+#include <QStandardPaths>
+#include <QTcpServer>
+#include <QTcpSocket>
+#include <QTemporaryDir>
+#include <QThread>
+
+#include <set>
+
+// Q_INIT_RESOURCE can't be used inside a namespace
+static void initBuilderResources()
+{
+    Q_INIT_RESOURCE(builder_releases);
+}
+
+namespace linglong::builder::test {
+
+namespace {
+
+constexpr auto archiveCount = 40;
+
+class SourceFetcherTest : public ::testing::Test
+{
+protected:
+    void SetUp() override
+    {
+        initBuilderResources();
+
+        for (const auto *tool : { "python3", "wget", "tar", "sha256sum" }) {
+            if (QStandardPaths::findExecutable(tool).isEmpty()) {
+                GTEST_SKIP() << tool << " not found";
+            }
+        }
+
+        ASSERT_TRUE(tmpDir.isValid());
+        QDir root(tmpDir.path());
+        ASSERT_TRUE(root.mkpath("www"));
+
+        // pick a free port for the http server
+        QTcpServer probe;
+        ASSERT_TRUE(probe.listen(QHostAddress::LocalHost));
+        port = probe.serverPort();
+        probe.close();
+
+        for (int i = 0; i < archiveCount; ++i) {
+            auto name = QString("source-%1").arg(i);
+            ASSERT_TRUE(root.mkpath(name));
+            QFile file(root.absoluteFilePath(name + "/README"));
+            ASSERT_TRUE(file.open(QFile::WriteOnly));
+            file.write(name.toUtf8());
+            file.close();
+
+            auto archive = root.absoluteFilePath("www/" + name + ".tar.gz");
+            ASSERT_EQ(QProcess::execute("tar", { "-czf", archive, "-C", root.path(), name }), 0);
+
+            QFile archiveFile(archive);
+            ASSERT_TRUE(archiveFile.open(QFile::ReadOnly));
+            QCryptographicHash hash(QCryptographicHash::Sha256);
+            ASSERT_TRUE(hash.addData(&archiveFile));
+
+            api::types::v1::BuilderProjectSource source;
+            source.kind = "archive";
+            source.name = name.toStdString();
+            source.url =
+              QString("http://127.0.0.1:%1/%2.tar.gz").arg(port).arg(name).toStdString();
+            source.digest = hash.result().toHex().toStdString();
+            sources.push_back(source);
+        }
+
+        server.setWorkingDirectory(root.absoluteFilePath("www"));
+        server.start("python3",
+                     { "-m", "http.server", QString::number(port), "--bind", "127.0.0.1" });
+        ASSERT_TRUE(server.waitForStarted());
+
+        for (int retry = 0; retry < 50; ++retry) {
+            QTcpSocket socket;
+            socket.connectToHost(QHostAddress::LocalHost, port);
+            if (socket.waitForConnected(100)) {
+                return;
+            }
+            QThread::msleep(100);
+        }
+        FAIL() << "http server is not ready";
+    }
+
+    void TearDown() override
+    {
+        stopServer();
+    }
+
+    void stopServer()
+    {
+        if (server.state() != QProcess::NotRunning) {
+            server.kill();
+            server.waitForFinished();
+        }
+    }
+
+    QTemporaryDir tmpDir;
+    quint16 port = 0;
+    QProcess server;
+    std::vector<api::types::v1::BuilderProjectSource> sources;
+};
+
+} // namespace
+
+TEST_F(SourceFetcherTest, ParallelFetchWithSharedCache)
+{
+    QDir root(tmpDir.path());
+    QDir cacheDir = root.absoluteFilePath("cache");
+
+    std::set<std::size_t> completed;
+    auto result = fetchSources(sources,
+                               {},
+                               cacheDir,
+                               root.absoluteFilePath("sources"),
+                               8,
+                               [&completed](std::size_t pos, FetchState state) {
+                                   EXPECT_NE(state, FetchState::Failed);
+                                   if (state == FetchState::Complete) {
+                                       EXPECT_TRUE(completed.insert(pos).second);
+                                   }
+                               });
+    ASSERT_TRUE(result.has_value()) << result.error().message().toStdString();
+    EXPECT_EQ(completed.size(), sources.size());
+
+    for (const auto &source : sources) {
+        auto name = QString::fromStdString(*source.name);
+        QFile readme(root.absoluteFilePath(QString("sources/%1/%1/README").arg(name)));
+        ASSERT_TRUE(readme.open(QFile::ReadOnly)) << readme.fileName().toStdString();
+        EXPECT_EQ(readme.readAll(), name.toUtf8());
+        EXPECT_TRUE(
+          cacheDir.exists(QString("archive_%1").arg(QString::fromStdString(*source.digest))));
+    }
+
+    // a second build sharing the cache doesn't need the network anymore
+    stopServer();
+    result = fetchSources(sources, {}, cacheDir, root.absoluteFilePath("sources2"), 8);
+    ASSERT_TRUE(result.has_value()) << result.error().message().toStdString();
+    EXPECT_TRUE(root.exists(QString("sources2/source-0/source-0/README")));
+
+    // no temporary files are left in the cache
+    EXPECT_TRUE(cacheDir.entryList({ "tmp_*" }, QDir::AllEntries | QDir::Hidden).isEmpty());
+}
+
+TEST_F(SourceFetcherTest, DigestMismatch)
+{
+    QDir root(tmpDir.path());
+    sources.at(3).digest = std::string(64, '0');
+
+    auto result = fetchSources(sources,
+                               {},
+                               root.absoluteFilePath("cache"),
+                               root.absoluteFilePath("sources"),
+                               4);
+    EXPECT_FALSE(result.has_value());
+    EXPECT_FALSE(root.exists(QString("cache/archive_%1").arg(QString(64, '0'))));
+}
+
+} // namespace linglong::builder::test
@@ -0,0 +1,106 @@
+/*
+ * SPDX-FileCopyrightText: 2024 UnionTech Software Technology Co., Ltd.
+ *
+ * SPDX-License-Identifier: LGPL-3.0-or-later
+ */
+
+#include <gtest/gtest.h>
+
+#include "linglong/generator/device_inventory.h"
+
+#include <algorithm>
+#include <fstream>
+
+#include <fcntl.h>
+#include <sys/stat.h>
+
+using linglong::generator::DeviceInventory;
+
+namespace {
+
+class DeviceInventoryTest : public ::testing::Test
+{
+protected:
+    void SetUp() override
+    {
+        char tmpl[] = "/tmp/ll-device-inventory-XXXXXX";
+        ASSERT_NE(::mkdtemp(tmpl), nullptr);
+        root = tmpl;
+        devDir = root / "dev";
+        cacheFile = root / "cache" / "devices.json";
+        std::filesystem::create_directories(devDir);
+    }
+
+    void TearDown() override { std::filesystem::remove_all(root); }
+
+    void touch(const std::string &name) const { std::ofstream(devDir / name).close(); }
+
+    std::filesystem::path root;
+    std::filesystem::path devDir;
+    std::filesystem::path cacheFile;
+};
+
+} // namespace
+
+TEST_F(DeviceInventoryTest, LargeDevDir)
+{
+    // a storage server with thousands of disks and ttys
+    for (int i = 0; i < 5000; ++i) {
+        touch("sd" + std::to_string(i));
+        touch("tty" + std::to_string(i));
+    }
+    touch("video0");
+    touch("video1");
+    touch("nvidia0");
+    touch("nvidiactl");
+
+    DeviceInventory inventory(devDir, cacheFile);
+    auto devices = inventory.devices();
+    std::sort(devices.begin(), devices.end());
+    std::vector<std::string> expected{ devDir / "nvidia0",
+                                       devDir / "nvidiactl",
+                                       devDir / "video0",
+                                       devDir / "video1" };
+    EXPECT_EQ(devices, expected);
+    EXPECT_EQ(inventory.rescanCount(), 1U);
+    ASSERT_TRUE(std::filesystem::exists(cacheFile));
+
+    // add a node behind the inventory's back, keeping the mtime of the directory
+    struct stat before{};
+    ASSERT_EQ(::stat(devDir.c_str(), &before), 0);
+    touch("video2");
+    struct timespec times[2] = { before.st_atim, before.st_mtim };
+    ASSERT_EQ(::utimensat(AT_FDCWD, devDir.c_str(), times, 0), 0);
+
+    // the answer comes from the cache, the directory isn't read again
+    DeviceInventory warm(devDir, cacheFile);
+    auto cached = warm.devices();
+    std::sort(cached.begin(), cached.end());
+    EXPECT_EQ(cached, expected);
+    EXPECT_EQ(warm.rescanCount(), 0U);
+
+    EXPECT_EQ(warm.scan().size(), expected.size() + 1);
+}
+
+TEST_F(DeviceInventoryTest, Invalidate)
+{
+    touch("video0");
+
+    DeviceInventory inventory(devDir, cacheFile);
+    EXPECT_EQ(inventory.devices(), std::vector<std::string>{ devDir / "video0" });
+
+    std::filesystem::remove(devDir / "video0");
+    touch("nvidia0");
+    // make sure the mtime differs even on filesystems with coarse timestamps
+    struct timespec times[2] = { { 0, UTIME_OMIT }, { 1, 0 } };
+    ASSERT_EQ(::utimensat(AT_FDCWD, devDir.c_str(), times, 0), 0);
+
+    EXPECT_EQ(inventory.devices(), std::vector<std::string>{ devDir / "nvidia0" });
+    EXPECT_EQ(inventory.rescanCount(), 2U);
+
+    // a broken cache is rebuilt
+    std::ofstream(cacheFile) << "{";
+    DeviceInventory rebuilt(devDir, cacheFile);
+    EXPECT_EQ(rebuilt.devices(), std::vector<std::string>{ devDir / "nvidia0" });
+    EXPECT_EQ(rebuilt.rescanCount(), 1U);
+}
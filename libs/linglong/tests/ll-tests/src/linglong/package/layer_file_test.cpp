@@ -0,0 +1,160 @@
+/*
+ * SPDX-FileCopyrightText: 2024 UnionTech Software Technology Co., Ltd.
+ *
+ * SPDX-License-Identifier: LGPL-3.0-or-later
+ */
+
+#include <gtest/gtest.h>
+
+#include "linglong/package/layer_file.h"
+#include "linglong/package/layer_test_helper.h"
+
+#include <QFile>
+#include <QTemporaryDir>
+#include <QtEndian>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+using namespace linglong::package;
+using test::createLayerFile;
+using test::layerPayload;
+
+TEST(LayerFile, LoadFromUnlinkedDescriptor)
+{
+    QTemporaryDir tmp;
+    ASSERT_TRUE(tmp.isValid());
+    const auto path = tmp.filePath("test.layer");
+    createLayerFile(path, "org.deepin.test");
+    if (HasFatalFailure()) {
+        return;
+    }
+
+    auto fd = ::open(path.toLocal8Bit().constData(), O_RDONLY | O_CLOEXEC);
+    ASSERT_NE(fd, -1);
+    ASSERT_EQ(::lseek(fd, 3, SEEK_SET), 3);
+
+    auto layer = LayerFile::New(fd);
+    ASSERT_TRUE(layer.has_value()) << layer.error().message().toStdString();
+
+    // 交给LayerFile之后删除并替换原文件，后续的读取不应该受到影响
+    ASSERT_TRUE(QFile::remove(path));
+    createLayerFile(path, "org.deepin.replaced");
+    ::close(fd);
+
+    auto info = (*layer)->metaInfo();
+    ASSERT_TRUE(info.has_value()) << info.error().message().toStdString();
+    EXPECT_EQ(info->info.at("id").get<std::string>(), "org.deepin.test");
+
+    auto offset = (*layer)->binaryDataOffset();
+    ASSERT_TRUE(offset.has_value());
+    EXPECT_EQ(qint64(*offset) + layerPayload.size(), (*layer)->size());
+
+    QFile reopened((*layer)->descriptorPath());
+    ASSERT_TRUE(reopened.open(QIODevice::ReadOnly));
+    ASSERT_TRUE(reopened.seek(*offset));
+    EXPECT_EQ(reopened.readAll(), layerPayload);
+}
+
+TEST(LayerFile, DescriptorOffsetUnchanged)
+{
+    QTemporaryDir tmp;
+    ASSERT_TRUE(tmp.isValid());
+    const auto path = tmp.filePath("test.layer");
+    createLayerFile(path, "org.deepin.test");
+    if (HasFatalFailure()) {
+        return;
+    }
+
+    auto fd = ::open(path.toLocal8Bit().constData(), O_RDONLY | O_CLOEXEC);
+    ASSERT_NE(fd, -1);
+    ASSERT_EQ(::lseek(fd, 5, SEEK_SET), 5);
+
+    {
+        auto layer = LayerFile::New(fd);
+        ASSERT_TRUE(layer.has_value());
+        ASSERT_TRUE((*layer)->metaInfo().has_value());
+        ASSERT_TRUE((*layer)->binaryDataOffset().has_value());
+    }
+
+    // 复制出的描述符与原描述符共享读写位置，读取时只能使用pread
+    EXPECT_EQ(::lseek(fd, 0, SEEK_CUR), 5);
+    EXPECT_NE(::fcntl(fd, F_GETFD), -1);
+    ::close(fd);
+}
+
+TEST(LayerFile, SaveToFromUnlinkedDescriptor)
+{
+    QTemporaryDir tmp;
+    ASSERT_TRUE(tmp.isValid());
+    const auto path = tmp.filePath("test.layer");
+    createLayerFile(path, "org.deepin.test");
+    if (HasFatalFailure()) {
+        return;
+    }
+
+    QFile original(path);
+    ASSERT_TRUE(original.open(QIODevice::ReadOnly));
+    const auto content = original.readAll();
+    original.close();
+
+    auto fd = ::open(path.toLocal8Bit().constData(), O_RDONLY | O_CLOEXEC);
+    ASSERT_NE(fd, -1);
+    ASSERT_EQ(::lseek(fd, 7, SEEK_SET), 7);
+    auto layer = LayerFile::New(fd);
+    ASSERT_TRUE(layer.has_value());
+    ASSERT_TRUE(QFile::remove(path));
+
+    const auto destination = tmp.filePath("saved.layer");
+    auto ret = (*layer)->saveTo(destination);
+    ASSERT_TRUE(ret.has_value()) << ret.error().message().toStdString();
+    EXPECT_EQ(::lseek(fd, 0, SEEK_CUR), 7);
+    ::close(fd);
+
+    QFile saved(destination);
+    ASSERT_TRUE(saved.open(QIODevice::ReadOnly));
+    EXPECT_EQ(saved.readAll(), content);
+
+    // 与QFile::copy一致，不覆盖已经存在的文件
+    EXPECT_FALSE((*layer)->saveTo(destination).has_value());
+}
+
+TEST(LayerFile, RejectInvalidMetaInfoLength)
+{
+    QTemporaryDir tmp;
+    ASSERT_TRUE(tmp.isValid());
+    const auto path = tmp.filePath("broken.layer");
+
+    QFile file(path);
+    ASSERT_TRUE(file.open(QIODevice::WriteOnly));
+    file.write(magicNumber);
+    auto length = qToLittleEndian<quint32>(4096);
+    file.write(reinterpret_cast<const char *>(&length), sizeof(length));
+    file.write("{}");
+    file.close();
+
+    EXPECT_FALSE(LayerFile::New(path).has_value());
+
+    ASSERT_TRUE(file.open(QIODevice::WriteOnly | QIODevice::Truncate));
+    file.write(QByteArray(magicNumber.size() + 8, 'x'));
+    file.close();
+    EXPECT_FALSE(LayerFile::New(path).has_value());
+}
+
+TEST(LayerFile, TruncatedAfterOpen)
+{
+    QTemporaryDir tmp;
+    ASSERT_TRUE(tmp.isValid());
+    const auto path = tmp.filePath("test.layer");
+    createLayerFile(path, "org.deepin.test");
+    if (HasFatalFailure()) {
+        return;
+    }
+
+    auto layer = LayerFile::New(path);
+    ASSERT_TRUE(layer.has_value());
+
+    // 文件的所有者可以在打开之后截断文件，读取元信息只能失败，不能让进程崩溃
+    ASSERT_EQ(::truncate(path.toLocal8Bit().constData(), magicNumber.size() + 8), 0);
+    EXPECT_FALSE((*layer)->metaInfo().has_value());
+}
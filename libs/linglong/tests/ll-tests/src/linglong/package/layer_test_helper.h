@@ -0,0 +1,38 @@
+/*
+ * SPDX-FileCopyrightText: 2024 UnionTech Software Technology Co., Ltd.
+ *
+ * SPDX-License-Identifier: LGPL-3.0-or-later
+ */
+
+#pragma once
+
+#include <gtest/gtest.h>
+
+#include "linglong/api/types/v1/Generators.hpp"
+#include "linglong/package/layer_file.h"
+
+#include <QFile>
+#include <QtEndian>
+
+namespace linglong::package::test {
+
+const QByteArray layerPayload = QByteArray("erofs payload").repeated(16);
+
+// 按照layer文件格式手工拼一个文件：魔数 + 小端u32长度 + 元信息json + 数据
+inline void createLayerFile(const QString &path, const std::string &id)
+{
+    api::types::v1::LayerInfo info;
+    info.version = "1";
+    info.info = nlohmann::json{ { "id", id } };
+    const auto meta = QByteArray::fromStdString(nlohmann::json(info).dump());
+
+    QFile file(path);
+    ASSERT_TRUE(file.open(QIODevice::WriteOnly));
+    file.write(magicNumber);
+    auto length = qToLittleEndian<quint32>(meta.size());
+    file.write(reinterpret_cast<const char *>(&length), sizeof(length));
+    file.write(meta);
+    file.write(layerPayload);
+}
+
+} // namespace linglong::package::test
@@ -0,0 +1,106 @@
+/*
+ * SPDX-FileCopyrightText: 2024 UnionTech Software Technology Co., Ltd.
+ *
+ * SPDX-License-Identifier: LGPL-3.0-or-later
+ */
+
+#include <gtest/gtest.h>
+
+#include "linglong/package/uab_file.h"
+#include "linglong/package/uab_test_helper.h"
+
+#include <QFile>
+#include <QTemporaryDir>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+using namespace linglong::package;
+
+namespace {
+
+const QByteArray bundleData = QByteArray("erofs bundle").repeated(4096);
+
+} // namespace
+
+TEST(UABFile, MetaLookupWithManySections)
+{
+    if (!test::hasUABHeader()) {
+        GTEST_SKIP() << "no executable to use as uab header";
+    }
+
+    QTemporaryDir tmp;
+    ASSERT_TRUE(tmp.isValid());
+    const auto uabPath = tmp.filePath("test.uab");
+    linglong::api::types::v1::UabMetaInfo meta;
+    test::createUAB(tmp, uabPath, bundleData, 512, meta);
+    if (HasFatalFailure()) {
+        return;
+    }
+
+    auto uab = UABFile::loadFromFile(uabPath);
+    ASSERT_TRUE(uab.has_value());
+    auto metaInfo = (*uab)->getMetaInfo();
+    ASSERT_TRUE(metaInfo.has_value());
+    EXPECT_EQ(metaInfo->get().uuid, meta.uuid);
+    auto verified = (*uab)->verify();
+    ASSERT_TRUE(verified.has_value());
+    EXPECT_TRUE(*verified);
+}
+
+TEST(UABFile, LoadFromUnlinkedDescriptor)
+{
+    if (!test::hasUABHeader()) {
+        GTEST_SKIP() << "no executable to use as uab header";
+    }
+
+    QTemporaryDir tmp;
+    ASSERT_TRUE(tmp.isValid());
+    const auto uabPath = tmp.filePath("test.uab");
+    linglong::api::types::v1::UabMetaInfo meta;
+    test::createUAB(tmp, uabPath, bundleData, 0, meta);
+    if (HasFatalFailure()) {
+        return;
+    }
+
+    auto fd = ::open(uabPath.toLocal8Bit().constData(), O_RDONLY | O_CLOEXEC);
+    ASSERT_NE(fd, -1);
+    auto uab = UABFile::loadFromFile(fd);
+    ASSERT_TRUE(uab.has_value()) << uab.error().message().toStdString();
+
+    // 客户端在交出描述符后删除文件，不应影响后续的校验
+    ASSERT_TRUE(QFile::remove(uabPath));
+
+    auto metaInfo = (*uab)->getMetaInfo();
+    ASSERT_TRUE(metaInfo.has_value());
+    EXPECT_EQ(metaInfo->get().uuid, meta.uuid);
+    auto verified = (*uab)->verify();
+    ASSERT_TRUE(verified.has_value());
+    EXPECT_TRUE(*verified);
+    EXPECT_EQ(::lseek(fd, 0, SEEK_CUR), 0);
+    ::close(fd);
+}
+
+TEST(UABFile, TruncatedWhileVerifying)
+{
+    if (!test::hasUABHeader()) {
+        GTEST_SKIP() << "no executable to use as uab header";
+    }
+
+    QTemporaryDir tmp;
+    ASSERT_TRUE(tmp.isValid());
+    const auto uabPath = tmp.filePath("test.uab");
+    linglong::api::types::v1::UabMetaInfo meta;
+    test::createUAB(tmp, uabPath, bundleData, 0, meta);
+    if (HasFatalFailure()) {
+        return;
+    }
+
+    auto uab = UABFile::loadFromFile(uabPath);
+    ASSERT_TRUE(uab.has_value());
+    ASSERT_TRUE((*uab)->getMetaInfo().has_value());
+
+    // 文件的所有者可以随时截断文件，校验只能失败，不能让进程崩溃
+    ASSERT_EQ(::truncate(uabPath.toLocal8Bit().constData(), 4096), 0);
+    EXPECT_FALSE((*uab)->verify().has_value());
+}
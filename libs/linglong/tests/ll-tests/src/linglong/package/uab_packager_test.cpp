@@ -0,0 +1,102 @@
+/*
+ * SPDX-FileCopyrightText: 2024 UnionTech Software Technology Co., Ltd.
+ *
+ * SPDX-License-Identifier: LGPL-3.0-or-later
+ */
+
+#include <gtest/gtest.h>
+
+#include "linglong/package/uab_file.h"
+#include "linglong/package/uab_packager.h"
+#include "linglong/package/uab_test_helper.h"
+
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QProcess>
+#include <QTemporaryDir>
+
+#include <sys/stat.h>
+
+using namespace linglong::package;
+
+TEST(UABPackager, WriteSectionsInOnePass)
+{
+    if (!test::hasUABHeader()) {
+        GTEST_SKIP() << "no executable to use as uab header";
+    }
+
+    QTemporaryDir tmp;
+    ASSERT_TRUE(tmp.isValid());
+    const auto uabPath = tmp.filePath("test.uab");
+    QByteArray bundleData;
+    for (int i = 0; i < 100000; ++i) {
+        bundleData.append(QByteArray::number(i));
+    }
+    linglong::api::types::v1::UabMetaInfo meta;
+    test::createUAB(tmp, uabPath, bundleData, 0, meta);
+    if (HasFatalFailure()) {
+        return;
+    }
+
+    // the header stays a valid executable
+    EXPECT_EQ(QProcess::execute(uabPath, {}), 0);
+
+    auto uab = UABFile::loadFromFile(uabPath);
+    ASSERT_TRUE(uab.has_value());
+    auto metaInfo = (*uab)->getMetaInfo();
+    ASSERT_TRUE(metaInfo.has_value());
+    EXPECT_EQ(metaInfo->get().uuid, meta.uuid);
+    auto verified = (*uab)->verify();
+    ASSERT_TRUE(verified.has_value());
+    EXPECT_TRUE(*verified);
+}
+
+TEST(UABPackager, StageMinifiedLayer)
+{
+    QTemporaryDir tmp;
+    ASSERT_TRUE(tmp.isValid());
+    QDir layer = tmp.filePath("layer");
+    ASSERT_TRUE(layer.mkpath("files/lib"));
+    ASSERT_TRUE(layer.mkpath("files/share/locale/zh_CN"));
+    ASSERT_TRUE(layer.mkpath("files/share/doc"));
+    ASSERT_TRUE(layer.mkpath("files/empty"));
+    for (const auto &path : { "info.json",
+                              "files/lib/libused.so",
+                              "files/lib/libunused.so",
+                              "files/share/locale/zh_CN/app.mo",
+                              "files/share/doc/README" }) {
+        QFile file(layer.absoluteFilePath(path));
+        ASSERT_TRUE(file.open(QIODevice::WriteOnly));
+        file.write(path);
+    }
+    ASSERT_TRUE(QFile::link("libunused.so", layer.absoluteFilePath("files/lib/libunused.so.1")));
+
+    // 与ll-builder export --minify-allowlist相同的通配符转换
+    MinifyFilter filter;
+    filter.files = { "files/lib/libused.so" };
+    filter.allowlist.append(QRegularExpression(QRegularExpression::anchoredPattern(
+      QRegularExpression::wildcardToRegularExpression("files/share/locale/*"))));
+
+    QDir dest = tmp.filePath("dest");
+    auto staged = stageMinifiedLayer(layer, dest, filter);
+    ASSERT_TRUE(staged.has_value()) << staged.error().message().toStdString();
+
+    // 访问记录中的文件以硬链接保留
+    EXPECT_TRUE(dest.exists("files/lib/libused.so"));
+    struct stat src{};
+    struct stat dst{};
+    ASSERT_EQ(::stat(layer.absoluteFilePath("files/lib/libused.so").toLocal8Bit(), &src), 0);
+    ASSERT_EQ(::stat(dest.absoluteFilePath("files/lib/libused.so").toLocal8Bit(), &dst), 0);
+    EXPECT_EQ(src.st_ino, dst.st_ino);
+
+    // 白名单匹配的文件、顶层文件、目录和符号链接总是保留
+    EXPECT_TRUE(dest.exists("files/share/locale/zh_CN/app.mo"));
+    EXPECT_TRUE(dest.exists("info.json"));
+    EXPECT_TRUE(QFileInfo(dest.absoluteFilePath("files/empty")).isDir());
+    EXPECT_TRUE(QFileInfo(dest.absoluteFilePath("files/lib/libunused.so.1")).isSymLink());
+
+    // 其余文件被丢弃
+    EXPECT_FALSE(dest.exists("files/lib/libunused.so"));
+    EXPECT_FALSE(dest.exists("files/share/doc/README"));
+}
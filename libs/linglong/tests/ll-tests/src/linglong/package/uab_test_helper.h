@@ -0,0 +1,76 @@
+/*
+ * SPDX-FileCopyrightText: 2024 UnionTech Software Technology Co., Ltd.
+ *
+ * SPDX-License-Identifier: LGPL-3.0-or-later
+ */
+
+#pragma once
+
+#include <gtest/gtest.h>
+
+#include "linglong/api/types/v1/Generators.hpp"
+#include "linglong/package/uab_packager.h"
+
+#include <QCryptographicHash>
+#include <QFile>
+#include <QStandardPaths>
+#include <QTemporaryDir>
+#include <QUuid>
+
+namespace linglong::package::test {
+
+inline bool hasUABHeader()
+{
+    return !QStandardPaths::findExecutable("true").isEmpty();
+}
+
+// 用true作为头部生成一个uab，bundle section之后、meta section之前再放extraSections个section，
+// 生成的meta信息通过meta返回
+inline void createUAB(const QTemporaryDir &tmp,
+                      const QString &uabPath,
+                      const QByteArray &bundleData,
+                      int extraSections,
+                      api::types::v1::UabMetaInfo &meta)
+{
+    ASSERT_TRUE(QFile::copy(QStandardPaths::findExecutable("true"), uabPath));
+
+    auto writeFile = [](const QString &path, const QByteArray &data) {
+        QFile file(path);
+        ASSERT_TRUE(file.open(QIODevice::WriteOnly | QIODevice::Truncate));
+        ASSERT_EQ(file.write(data), data.size());
+    };
+
+    const auto bundlePath = tmp.filePath("bundle.ef");
+    writeFile(bundlePath, bundleData);
+
+    meta.digest =
+      QCryptographicHash::hash(bundleData, QCryptographicHash::Sha256).toHex().toStdString();
+    meta.sections.bundle = "linglong.bundle";
+    meta.uuid = QUuid::createUuid().toString(QUuid::WithoutBraces).toStdString();
+    meta.version = api::types::v1::Version::The1;
+    const auto metaPath = tmp.filePath("metaInfo.json");
+    writeFile(metaPath, QByteArray::fromStdString(nlohmann::json(meta).dump()));
+    if (::testing::Test::HasFatalFailure()) {
+        return;
+    }
+
+    auto elf = elfHelper::create(uabPath.toLocal8Bit());
+    ASSERT_TRUE(elf.has_value());
+    ASSERT_TRUE(elf->addNewSection("linglong.bundle", QFileInfo(bundlePath)).has_value());
+    for (int i = 0; i < extraSections; ++i) {
+        const auto path = tmp.filePath(QString("section%1").arg(i));
+        writeFile(path, QByteArray::number(i).repeated(64));
+        if (::testing::Test::HasFatalFailure()) {
+            return;
+        }
+        ASSERT_TRUE(
+          elf->addNewSection(QString("linglong.section%1").arg(i).toUtf8(), QFileInfo(path))
+            .has_value());
+    }
+    ASSERT_TRUE(elf->addNewSection("linglong.meta", QFileInfo(metaPath)).has_value());
+
+    auto ret = elf->writeSections();
+    ASSERT_TRUE(ret.has_value()) << ret.error().message().toStdString();
+}
+
+} // namespace linglong::package::test
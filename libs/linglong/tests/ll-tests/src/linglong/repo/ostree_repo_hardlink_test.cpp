@@ -0,0 +1,140 @@
+/*
+ * SPDX-FileCopyrightText: 2024 UnionTech Software Technology Co., Ltd.
+ *
+ * SPDX-License-Identifier: LGPL-3.0-or-later
+ */
+
+#include <gtest/gtest.h>
+
+#include "linglong/package/layer_dir.h"
+#include "linglong/repo/client_factory.h"
+#include "linglong/repo/ostree_repo.h"
+#include "linglong/repo/repo_test_helper.h"
+
+#include <QDir>
+#include <QFile>
+#include <QTemporaryDir>
+
+#include <sys/stat.h>
+#include <unistd.h>
+
+using namespace linglong;
+
+namespace {
+
+const QStringList versions{ "1.0.0.0", "1.0.0.1" };
+
+// 两个版本的runtime只有files/etc/version不同
+void createRuntimeLayer(const QDir &dir, const QString &version)
+{
+    repo::test::createLayer(dir, "org.deepin.runtime", "runtime", version);
+}
+
+struct stat statOf(const QString &path)
+{
+    struct stat st{};
+    EXPECT_EQ(::lstat(path.toLocal8Bit().constData(), &st), 0) << path.toStdString();
+    return st;
+}
+
+class OSTreeRepoHardlinkTest : public ::testing::Test
+{
+protected:
+    QTemporaryDir tmp;
+    repo::ClientFactory clientFactory{ QString("https://localhost") };
+    std::unique_ptr<repo::OSTreeRepo> ostreeRepo;
+    QStringList layers;
+
+    void SetUp() override
+    {
+        ASSERT_TRUE(tmp.isValid());
+        for (const auto &version : versions) {
+            createRuntimeLayer(tmp.filePath(QString("input/%1").arg(version)), version);
+            if (HasFatalFailure()) {
+                return;
+            }
+        }
+    }
+
+    void openRepo(bool hardlink)
+    {
+        api::types::v1::RepoConfig cfg;
+        cfg.defaultRepo = "stable";
+        cfg.repos = { { "stable", "https://localhost" } };
+        cfg.version = 1;
+        if (hardlink) {
+            cfg.hardlinkLayers = true;
+        }
+        ostreeRepo =
+          std::make_unique<repo::OSTreeRepo>(QDir(tmp.filePath("repo")), cfg, clientFactory);
+    }
+
+    void importRuntimes()
+    {
+        for (const auto &version : versions) {
+            auto layer = ostreeRepo->importLayerDir(
+              package::LayerDir(tmp.filePath(QString("input/%1").arg(version))));
+            ASSERT_TRUE(layer.has_value()) << layer.error().message().toStdString();
+            layers.append(layer->absolutePath());
+        }
+    }
+};
+
+} // namespace
+
+TEST_F(OSTreeRepoHardlinkTest, HardlinkIdenticalFiles)
+{
+    openRepo(true);
+    importRuntimes();
+    if (HasFatalFailure()) {
+        return;
+    }
+
+    auto oldShared = statOf(layers[0] + "/files/lib/libshared.so");
+    auto newShared = statOf(layers[1] + "/files/lib/libshared.so");
+    EXPECT_EQ(oldShared.st_ino, newShared.st_ino);
+    EXPECT_GT(newShared.st_nlink, 2U);
+
+    auto oldVersion = statOf(layers[0] + "/files/etc/version");
+    auto newVersion = statOf(layers[1] + "/files/etc/version");
+    EXPECT_NE(oldVersion.st_ino, newVersion.st_ino);
+
+    QFile versionFile(layers[1] + "/files/etc/version");
+    ASSERT_TRUE(versionFile.open(QIODevice::ReadOnly));
+    EXPECT_EQ(versionFile.readAll(), "1.0.0.1");
+}
+
+TEST_F(OSTreeRepoHardlinkTest, DeduplicateInstalledLayers)
+{
+    // 不使用硬链接时检出会把文件属主设置为对象记录的root
+    if (::geteuid() != 0) {
+        GTEST_SKIP() << "copying checkout of bare-user-only objects requires root";
+    }
+
+    openRepo(false);
+    importRuntimes();
+    if (HasFatalFailure()) {
+        return;
+    }
+
+    const auto sharedBefore = statOf(layers[1] + "/files/lib/libshared.so");
+    EXPECT_NE(statOf(layers[0] + "/files/lib/libshared.so").st_ino, sharedBefore.st_ino);
+    EXPECT_EQ(sharedBefore.st_nlink, 1U);
+
+    auto saved = ostreeRepo->deduplicateLayers();
+    ASSERT_TRUE(saved.has_value()) << saved.error().message().toStdString();
+    EXPECT_GE(*saved, quint64(sharedBefore.st_blocks) * 512 * 2);
+
+    EXPECT_EQ(statOf(layers[0] + "/files/lib/libshared.so").st_ino,
+              statOf(layers[1] + "/files/lib/libshared.so").st_ino);
+    EXPECT_NE(statOf(layers[0] + "/files/etc/version").st_ino,
+              statOf(layers[1] + "/files/etc/version").st_ino);
+
+    QFile shared(layers[0] + "/files/lib/libshared.so");
+    ASSERT_TRUE(shared.open(QIODevice::ReadOnly));
+    EXPECT_EQ(shared.readAll(), repo::test::sharedContent);
+
+    saved = ostreeRepo->deduplicateLayers();
+    ASSERT_TRUE(saved.has_value());
+    EXPECT_EQ(*saved, 0U);
+}
@@ -6,8 +6,12 @@
 
 #include <gtest/gtest.h>
 
+#include "linglong/package/layer_dir.h"
 #include "linglong/package/ref.h"
+#include "linglong/package/reference.h"
+#include "linglong/repo/client_factory.h"
 #include "linglong/repo/ostree_repo.h"
+#include "linglong/repo/repo_test_helper.h"
 #include "linglong/util/file.h"
 #include "linglong/utils/error/error.h"
 #include "linglong/utils/serialize/yaml.h"
@@ -16,11 +20,16 @@
 #include <QDir>
 #include <QProcess>
 #include <QStandardPaths>
+#include <QSysInfo>
 #include <QTemporaryDir>
 
+#include <algorithm>
 #include <cstddef>
 #include <iostream>
 #include <memory>
+#include <thread>
+
+#include <unistd.h>
 
 namespace linglong::repo::test {
 
@@ -192,5 +201,90 @@ TEST_F(RepoTest, getRemoteRepoList)
     GTEST_SKIP();
 }
 
+class ImportLayerDirsTest : public ::testing::Test
+{
+protected:
+    QTemporaryDir tmp;
+    ClientFactory clientFactory{ QString("https://localhost") };
+    std::unique_ptr<OSTreeRepo> ostreeRepo;
+    std::vector<std::pair<package::LayerDir, QString>> dirs;
+    const std::vector<std::pair<std::string, std::string>> layers{
+        { "org.deepin.runtime", "runtime" },
+        { "org.deepin.demo", "app" },
+    };
+
+    void SetUp() override
+    {
+        ASSERT_TRUE(tmp.isValid());
+        for (const auto &[id, kind] : layers) {
+            auto dir = tmp.filePath(QString("input/%1").arg(QString::fromStdString(id)));
+            createLayer(dir, id, kind, "1.0.0.0");
+            if (HasFatalFailure()) {
+                return;
+            }
+            dirs.emplace_back(package::LayerDir(dir), QString{});
+        }
+    }
+
+    void openRepo(bool hardlink)
+    {
+        ostreeRepo.reset();
+
+        api::types::v1::RepoConfig cfg;
+        cfg.defaultRepo = "stable";
+        cfg.repos = { { "stable", "https://localhost" } };
+        cfg.version = 1;
+        cfg.hardlinkLayers = hardlink;
+        ostreeRepo = std::make_unique<OSTreeRepo>(QDir(tmp.filePath("repo")), cfg, clientFactory);
+    }
+
+    static package::Reference referenceOf(const std::string &id)
+    {
+        return *package::Reference::parse(QString::fromStdString("main:" + id + "/1.0.0.0/")
+                                          + QSysInfo::currentCpuArchitecture());
+    }
+};
+
+TEST_F(ImportLayerDirsTest, ReportsEachLayerAfterCheckout)
+{
+    openRepo(true);
+
+    // 每个layer检出后立即在调用线程中回调，回调时该layer目录已经存在
+    const auto caller = std::this_thread::get_id();
+    std::vector<std::size_t> reported;
+    auto imported = ostreeRepo->importLayerDirs(dirs, [&](std::size_t pos) {
+        EXPECT_EQ(std::this_thread::get_id(), caller);
+        reported.push_back(pos);
+        auto info = dirs[pos].first.info();
+        ASSERT_TRUE(info.has_value());
+        EXPECT_TRUE(ostreeRepo->getLayerDir(referenceOf(info->id)).has_value());
+    });
+    ASSERT_TRUE(imported.has_value()) << imported.error().message().toStdString();
+    std::sort(reported.begin(), reported.end());
+    EXPECT_EQ(reported, (std::vector<std::size_t>{ 0, 1 }));
+}
+
+TEST_F(ImportLayerDirsTest, RollbackRemovesCheckedOutLayers)
+{
+    // 不使用硬链接时，非root用户检出bare-user-only对象会因为无法设置属主而失败
+    if (::geteuid() == 0) {
+        GTEST_SKIP() << "checkout only fails without root";
+    }
+
+    openRepo(false);
+    auto imported = ostreeRepo->importLayerDirs(dirs);
+    ASSERT_FALSE(imported.has_value());
+
+    for (const auto &[id, kind] : layers) {
+        EXPECT_FALSE(ostreeRepo->getLayerDir(referenceOf(id)).has_value()) << id;
+        EXPECT_FALSE(ostreeRepo->getCommit(referenceOf(id)).has_value()) << id;
+    }
+
+    // 残留的layer目录会让重新安装报告已存在
+    openRepo(true);
+    imported = ostreeRepo->importLayerDirs(dirs);
+    ASSERT_TRUE(imported.has_value()) << imported.error().message().toStdString();
+}
+
 } // namespace
 } // namespace linglong::repo::test
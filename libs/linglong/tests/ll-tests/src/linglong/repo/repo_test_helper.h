@@ -0,0 +1,69 @@
+/*
+ * SPDX-FileCopyrightText: 2024 UnionTech Software Technology Co., Ltd.
+ *
+ * SPDX-License-Identifier: LGPL-3.0-or-later
+ */
+
+#pragma once
+
+#include <gtest/gtest.h>
+
+#include "linglong/api/types/v1/Generators.hpp"
+
+#include <QDir>
+#include <QFile>
+#include <QSysInfo>
+
+namespace linglong::repo::test {
+
+const QByteArray sharedContent = QByteArray("shared library ").repeated(8192);
+
+// 构造一个可以导入ostree仓库的layer目录，不同版本只有files/etc/version不同，
+// extraFiles用于模拟文件较多的base
+inline void createLayer(const QDir &dir,
+                        const std::string &id,
+                        const std::string &kind,
+                        const QString &version,
+                        int extraFiles = 0)
+{
+    ASSERT_TRUE(dir.mkpath("files/lib"));
+    ASSERT_TRUE(dir.mkpath("files/etc"));
+
+    api::types::v1::PackageInfoV2 info;
+    info.arch = { QSysInfo::currentCpuArchitecture().toStdString() };
+    info.base = "main:org.deepin.base/23.1.0/" + info.arch.front();
+    info.channel = "main";
+    info.id = id;
+    info.kind = kind;
+    info.packageInfoV2Module = "binary";
+    info.name = id;
+    info.schemaVersion = "1.0";
+    info.size = 0;
+    info.version = version.toStdString();
+
+    QFile infoFile(dir.absoluteFilePath("info.json"));
+    ASSERT_TRUE(infoFile.open(QIODevice::WriteOnly));
+    infoFile.write(QByteArray::fromStdString(nlohmann::json(info).dump()));
+    infoFile.close();
+
+    QFile shared(dir.absoluteFilePath("files/lib/libshared.so"));
+    ASSERT_TRUE(shared.open(QIODevice::WriteOnly));
+    shared.write(sharedContent);
+    shared.close();
+
+    QFile versionFile(dir.absoluteFilePath("files/etc/version"));
+    ASSERT_TRUE(versionFile.open(QIODevice::WriteOnly));
+    versionFile.write(version.toUtf8());
+    versionFile.close();
+
+    if (extraFiles > 0) {
+        ASSERT_TRUE(dir.mkpath("files/share"));
+    }
+    for (int i = 0; i < extraFiles; ++i) {
+        QFile file(dir.absoluteFilePath(QString("files/share/%1").arg(i)));
+        ASSERT_TRUE(file.open(QIODevice::WriteOnly));
+        file.write(QByteArray::number(i).repeated(512));
+    }
+}
+
+} // namespace linglong::repo::test
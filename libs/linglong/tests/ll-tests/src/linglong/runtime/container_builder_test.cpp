@@ -0,0 +1,118 @@
+/*
+ * SPDX-FileCopyrightText: 2024 UnionTech Software Technology Co., Ltd.
+ *
+ * SPDX-License-Identifier: LGPL-3.0-or-later
+ */
+
+#include <gtest/gtest.h>
+
+#include "linglong/runtime/container_builder.h"
+
+#include <QDateTime>
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QTemporaryDir>
+
+using namespace linglong::runtime;
+
+TEST(ContainerBuilder, CacheEnvironmentIgnoresVolatileKeys)
+{
+    QProcessEnvironment env;
+    env.insert("HOME", "/home/user");
+    env.insert("DISPLAY", ":0");
+    env.insert("PWD", "/tmp/a");
+    env.insert("OLDPWD", "/tmp");
+    env.insert("SHLVL", "1");
+    env.insert("_", "/usr/bin/ll-cli");
+    const auto expected = configCacheEnvironment(env);
+    EXPECT_EQ(expected, QStringList({ "DISPLAY=:0", "HOME=/home/user" }));
+
+    env.insert("PWD", "/srv");
+    env.insert("OLDPWD", "/tmp/a");
+    env.insert("SHLVL", "3");
+    env.insert("_", "/usr/bin/env");
+    env.insert("INVOCATION_ID", "0123456789abcdef");
+    EXPECT_EQ(configCacheEnvironment(env), expected);
+
+    env.insert("DISPLAY", ":1");
+    EXPECT_NE(configCacheEnvironment(env), expected);
+}
+
+TEST(ContainerBuilder, CachedConfigRequiresBindSources)
+{
+    QTemporaryDir tmp;
+    ASSERT_TRUE(tmp.isValid());
+    // 生成器创建的目录，例如~/.linglong/<appID>
+    const auto source = tmp.filePath("home/.linglong/org.deepin.test");
+    ASSERT_TRUE(QDir().mkpath(source));
+
+    ocppi::runtime::config::types::Config config;
+    config.process = ocppi::runtime::config::types::Process{};
+    config.process->env = std::vector<std::string>{ "HOME=/home/user" };
+    ocppi::runtime::config::types::Mount mount;
+    mount.destination = "/home/user/.linglong/org.deepin.test";
+    mount.type = "bind";
+    mount.source = source.toStdString();
+    config.mounts = std::vector<ocppi::runtime::config::types::Mount>{ mount };
+
+    EXPECT_TRUE(checkCachedConfig(config).has_value());
+    EXPECT_TRUE(checkCachedConfig(config).has_value());
+
+    ASSERT_TRUE(QDir(source).removeRecursively());
+    EXPECT_FALSE(checkCachedConfig(config).has_value());
+
+    config.mounts = std::nullopt;
+    EXPECT_FALSE(checkCachedConfig(config).has_value());
+}
+
+TEST(ContainerBuilder, CacheKeyFollowsGeneratorInputs)
+{
+    QTemporaryDir tmp;
+    ASSERT_TRUE(tmp.isValid());
+    QDir root = tmp.path();
+    ASSERT_TRUE(root.mkpath("base/files"));
+    ASSERT_TRUE(root.mkpath("container/config.d"));
+    ASSERT_TRUE(root.mkpath("home/.config"));
+
+    auto writeFile = [](const QString &path, const QByteArray &content) {
+        QFile file{ path };
+        ASSERT_TRUE(file.open(QFile::WriteOnly | QFile::Truncate));
+        ASSERT_EQ(file.write(content), content.size());
+    };
+    const auto configFile = root.filePath("container/config.json");
+    writeFile(configFile, R"({"ociVersion":"1.0.1"})");
+    const auto generator = root.filePath("container/config.d/30-user-home");
+    writeFile(generator, "#!/bin/sh\nexec cat\n");
+    ASSERT_TRUE(QFile::setPermissions(generator, QFile::ReadOwner | QFile::ExeOwner));
+
+    const auto oldHome = qgetenv("HOME");
+    qputenv("HOME", root.filePath("home").toUtf8());
+
+    ContainerOptions opts;
+    opts.appID = "org.deepin.test";
+    opts.containerID = "test";
+    opts.baseDir = root.filePath("base");
+
+    const auto key = getConfigCacheKey(configFile, opts);
+    EXPECT_EQ(getConfigCacheKey(configFile, opts), key);
+
+    // 30-user-home绑定~/.config/user-dirs.dirs，文件出现后必须重新生成配置
+    writeFile(root.filePath("home/.config/user-dirs.dirs"), "XDG_DESKTOP_DIR=\"$HOME/Desktop\"\n");
+    const auto userDirsKey = getConfigCacheKey(configFile, opts);
+    EXPECT_NE(userDirsKey, key);
+
+    // 生成器按内容计算，大小和修改时间不变时内容变化也要重新生成
+    const auto mtime = QFileInfo(generator).lastModified();
+    ASSERT_TRUE(QFile::setPermissions(generator, QFile::WriteOwner | QFile::ReadOwner));
+    writeFile(generator, "#!/bin/sh\nexec tac\n");
+    {
+        QFile file{ generator };
+        ASSERT_TRUE(file.open(QFile::ReadWrite));
+        ASSERT_TRUE(file.setFileTime(mtime, QFileDevice::FileModificationTime));
+    }
+    ASSERT_TRUE(QFile::setPermissions(generator, QFile::ReadOwner | QFile::ExeOwner));
+    EXPECT_NE(getConfigCacheKey(configFile, opts), userDirsKey);
+
+    qputenv("HOME", oldHome);
+}
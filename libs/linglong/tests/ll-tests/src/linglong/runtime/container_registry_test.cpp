@@ -0,0 +1,96 @@
+/*
+ * SPDX-FileCopyrightText: 2024 UnionTech Software Technology Co., Ltd.
+ *
+ * SPDX-License-Identifier: LGPL-3.0-or-later
+ */
+
+#include <gtest/gtest.h>
+
+#include "linglong/runtime/container_registry.h"
+#include "ocppi/types/Generators.hpp"
+
+#include <QFile>
+#include <QTemporaryDir>
+
+#include <unistd.h>
+
+using namespace linglong::runtime;
+
+namespace {
+
+// simulate what ll-box writes on container creation
+void registerContainer(const QDir &dir, const QString &id, const QString &appID, pid_t pid)
+{
+    nlohmann::json content = ocppi::types::ContainerListItem{
+        .bundle = "/run/user/1000/linglong/" + id.toStdString(),
+        .id = id.toStdString(),
+        .pid = pid,
+        .status = "running",
+    };
+    content["appID"] = appID.toStdString();
+
+    QFile file(dir.absoluteFilePath(id + ".json"));
+    ASSERT_TRUE(file.open(QFile::WriteOnly));
+    file.write(QByteArray::fromStdString(content.dump()));
+    file.close();
+
+    QDir appDir = dir.absoluteFilePath("by-app/" + appID);
+    ASSERT_TRUE(appDir.mkpath("."));
+    ASSERT_TRUE(QFile::link("../../" + id + ".json", appDir.absoluteFilePath(id + ".json")));
+}
+
+} // namespace
+
+TEST(ContainerRegistry, ListByApp)
+{
+    QTemporaryDir tmp;
+    ASSERT_TRUE(tmp.isValid());
+    QDir dir = tmp.path();
+
+    constexpr auto appCount = 50;
+    constexpr auto containersPerApp = 10;
+    for (int i = 0; i < appCount; ++i) {
+        auto appID = QString("org.deepin.demo%1").arg(i);
+        for (int j = 0; j < containersPerApp; ++j) {
+            registerContainer(dir, QString("%1-%2").arg(appID).arg(j), appID, ::getpid());
+        }
+    }
+
+    ContainerRegistry registry(dir);
+
+    auto all = registry.list();
+    ASSERT_TRUE(all.has_value()) << all.error().message().toStdString();
+    EXPECT_EQ(all->size(), appCount * containersPerApp);
+
+    auto containers = registry.listByApp("org.deepin.demo7");
+    ASSERT_TRUE(containers.has_value()) << containers.error().message().toStdString();
+    ASSERT_EQ(containers->size(), containersPerApp);
+    for (const auto &container : *containers) {
+        EXPECT_EQ(container.id.rfind("org.deepin.demo7-", 0), 0U) << container.id;
+    }
+
+    auto none = registry.listByApp("org.deepin.unknown");
+    ASSERT_TRUE(none.has_value());
+    EXPECT_TRUE(none->empty());
+}
+
+TEST(ContainerRegistry, SkipExitedContainers)
+{
+    QTemporaryDir tmp;
+    ASSERT_TRUE(tmp.isValid());
+    QDir dir = tmp.path();
+
+    registerContainer(dir, "alive", "org.deepin.demo", ::getpid());
+    // pid_max never reaches INT32_MAX, so this process can't exist
+    registerContainer(dir, "exited", "org.deepin.demo", INT32_MAX);
+
+    // the container file is gone but its index is left behind
+    registerContainer(dir, "removed", "org.deepin.demo", ::getpid());
+    ASSERT_TRUE(QFile::remove(dir.absoluteFilePath("removed.json")));
+
+    ContainerRegistry registry(dir);
+    auto containers = registry.listByApp("org.deepin.demo");
+    ASSERT_TRUE(containers.has_value()) << containers.error().message().toStdString();
+    ASSERT_EQ(containers->size(), 1U);
+    EXPECT_EQ(containers->front().id, "alive");
+}
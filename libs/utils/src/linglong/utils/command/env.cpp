@@ -6,10 +6,43 @@
 
 #include "env.h"
 
+#include <QProcess>
 #include <QProcessEnvironment>
 
+#include <utility>
+
+#include <fcntl.h>
+
 namespace linglong::utils::command {
 
+namespace {
+
+// 描述符只在fork之后、exec之前的子进程中变为可继承，不会泄漏给同时启动的其他进程
+class InheritFdProcess : public QProcess
+{
+public:
+    explicit InheritFdProcess(QList<int> fds)
+        : fds(std::move(fds))
+    {
+    }
+
+protected:
+    void setupChildProcess() override
+    {
+        for (auto fd : this->fds) {
+            auto flags = ::fcntl(fd, F_GETFD);
+            if (flags != -1) {
+                ::fcntl(fd, F_SETFD, flags & ~FD_CLOEXEC);
+            }
+        }
+    }
+
+private:
+    QList<int> fds;
+};
+
+} // namespace
+
 const QStringList envList = {
     "DISPLAY",
     "LANG",
@@ -61,11 +94,13 @@ QStringList getUserEnv(const QStringList &filters)
     return ret.toStringList();
 }
 
-linglong::utils::error::Result<QString> Exec(QString command, QStringList args)
+linglong::utils::error::Result<QString> Exec(QString command,
+                                             QStringList args,
+                                             QList<int> inheritFds)
 {
     LINGLONG_TRACE(QString("exec %1 %2").arg(command).arg(args.join(" ")));
     qDebug() << "exec" << command << args;
-    QProcess process;
+    InheritFdProcess process(std::move(inheritFds));
     process.setProgram(command);
     process.setArguments(args);
     process.start();
@@ -9,11 +9,13 @@
 
 #include "linglong/utils/error/error.h"
 
+#include <QList>
 #include <QStringList>
 
 namespace linglong::utils::command {
 
-error::Result<QString> Exec(QString command, QStringList args);
+// inheritFds中的描述符会在子进程中去掉close-on-exec标志，子进程可以通过/dev/fd/N访问
+error::Result<QString> Exec(QString command, QStringList args, QList<int> inheritFds = {});
 QStringList getUserEnv(const QStringList &filters);
 extern const QStringList envList;
 